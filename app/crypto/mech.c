@@ -49,64 +49,154 @@ static const struct aes_funcs
   { aes_decrypt_init, aes_decrypt, aes_decrypt_deinit }
 };
 
-static bool do_aes (crypto_op_t *co, bool with_cbc)
+/* CTR mode only ever uses the forward cipher */
+static const struct aes_funcs *stream_funcs (const crypto_stream_t *s)
 {
-  const struct aes_funcs *funcs = &aes_funcs[co->op];
+  return &aes_funcs[s->mode == MODE_CTR ? OP_ENCRYPT : s->op];
+}
 
-  void *ctx = funcs->init (co->key, co->keylen);
-  if (!ctx)
+static bool stream_init (crypto_stream_t *s, crypto_mode_t mode, int op,
+                         const char *key, size_t keylen,
+                         const char *iv, size_t ivlen)
+{
+  memset (s, 0, sizeof (*s));
+  s->mode = mode;
+  s->op = op;
+  s->ctx = stream_funcs (s)->init (key, keylen);
+  if (!s->ctx)
     return false;
 
-  char iv[AES_BLOCKSIZE] = { 0 };
-  if (with_cbc && co->ivlen)
-    memcpy (iv, co->iv, co->ivlen < AES_BLOCKSIZE ? co->ivlen : AES_BLOCKSIZE);
+  if (mode != MODE_ECB && ivlen)
+    memcpy (s->iv, iv, ivlen < AES_BLOCKSIZE ? ivlen : AES_BLOCKSIZE);
+  return true;
+}
 
-  const char *src = co->data;
-  char *dst = co->out;
+static void stream_block (crypto_stream_t *s, const char *in, char *out)
+{
+  const struct aes_funcs *funcs = stream_funcs (s);
+  int i;
 
-  size_t left = co->datalen;
-  while (left)
+  if (s->mode == MODE_CBC && s->op == OP_ENCRYPT)
   {
-    char block[AES_BLOCKSIZE] = { 0 };
-    size_t n = left > AES_BLOCKSIZE ? AES_BLOCKSIZE : left;
-    memcpy (block, src, n);
+    char block[AES_BLOCKSIZE];
+    for (i = 0; i < AES_BLOCKSIZE; ++i)
+      block[i] = in[i] ^ s->iv[i];
+    funcs->crypt (s->ctx, block, out);
+    memcpy (s->iv, out, AES_BLOCKSIZE);
+  }
+  else if (s->mode == MODE_CBC)
+  {
+    char prev[AES_BLOCKSIZE];
+    memcpy (prev, in, AES_BLOCKSIZE);
+    funcs->crypt (s->ctx, in, out);
+    for (i = 0; i < AES_BLOCKSIZE; ++i)
+      out[i] ^= s->iv[i];
+    memcpy (s->iv, prev, AES_BLOCKSIZE);
+  }
+  else
+    funcs->crypt (s->ctx, in, out);
+}
 
-    if (with_cbc && co->op == OP_ENCRYPT)
-    {
-      const char *xor = (src == co->data) ? iv : dst - AES_BLOCKSIZE;
-      int i;
-      for (i = 0; i < AES_BLOCKSIZE; ++i)
-        block[i] ^= xor[i];
-    }
+/* Encrypt the counter into the key stream, then increment it as a 128-bit
+ * big-endian integer, as per NIST SP 800-38A */
+static void stream_ctr_next (crypto_stream_t *s)
+{
+  int i;
+  stream_funcs (s)->crypt (s->ctx, s->iv, s->buf);
+  for (i = AES_BLOCKSIZE - 1; i >= 0 && ++s->iv[i] == 0; --i)
+    {}
+  s->buflen = AES_BLOCKSIZE;
+}
 
-    funcs->crypt (ctx, block, dst);
+size_t crypto_stream_update (crypto_stream_t *s, const char *in, size_t len, char *out)
+{
+  size_t n = 0;
 
-    if (with_cbc && co->op == OP_DECRYPT)
+  if (s->mode == MODE_CTR)
+  {
+    /* buflen is the number of unused key stream bytes at the end of buf */
+    for (; n < len; ++n)
     {
-      const char *xor = (src == co->data) ? iv : src - AES_BLOCKSIZE;
-      int i;
-      for (i = 0; i < AES_BLOCKSIZE; ++i)
-        dst[i] ^= xor[i];
+      if (!s->buflen)
+        stream_ctr_next (s);
+      out[n] = in[n] ^ s->buf[AES_BLOCKSIZE - s->buflen--];
     }
+    return n;
+  }
 
-    left -= n;
-    src += n;
-    dst += n;
+  while (len)
+  {
+    size_t take = AES_BLOCKSIZE - s->buflen;
+    if (take > len)
+      take = len;
+    if (take == AES_BLOCKSIZE)   /* whole block, so skip the copy */
+      stream_block (s, in, out + n);
+    else
+    {
+      memcpy (s->buf + s->buflen, in, take);
+      s->buflen += take;
+      if (s->buflen < AES_BLOCKSIZE)
+        break;
+      stream_block (s, s->buf, out + n);
+    }
+    s->buflen = 0;
+    n += AES_BLOCKSIZE;
+    in += take;
+    len -= take;
   }
+  return n;
+}
+
+size_t crypto_stream_finalize (crypto_stream_t *s, char *out)
+{
+  if (s->mode == MODE_CTR || !s->buflen)
+    return 0;
+  memset (s->buf + s->buflen, 0, AES_BLOCKSIZE - s->buflen);
+  stream_block (s, s->buf, out);
+  s->buflen = 0;
+  return AES_BLOCKSIZE;
+}
 
-  funcs->deinit (ctx);
+void crypto_stream_deinit (crypto_stream_t *s)
+{
+  if (s->ctx)
+    stream_funcs (s)->deinit (s->ctx);
+  s->ctx = NULL;
+}
+
+bool crypto_stream_init (crypto_stream_t *s, const crypto_mech_t *mech, int op,
+                         const char *key, size_t keylen,
+                         const char *iv, size_t ivlen)
+{
+  return stream_init (s, mech->mode, op, key, keylen, iv, ivlen);
+}
+
+static bool do_aes (crypto_op_t *co, crypto_mode_t mode)
+{
+  crypto_stream_t s;
+  if (!stream_init (&s, mode, co->op, co->key, co->keylen, co->iv, co->ivlen))
+    return false;
+
+  size_t n = crypto_stream_update (&s, co->data, co->datalen, co->out);
+  crypto_stream_finalize (&s, co->out + n);
+  crypto_stream_deinit (&s);
   return true;
 }
 
 
 static bool do_aes_ecb (crypto_op_t *co)
 {
-  return do_aes (co, false);
+  return do_aes (co, MODE_ECB);
 }
 
 static bool do_aes_cbc (crypto_op_t *co)
 {
-  return do_aes (co, true);
+  return do_aes (co, MODE_CBC);
+}
+
+static bool do_aes_ctr (crypto_op_t *co)
+{
+  return do_aes (co, MODE_CTR);
 }
 
 
@@ -114,8 +204,9 @@ static bool do_aes_cbc (crypto_op_t *co)
 
 static const crypto_mech_t mechs[] =
 {
-  { "AES-ECB",  do_aes_ecb, AES_BLOCKSIZE },
-  { "AES-CBC",  do_aes_cbc, AES_BLOCKSIZE }
+  { "AES-ECB",  do_aes_ecb, AES_BLOCKSIZE, MODE_ECB },
+  { "AES-CBC",  do_aes_cbc, AES_BLOCKSIZE, MODE_CBC },
+  { "AES-CTR",  do_aes_ctr, 1,             MODE_CTR }
 };
 
 
@@ -19,14 +19,46 @@ typedef struct
 } crypto_op_t;
 
 
+#define CRYPTO_MAX_BLOCKSIZE 16
+
+typedef enum { MODE_ECB, MODE_CBC, MODE_CTR } crypto_mode_t;
+
 typedef struct
 {
   const char *name;
   bool (*run) (crypto_op_t *op);
   uint16_t block_size;
+  crypto_mode_t mode;
 } crypto_mech_t;
 
 
+/* State for an incremental encryption or decryption, so that data can be
+ * processed in pieces of any length.  Output is produced a whole block at
+ * a time, and crypto_stream_finalize() zero pads any final partial block
+ * just as the one-shot run() does.  CTR is a stream mode, so it needs no
+ * padding and its output is always the same length as its input.
+ */
+typedef struct
+{
+  void *ctx;
+  crypto_mode_t mode;
+  uint8_t op;
+  uint8_t buflen;
+  char iv[CRYPTO_MAX_BLOCKSIZE];   /* CBC chaining block or CTR counter */
+  char buf[CRYPTO_MAX_BLOCKSIZE];  /* partial input block or CTR key stream */
+} crypto_stream_t;
+
+
 const crypto_mech_t *crypto_encryption_mech (const char *name);
 
+bool crypto_stream_init (crypto_stream_t *s, const crypto_mech_t *mech, int op,
+                         const char *key, size_t keylen,
+                         const char *iv, size_t ivlen);
+/* out must have room for len + CRYPTO_MAX_BLOCKSIZE bytes; returns the
+ * number of bytes written */
+size_t crypto_stream_update (crypto_stream_t *s, const char *in, size_t len, char *out);
+/* out must have room for CRYPTO_MAX_BLOCKSIZE bytes */
+size_t crypto_stream_finalize (crypto_stream_t *s, char *out);
+void crypto_stream_deinit (crypto_stream_t *s);
+
 #endif
@@ -12,6 +12,8 @@ static struct input_state {
   size_t      len;
   const char *prompt;
   uart_cb_t   uart_cb;
+  uart_hw_cb_t highwater_cb;
+  size_t      highwater;
   platform_task_handle_t input_sig;
   int         data_len;
   bool        run_input;
@@ -19,6 +21,11 @@ static struct input_state {
   char        last_char;
   char        end_char;
   uint8       input_sig_flag;
+  uint8       frame_mode;     // INPUT_FRAME_xxx
+  uint8       frame_param;    // idle time or length prefix size
+  uint8       frame_hdr;      // length prefix bytes received so far
+  bool        frame_oversize; // current frame is being discarded
+  int         frame_need;     // payload bytes still to come for INPUT_FRAME_LENGTH
 } ins = {0};
 
 #define NUL '\0'
@@ -42,7 +49,7 @@ static bool uart_getc(char *c){
     // ETS_UART_INTR_DISABLE();
     ETS_INTR_LOCK();
     *c = (char)*(pRxBuff->pReadPos);
-    if (pRxBuff->pReadPos == (pRxBuff->pRcvMsgBuff + RX_BUFF_SIZE)) {
+    if (pRxBuff->pReadPos == (pRxBuff->pRcvMsgBuff + pRxBuff->RcvBuffSize)) {
         pRxBuff->pReadPos = pRxBuff->pRcvMsgBuff ;
     } else {
         pRxBuff->pReadPos++;
@@ -71,6 +78,11 @@ static void input_handler(platform_task_param_t flag, uint8 priority) {
     return;
   }
   ins.input_sig_flag = flag & 0x1;
+  if (ins.highwater_cb) {
+    size_t fill = uart0_rx_count();
+    if (fill >= ins.highwater)
+      ins.highwater_cb(fill);
+  }
   while (input_readline()) {}
 }
 
@@ -95,12 +107,57 @@ void input_setup(int bufsize, const char *prompt) {
 }
 
 void input_setup_receive(uart_cb_t uart_on_data_cb, int data_len, char end_char, bool run_input) {
+  input_setup_frame(NULL, INPUT_FRAME_NONE, 0);
   ins.uart_cb   = uart_on_data_cb;
   ins.data_len  = data_len;
   ins.end_char  = end_char;
   ins.run_input = run_input;
 }
 
+/*
+** input_setup_frame() switches to binary input, where complete frames are
+** assembled in C before being passed to uart_cb.  In INPUT_FRAME_IDLE mode a
+** frame ends when the line has been idle for param character times, and in
+** INPUT_FRAME_LENGTH mode each frame starts with a big endian length prefix
+** of param bytes.  Frames which do not fit in the input buffer are dropped.
+*/
+void input_setup_frame(uart_cb_t uart_on_frame_cb, int mode, int param) {
+  if (mode == INPUT_FRAME_NONE) {
+    if (ins.frame_mode == INPUT_FRAME_IDLE)
+      uart0_rx_idle(0);
+    ins.frame_mode = INPUT_FRAME_NONE;
+    return;
+  }
+  ins.uart_cb        = uart_on_frame_cb;
+  ins.run_input      = false;
+  ins.line_pos       = 0;
+  ins.frame_mode     = mode;
+  ins.frame_param    = param;
+  ins.frame_hdr      = 0;
+  ins.frame_need     = 0;
+  ins.frame_oversize = false;
+  uart0_rx_idle(mode == INPUT_FRAME_IDLE ? param : 0);
+}
+
+/*
+** Grow the input buffer so that it can hold frames of up to len bytes
+*/
+bool input_setup_framelen(size_t len) {
+  char *data;
+  if (len <= ins.len)
+    return true;
+  if (!(data = os_realloc(ins.data, len)))
+    return false;
+  ins.data = data;
+  ins.len  = len;
+  return true;
+}
+
+void input_setup_highwater(uart_hw_cb_t uart_on_highwater_cb, size_t level) {
+  ins.highwater_cb = uart_on_highwater_cb;
+  ins.highwater    = level;
+}
+
 void input_setecho (bool flag) {
   ins.uart_echo = flag;
 }
@@ -120,6 +177,50 @@ void input_setprompt (const char *prompt) {
 */
 extern void lua_input_string (const char *line, int len);
 
+static void input_frame_add(char ch) {
+  if (ins.line_pos >= ins.len)
+    ins.frame_oversize = true;
+  else
+    ins.data[ins.line_pos++] = ch;
+}
+
+static void input_frame_end(void) {
+  if (ins.frame_oversize)
+    uart0_rx_stats()->oversize++;
+  else if (ins.uart_cb)
+    ins.uart_cb(ins.data, ins.line_pos);
+  ins.line_pos = 0;
+  ins.frame_oversize = false;
+}
+
+static void input_read_frames(void) {
+  char ch;
+  if (ins.frame_mode == INPUT_FRAME_IDLE) {
+    uint8 *gap;
+    /* bytes stay in the Rx buffer until the end of their frame has been seen */
+    while ((gap = uart0_rx_next_gap()) != NULL) {
+      while (UartDev.rcv_buff.pReadPos != gap && uart_getc(&ch))
+        input_frame_add(ch);
+      uart0_rx_drop_gap(gap);
+      input_frame_end();
+    }
+  } else {
+    while (uart_getc(&ch)) {
+      if (ins.frame_hdr < ins.frame_param) {
+        ins.frame_need = (ins.frame_need << 8) | (uint8)ch;
+        if (++ins.frame_hdr < ins.frame_param || ins.frame_need > 0)
+          continue;
+      } else {
+        input_frame_add(ch);
+        if (--ins.frame_need > 0)
+          continue;
+      }
+      input_frame_end();
+      ins.frame_hdr = 0;
+    }
+  }
+}
+
 static bool input_readline(void) {
   char ch = NUL;
   if (ins.run_input) {
@@ -169,6 +270,8 @@ static bool input_readline(void) {
       ins.data[ins.line_pos++] = ch;
     }
 
+  } else if (ins.frame_mode != INPUT_FRAME_NONE) {
+    input_read_frames();
   } else {
 
     if (!ins.uart_cb) {
@@ -374,6 +374,156 @@ void spi_mast_transaction(uint8 spi_no, uint8 cmd_bitlen, uint16 cmd_data, uint8
 }
 
 
+/******************************************************************************
+ * Asynchronous block transfers.  Each chunk of up to 64 bytes is loaded
+ * into the W0-W15 FIFO and the transaction done interrupt unloads it and
+ * starts the next, so the CPU is only needed between chunks.  Only HSPI
+ * is supported, as SPI is shared with the flash.
+*******************************************************************************/
+static struct {
+    const uint8 *out;
+    uint8 *in;
+    size_t len, pos, chunk;
+    void (*done)(void *arg);
+    void *arg;
+    void (*prev)(void *);
+    void *prev_arg;
+    uint8 busy;
+} spi_async;
+
+static void ICACHE_RAM_ATTR spi_async_load(void)
+{
+    const uint8 *p = spi_async.out + spi_async.pos;
+    size_t n = spi_async.len - spi_async.pos, i;
+
+    if (n > 64)
+        n = 64;
+    // assemble words bytewise as the data need not be aligned
+    for (i = 0; i < n; i += 4) {
+        uint32 w = p[i];
+        if (i + 1 < n) w |= p[i + 1] << 8;
+        if (i + 2 < n) w |= p[i + 2] << 16;
+        if (i + 3 < n) w |= p[i + 3] << 24;
+        WRITE_PERI_REG(SPI_W0(SPI_HSPI) + i, w);
+    }
+    spi_async.chunk = n;
+    WRITE_PERI_REG(SPI_USER1(SPI_HSPI),
+                   ((n * 8 - 1) & SPI_USR_MOSI_BITLEN) << SPI_USR_MOSI_BITLEN_S);
+    SET_PERI_REG_MASK(SPI_CMD(SPI_HSPI), SPI_USR);
+}
+
+// The SPI, HSPI and I2S events share one level 2 interrupt, so the handler
+// which was attached before is recorded and events which are not ours are
+// passed on to it rather than lost.
+static void (*spi_isr_fn)(void *);
+static void *spi_isr_arg;
+
+static void spi_intr_attach(void (*fn)(void *), void *arg)
+{
+    spi_isr_fn  = fn;
+    spi_isr_arg = arg;
+    ETS_SPI_INTR_ATTACH(fn, arg);
+}
+
+static void ICACHE_RAM_ATTR spi_async_chain(void)
+{
+    if (spi_async.prev) {
+        spi_async.prev(spi_async.prev_arg);
+    } else if (READ_PERI_REG(0x3ff00020) & BIT4) {
+        // must be cleared as in spi_slave_isr_handler()
+        CLEAR_PERI_REG_MASK(SPI_SLAVE(SPI_SPI), 0x3ff);
+    }
+}
+
+static void ICACHE_RAM_ATTR spi_async_isr(void *para)
+{
+    size_t i;
+
+    if (!spi_async.busy ||
+        !(READ_PERI_REG(0x3ff00020) & BIT7) ||                 // bit7 is for hspi isr
+        !(READ_PERI_REG(SPI_SLAVE(SPI_HSPI)) & SPI_TRANS_DONE)) {
+        spi_async_chain();
+        return;
+    }
+    CLEAR_PERI_REG_MASK(SPI_SLAVE(SPI_HSPI), SPI_TRANS_DONE);
+
+    if (spi_async.in) {
+        // in is word aligned and sized to a multiple of 4 bytes
+        uint32 *in = (uint32 *)(spi_async.in + spi_async.pos);
+        for (i = 0; i < spi_async.chunk; i += 4)
+            *in++ = READ_PERI_REG(SPI_W0(SPI_HSPI) + i);
+    }
+    spi_async.pos += spi_async.chunk;
+
+    if (spi_async.pos < spi_async.len) {
+        spi_async_load();
+    } else {
+        CLEAR_PERI_REG_MASK(SPI_SLAVE(SPI_HSPI), SPI_TRANS_DONE_EN);
+        spi_async.busy = 0;
+        spi_async.done(spi_async.arg);
+    }
+    // an SPI event raised at the same time still needs its handler
+    if (READ_PERI_REG(0x3ff00020) & BIT4)
+        spi_async_chain();
+}
+
+/******************************************************************************
+ * FunctionName : spi_mast_async_transfer
+ * Description  : Start a block transfer of any length which runs in the
+ *                background, calling done(arg) from the ISR on completion.
+ * Parameters   : uint8 spi_no - SPI module number, only "HSPI" is valid
+ *                const uint8 *out - data to send, which must be in RAM and
+ *                                   remain valid until done() is called
+ *                uint8 *in - word aligned buffer for the received data, sized
+ *                            to a multiple of 4 bytes, or NULL for half-duplex
+ *                size_t len - number of bytes to transfer
+ * Returns      : 0 if started, -1 if the bus is busy or the args are invalid
+*******************************************************************************/
+int spi_mast_async_transfer(uint8 spi_no, const uint8 *out, uint8 *in, size_t len,
+                            void (*done)(void *arg), void *arg)
+{
+    if (spi_no != SPI_HSPI || spi_async.busy || len == 0 || !done)
+        return -1;
+
+    while(READ_PERI_REG(SPI_CMD(spi_no)) & SPI_USR);
+
+    CLEAR_PERI_REG_MASK(SPI_USER(spi_no), SPI_USR_COMMAND|SPI_USR_ADDR|SPI_USR_MOSI|SPI_USR_DUMMY|SPI_USR_MISO|SPI_DOUTDIN);
+    SET_PERI_REG_MASK(SPI_USER(spi_no), in ? SPI_USR_MOSI|SPI_DOUTDIN : SPI_USR_MOSI);
+
+    spi_async.out  = out;
+    spi_async.in   = in;
+    spi_async.len  = len;
+    spi_async.pos  = 0;
+    spi_async.done = done;
+    spi_async.arg  = arg;
+    spi_async.busy = 1;
+
+    if (spi_isr_fn != spi_async_isr) {
+        //register level2 isr function, which contains spi, hspi and i2s events,
+        //chaining to the handler it replaces
+        spi_async.prev     = spi_isr_fn;
+        spi_async.prev_arg = spi_isr_arg;
+        spi_intr_attach(spi_async_isr, NULL);
+        ETS_SPI_INTR_ENABLE();
+    }
+    CLEAR_PERI_REG_MASK(SPI_SLAVE(spi_no), SPI_TRANS_DONE);
+    SET_PERI_REG_MASK(SPI_SLAVE(spi_no), SPI_TRANS_DONE_EN);
+
+    spi_async_load();
+    return 0;
+}
+
+/******************************************************************************
+ * FunctionName : spi_mast_async_busy
+ * Description  : Check whether an asynchronous transfer is in progress
+ * Parameters   : uint8 spi_no - SPI module number
+*******************************************************************************/
+bool spi_mast_async_busy(uint8 spi_no)
+{
+    return spi_no == SPI_HSPI && spi_async.busy;
+}
+
+
 /******************************************************************************
  * FunctionName : spi_byte_write_espslave
  * Description  : SPI master 1 byte transmission function for esp8266 slave,
@@ -497,7 +647,7 @@ void spi_slave_init(uint8 spi_no)
     //maybe enable slave transmission liston
     SET_PERI_REG_MASK(SPI_CMD(spi_no),SPI_USR);
     //register level2 isr function, which contains spi, hspi and i2s events
-    ETS_SPI_INTR_ATTACH(spi_slave_isr_handler,NULL);
+    spi_intr_attach(spi_slave_isr_handler,NULL);
     //enable level2 isr, which contains spi, hspi and i2s events
     ETS_SPI_INTR_ENABLE();
 }
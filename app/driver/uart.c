@@ -16,6 +16,7 @@
 #include "user_config.h"
 #include "user_interface.h"
 #include "osapi.h"
+#include "mem.h"
 
 #define UART0   0
 #define UART1   1
@@ -40,8 +41,18 @@ static os_timer_t autobaud_timer;
 #endif
 static void (*alt_uart0_tx)(char txchar);
 
+// UART0 receive framing and error accounting, see uart0_rx_idle()
+#define RX_GAP_QUEUE        16
+#define RX_IDLE_TRIG_LVL    100   // RX FIFO (128 bytes) threshold while idle framing
+static uint8 rx_idle;             // idle gap in character times, 0 if disabled
+static uint8 *rx_gap[RX_GAP_QUEUE];
+static volatile uint8 rx_gap_head, rx_gap_tail;
+static uint8 *rx_buff_alloc;      // set once the ROM's RX buffer has been replaced
+static UartRxStats rx_stats;
+
 LOCAL void ICACHE_RAM_ATTR
 uart0_rx_intr_handler(void *para);
+LOCAL void uart0_rx_config(void);
 
 
 /******************************************************************************
@@ -95,13 +106,17 @@ uart_config(uint8 uart_no)
     SET_PERI_REG_MASK(UART_CONF0(uart_no), UART_RXFIFO_RST | UART_TXFIFO_RST);
     CLEAR_PERI_REG_MASK(UART_CONF0(uart_no), UART_RXFIFO_RST | UART_TXFIFO_RST);
 
-    //set rx fifo trigger
-    WRITE_PERI_REG(UART_CONF1(uart_no), (UartDev.rcv_buff.TrigLvl & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S);
-
     //clear all interrupt
     WRITE_PERI_REG(UART_INT_CLR(uart_no), 0xffff);
-    //enable rx_interrupt
-    SET_PERI_REG_MASK(UART_INT_ENA(uart_no), UART_RXFIFO_FULL_INT_ENA);
+
+    if (uart_no == UART0) {
+        uart0_rx_config();
+    } else {
+        //set rx fifo trigger
+        WRITE_PERI_REG(UART_CONF1(uart_no), (UartDev.rcv_buff.TrigLvl & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S);
+        //enable rx_interrupt
+        SET_PERI_REG_MASK(UART_INT_ENA(uart_no), UART_RXFIFO_FULL_INT_ENA);
+    }
 }
 
 
@@ -244,16 +259,31 @@ uart0_rx_intr_handler(void *para)
      * uart1 and uart0 respectively
      */
     RcvMsgBuff *pRxBuff = (RcvMsgBuff *)para;
+    uint8 *pBuffEnd = pRxBuff->pRcvMsgBuff + pRxBuff->RcvBuffSize;
     uint8 RcvChar;
     bool got_input = false;
+    uint32 status = READ_PERI_REG(UART_INT_ST(UART0)) &
+                    (UART_RXFIFO_FULL_INT_ST | UART_RXFIFO_TOUT_INT_ST | UART_RXFIFO_OVF_INT_ST |
+                     UART_FRM_ERR_INT_ST | UART_PARITY_ERR_INT_ST);
+    uint32 count;
 
-    if (UART_RXFIFO_FULL_INT_ST != (READ_PERI_REG(UART_INT_ST(UART0)) & UART_RXFIFO_FULL_INT_ST)) {
+    if (!status) {
         return;
     }
 
-    WRITE_PERI_REG(UART_INT_CLR(UART0), UART_RXFIFO_FULL_INT_CLR);
+    WRITE_PERI_REG(UART_INT_CLR(UART0), status);
 
-    while (READ_PERI_REG(UART_STATUS(UART0)) & (UART_RXFIFO_CNT << UART_RXFIFO_CNT_S)) {
+    if (status & UART_RXFIFO_OVF_INT_ST)  rx_stats.fifo_overflow++;
+    if (status & UART_FRM_ERR_INT_ST)     rx_stats.frame_error++;
+    if (status & UART_PARITY_ERR_INT_ST)  rx_stats.parity_error++;
+
+    count = (READ_PERI_REG(UART_STATUS(UART0)) >> UART_RXFIFO_CNT_S) & UART_RXFIFO_CNT;
+    // While idle framing, leave a byte in the FIFO so that the timeout still fires
+    if (rx_idle && count && !(status & UART_RXFIFO_TOUT_INT_ST)) {
+        count--;
+    }
+
+    while (count--) {
         RcvChar = READ_PERI_REG(UART_FIFO(UART0)) & 0xFF;
 
         /* you can add your handle code below.*/
@@ -265,24 +295,37 @@ uart0_rx_intr_handler(void *para)
             pRxBuff->BuffState = WRITE_OVER;
         }
 
-        if (pRxBuff->pWritePos == (pRxBuff->pRcvMsgBuff + RX_BUFF_SIZE)) {
-            // overflow ...we may need more error handle here.
+        if (pRxBuff->pWritePos == pBuffEnd) {
             pRxBuff->pWritePos = pRxBuff->pRcvMsgBuff ;
         } else {
             pRxBuff->pWritePos++;
         }
 
         if (pRxBuff->pWritePos == pRxBuff->pReadPos){   // overflow one byte, need push pReadPos one byte ahead
-            if (pRxBuff->pReadPos == (pRxBuff->pRcvMsgBuff + RX_BUFF_SIZE)) {
+            if (pRxBuff->pReadPos == pBuffEnd) {
                 pRxBuff->pReadPos = pRxBuff->pRcvMsgBuff ;
             } else {
                 pRxBuff->pReadPos++;
             }
+            rx_stats.overrun++;
+            // the frame boundaries no longer line up with the data
+            rx_gap_tail = rx_gap_head;
         }
 
         got_input = true;
     }
 
+    if (got_input && (status & UART_RXFIFO_TOUT_INT_ST)) {
+        // the line has gone idle, so this is the end of a frame
+        uint8 next = (rx_gap_head + 1) % RX_GAP_QUEUE;
+        if (next == rx_gap_tail) {
+            rx_stats.frame_overflow++;
+        } else {
+            rx_gap[rx_gap_head] = pRxBuff->pWritePos;
+            rx_gap_head = next;
+        }
+    }
+
     if (got_input && sig) {
       // Only post a new handler request once the handler has fired clearing the last post
       if (isr_flag == *sig_flag) {
@@ -335,6 +378,7 @@ uart_stop_autobaud()
 void ICACHE_FLASH_ATTR
 uart_init(UartBautRate uart0_br, UartBautRate uart1_br)
 {
+    UartDev.rcv_buff.RcvBuffSize = RX_BUFF_SIZE;
     // rom use 74880 baut_rate, here reinitialize
     UartDev.baut_rate = uart0_br;
     uart_config(UART0);
@@ -389,3 +433,126 @@ UartConfig ICACHE_FLASH_ATTR uart_get_config(uint8 uart_no) {
 
   return config;
 }
+
+/******************************************************************************
+ * FunctionName : uart0_rx_config
+ * Description  : Internal used function
+ *                Set the UART0 RX FIFO threshold, idle timeout and interrupts
+ *                according to the current framing mode
+ * Parameters   : NONE
+ * Returns      : NONE
+*******************************************************************************/
+LOCAL void ICACHE_FLASH_ATTR
+uart0_rx_config(void)
+{
+    uint32 conf1, ena = UART_RXFIFO_FULL_INT_ENA | UART_RXFIFO_OVF_INT_ENA |
+                        UART_FRM_ERR_INT_ENA | UART_PARITY_ERR_INT_ENA;
+
+    if (rx_idle) {
+        conf1 = ((RX_IDLE_TRIG_LVL & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S) |
+                ((rx_idle & UART_RX_TOUT_THRHD) << UART_RX_TOUT_THRHD_S) | UART_RX_TOUT_EN;
+        ena |= UART_RXFIFO_TOUT_INT_ENA;
+    } else {
+        conf1 = (UartDev.rcv_buff.TrigLvl & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S;
+    }
+    WRITE_PERI_REG(UART_CONF1(UART0), conf1);
+    WRITE_PERI_REG(UART_INT_ENA(UART0), ena);
+}
+
+/******************************************************************************
+ * FunctionName : uart0_rx_buffer
+ * Description  : Replace the UART0 RX ring buffer, discarding any pending data
+ * Parameters   : size_t size - new buffer size in bytes
+ * Returns      : false if the buffer could not be allocated
+*******************************************************************************/
+bool ICACHE_FLASH_ATTR
+uart0_rx_buffer(size_t size)
+{
+    RcvMsgBuff *pRxBuff = &(UartDev.rcv_buff);
+    // the read and write positions run up to and including pRcvMsgBuff + size
+    uint8 *buf = (uint8 *) os_malloc(size + 1), *old;
+
+    if (!buf) {
+        return false;
+    }
+    ETS_UART_INTR_DISABLE();
+    old = rx_buff_alloc;
+    rx_buff_alloc = buf;
+    pRxBuff->pRcvMsgBuff = pRxBuff->pWritePos = pRxBuff->pReadPos = buf;
+    pRxBuff->RcvBuffSize = size;
+    rx_gap_tail = rx_gap_head;
+    ETS_UART_INTR_ENABLE();
+    if (old) {
+        os_free(old);
+    }
+    return true;
+}
+
+/******************************************************************************
+ * FunctionName : uart0_rx_count
+ * Description  : Number of bytes waiting in the UART0 RX ring buffer
+*******************************************************************************/
+size_t ICACHE_FLASH_ATTR
+uart0_rx_count(void)
+{
+    RcvMsgBuff *pRxBuff = &(UartDev.rcv_buff);
+    int n = pRxBuff->pWritePos - pRxBuff->pReadPos;
+    return n < 0 ? n + pRxBuff->RcvBuffSize + 1 : n;
+}
+
+/******************************************************************************
+ * FunctionName : uart0_rx_idle
+ * Description  : Enable or disable frame boundary detection on UART0. A
+ *                boundary is recorded whenever the line has been idle for
+ *                the given time after receiving data.
+ * Parameters   : uint8 chars - idle time in character times, 0 to disable
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR
+uart0_rx_idle(uint8 chars)
+{
+    ETS_UART_INTR_DISABLE();
+    rx_idle = chars & UART_RX_TOUT_THRHD;
+    rx_gap_tail = rx_gap_head;
+    uart0_rx_config();
+    ETS_UART_INTR_ENABLE();
+}
+
+/******************************************************************************
+ * FunctionName : uart0_rx_next_gap
+ * Description  : Get the oldest frame boundary found by idle detection
+ * Returns      : position in the RX buffer of the end of the frame, or NULL
+*******************************************************************************/
+uint8 * ICACHE_FLASH_ATTR
+uart0_rx_next_gap(void)
+{
+    return rx_gap_tail == rx_gap_head ? NULL : rx_gap[rx_gap_tail];
+}
+
+/******************************************************************************
+ * FunctionName : uart0_rx_drop_gap
+ * Description  : Discard a frame boundary returned by uart0_rx_next_gap()
+ * Parameters   : uint8 *gap - the boundary
+ * Returns      : NONE
+*******************************************************************************/
+void ICACHE_FLASH_ATTR
+uart0_rx_drop_gap(uint8 *gap)
+{
+    ETS_INTR_LOCK();
+    // the queue may have been reset by an overrun in the meantime
+    if (rx_gap_tail != rx_gap_head && rx_gap[rx_gap_tail] == gap) {
+        rx_gap_tail = (rx_gap_tail + 1) % RX_GAP_QUEUE;
+    }
+    ETS_INTR_UNLOCK();
+}
+
+/******************************************************************************
+ * FunctionName : uart0_rx_stats
+ * Description  : Access the UART0 receive error counters
+ * Returns      : pointer to the counters, which may be reset by the caller
+*******************************************************************************/
+UartRxStats * ICACHE_FLASH_ATTR
+uart0_rx_stats(void)
+{
+    return &rx_stats;
+}
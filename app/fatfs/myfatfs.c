@@ -59,6 +59,8 @@ static vfs_fs_fns myfatfs_fs_fns = {
   .mkdir    = myfatfs_mkdir,
   .fsinfo   = myfatfs_fsinfo,
   .fscfg    = NULL,
+  .fscache  = NULL,
+  .fsstats  = NULL,
   .format   = NULL,
   .chdrive  = myfatfs_chdrive,
   .chdir    = myfatfs_chdir,
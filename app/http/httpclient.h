@@ -37,7 +37,8 @@ static const char log_prefix[] = "HTTP client: ";
 #define HTTP_STATUS_GENERIC_ERROR  (-1)
 
 /*
- * Size of http responses that will cause an error.
+ * Size of http responses that will cause an error.  For streamed requests this
+ * only limits the size of the response headers.
  */
 #define BUFFER_SIZE_MAX            (0x2000)
 
@@ -46,6 +47,16 @@ static const char log_prefix[] = "HTTP client: ";
  */
 #define HTTP_REQUEST_TIMEOUT_MS    (60000)
 
+/*
+ * Default time an unused keep-alive connection is kept open.
+ */
+#define HTTP_POOL_IDLE_TIMEOUT_MS  (30000)
+
+/*
+ * Most requests sent on a connection ahead of their responses.
+ */
+#define HTTP_PIPELINE_MAX          (4)
+
 /*
  * "full_response" is a string containing all response headers and the response body.
  * "response_body and "http_status" are extracted from "full_response" for convenience.
@@ -53,52 +64,96 @@ static const char log_prefix[] = "HTTP client: ";
  * A successful request corresponds to an HTTP status code of 200 (OK).
  * More info at http://en.wikipedia.org/wiki/List_of_HTTP_status_codes
  */
-typedef void (* http_callback_t)(char * response_body, int http_status, char ** full_response_p, int body_size);
+typedef void (* http_callback_t)(char * response_body, int http_status, char ** full_response_p, int body_size, void * arg);
+
+/*
+ * A streamed request hands the response over as it arrives rather than collecting it,
+ * so its size is not limited by BUFFER_SIZE_MAX.
+ * "headers" is called once with the status and the header block, which starts with the
+ * status line and has one "Name: value\r\n" per header.  "data" is called for each
+ * piece of the body, after any chunked transfer encoding has been removed; returning
+ * non-zero aborts the transfer.  "done" is always called last, with the status or
+ * HTTP_STATUS_GENERIC_ERROR if the response was not received in full.  Redirects are
+ * followed before "headers" is called.
+ */
+typedef struct {
+	void	(* headers)(void * arg, int http_status, const char * headers);
+	int	(* data)(void * arg, const char * data, int len);
+	void	(* done)(void * arg, int http_status);
+	void	* arg;
+} http_stream_t;
 
 /*
  * Call this function to skip URL parsing if the arguments are already in separate variables.
  */
-void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool secure, const char * method, const char * path, const char * headers, const char * post_data, http_callback_t callback_handle, int redirect_follow_count);
+void ICACHE_FLASH_ATTR http_raw_request(const char * hostname, int port, bool secure, const char * method, const char * path, const char * headers, const char * post_data, http_callback_t callback_handle, void * callback_arg, int redirect_follow_count);
 
 /*
  * Request data from URL use custom method.
  * The data should be encoded as any format.
  * Try:
- * http_request("http://httpbin.org/post", "OPTIONS", "Content-type: text/plain", "Hello world", http_callback_example, 0);
+ * http_request("http://httpbin.org/post", "OPTIONS", "Content-type: text/plain", "Hello world", http_callback_example, NULL, 0);
  */
-void ICACHE_FLASH_ATTR http_request(const char * url, const char * method, const char * headers, const char * post_data, http_callback_t callback_handle, int redirect_follow_count);
+void ICACHE_FLASH_ATTR http_request(const char * url, const char * method, const char * headers, const char * post_data, http_callback_t callback_handle, void * callback_arg, int redirect_follow_count);
+
+/*
+ * Like http_request(), but the response is streamed to the "stream" callbacks.
+ */
+void ICACHE_FLASH_ATTR http_stream_request(const char * url, const char * method, const char * headers, const char * post_data, const http_stream_t * stream);
 
 /*
  * Post data to a web form.
  * The data should be encoded as any format.
  * Try:
- * http_post("http://httpbin.org/post", "Content-type: application/json", "{\"hello\": \"world\"}", http_callback_example);
+ * http_post("http://httpbin.org/post", "Content-type: application/json", "{\"hello\": \"world\"}", http_callback_example, NULL);
  */
-void ICACHE_FLASH_ATTR http_post(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle);
+void ICACHE_FLASH_ATTR http_post(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle, void * callback_arg);
 
 /*
  * Download a web page from its URL.
  * Try:
- * http_get("http://wtfismyip.com/text", NULL, http_callback_example);
+ * http_get("http://wtfismyip.com/text", NULL, http_callback_example, NULL);
  */
-void ICACHE_FLASH_ATTR http_get(const char * url, const char * headers, http_callback_t callback_handle);
+void ICACHE_FLASH_ATTR http_get(const char * url, const char * headers, http_callback_t callback_handle, void * callback_arg);
 /*
  * Delete a web page from its URL.
  * Try:
- * http_delete("http://wtfismyip.com/text", NULL, http_callback_example);
+ * http_delete("http://wtfismyip.com/text", NULL, http_callback_example, NULL);
  */
-void ICACHE_FLASH_ATTR http_delete(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle);
+void ICACHE_FLASH_ATTR http_delete(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle, void * callback_arg);
 /*
  * Update data to a web form.
  * The data should be encoded as any format.
  * Try:
- * http_put("http://httpbin.org/post", "Content-type: application/json", "{\"hello\": \"world\"}", http_callback_example);
+ * http_put("http://httpbin.org/post", "Content-type: application/json", "{\"hello\": \"world\"}", http_callback_example, NULL);
+ */
+void ICACHE_FLASH_ATTR http_put(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle, void * callback_arg);
+
+/*
+ * Requests to the same server share connections when the pool is enabled: they
+ * are sent with "Connection: keep-alive", and up to "size" connections that have
+ * answered all their requests are kept open for "idle_ms" for reuse.  Idempotent
+ * requests are pipelined on a connection that is still busy, and sent again on a
+ * new connection if the server closes a kept one before answering.  A size of 0,
+ * the default, disables the pool and closes idle connections.
  */
-void ICACHE_FLASH_ATTR http_put(const char * url, const char * headers, const char * post_data, http_callback_t callback_handle);
+void ICACHE_FLASH_ATTR http_pool_config(int size, uint32_t idle_ms);
+
+typedef struct {
+	uint32_t	hits;		/* requests sent on an open connection */
+	uint32_t	misses;		/* requests that opened a new connection */
+	uint32_t	pipelined;	/* hits sent ahead of an earlier response */
+	uint32_t	retries;	/* requests sent again after a kept connection closed */
+	uint32_t	handshakes;	/* connections established, including TLS */
+	uint32_t	handshake_us;	/* total time spent establishing them */
+	uint32_t	handshake_max_us;
+} http_pool_stats_t;
+
+void ICACHE_FLASH_ATTR http_pool_stats(http_pool_stats_t * stats, bool reset);
 
 /*
  * Output on the UART.
  */
-void http_callback_example(char * response, int http_status, char * full_response);
+void http_callback_example(char * response, int http_status, char ** full_response_p, int body_size, void * arg);
 
 #endif // __HTTPCLIENT_H__
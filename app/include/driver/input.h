@@ -1,9 +1,17 @@
 #ifndef READLINE_APP_H
 #define READLINE_APP_H
 typedef void (*uart_cb_t)(const char *buf, size_t len);
+typedef void (*uart_hw_cb_t)(size_t fill);
+
+#define INPUT_FRAME_NONE   0
+#define INPUT_FRAME_IDLE   1
+#define INPUT_FRAME_LENGTH 2
 
 extern void input_setup(int bufsize, const char *prompt);
 extern void input_setup_receive(uart_cb_t uart_on_data_cb, int data_len, char end_char, bool run_input);
+extern void input_setup_frame(uart_cb_t uart_on_frame_cb, int mode, int param);
+extern bool input_setup_framelen(size_t len);
+extern void input_setup_highwater(uart_hw_cb_t uart_on_highwater_cb, size_t level);
 extern void input_setecho (bool flag);
 extern void input_setprompt (const char *prompt);
 
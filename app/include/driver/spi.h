@@ -35,6 +35,10 @@ uint32 spi_mast_get_miso(uint8 spi_no, uint16 offset, uint8 bitlen);
 // initiate SPI transaction
 void spi_mast_transaction(uint8 spi_no, uint8 cmd_bitlen, uint16 cmd_data, uint8 addr_bitlen, uint32 addr_data,
                           uint16 mosi_bitlen, uint8 dummy_bitlen, sint16 miso_bitlen);
+// start a background block transfer of any length, HSPI only
+int spi_mast_async_transfer(uint8 spi_no, const uint8 *out, uint8 *in, size_t len,
+                            void (*done)(void *arg), void *arg);
+bool spi_mast_async_busy(uint8 spi_no);
 
 //transmit data to esp8266 slave buffer,which needs 16bit transmission ,
 //first byte is master command 0x04, second byte is master data
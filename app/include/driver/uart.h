@@ -110,6 +110,15 @@ typedef struct {
     UartStopBitsNum   stop_bits;
 } UartConfig;
 
+typedef struct {
+    uint32   overrun;        // bytes lost as the RX buffer was full
+    uint32   fifo_overflow;  // hardware RX FIFO overflows
+    uint32   frame_error;    // characters received with a bad stop bit
+    uint32   parity_error;   // characters received with a bad parity bit
+    uint32   oversize;       // frames discarded as too long for the frame buffer
+    uint32   frame_overflow; // frame boundaries lost as too many frames were waiting
+} UartRxStats;
+
 void uart_init(UartBautRate uart0_br, UartBautRate uart1_br);
 void uart_init_task(os_signal_t sig_input, uint8 *flag_input);
 UartConfig uart_get_config(uint8 uart_no);
@@ -121,5 +130,11 @@ void uart0_tx_buffer(uint8 *buf, uint16 len);
 void uart_setup(uint8 uart_no);
 STATUS uart_tx_one_char(uint8 uart, uint8 TxChar);
 void uart_set_alt_output_uart0(void (*fn)(char));
+bool uart0_rx_buffer(size_t size);
+size_t uart0_rx_count(void);
+void uart0_rx_idle(uint8 chars);
+uint8 *uart0_rx_next_gap(void);
+void uart0_rx_drop_gap(uint8 *gap);
+UartRxStats *uart0_rx_stats(void);
 #endif
 
@@ -81,6 +81,15 @@
 
 //#define LUA_FLASH_STORE                   0x10000
 
+// Defining LUA_FLASH_STORE_DUAL_BANK also allocates a second LFS partition of
+// the same size by default.  New LFS images are then loaded into the bank not
+// in use, so that the running image survives a failed or interrupted load, and
+// node.LFS.load() can do this without a restart.  A new image that hasn't been
+// confirmed by node.LFS.confirm() is rolled back on the following restart.
+// Both banks must lie in the first Mb of flash as only this is mapped.
+
+//#define LUA_FLASH_STORE_DUAL_BANK
+
 // By default Lua executes the file init.lua at start up.  The following
 // define allows you to replace this with an alternative startup.  Warning:
 // you must protect this execution otherwise you will enter a panic loop;
@@ -90,6 +99,16 @@
 
 //#define LUA_INIT_STRING "pcall(function() node.flashindex'_init'() end)"
 
+// Key lookups in ROM tables (the C module tables and their metatables) go
+// through a lookaside cache of KEYCACHE_N lines (a power of 2), each holding
+// KEYCACHE_M slots.  Builds with a lot of modules can benefit from a larger
+// cache.  Define KEYCACHE_STATS to collect per-line hit, miss and eviction
+// counts which can be read with node.info("keycache") to help tune these.
+
+//#define KEYCACHE_N 32
+//#define KEYCACHE_M 4
+//#define KEYCACHE_STATS
+
 
 // NodeMCU supports two file systems: SPIFFS and FATFS, the first is available
 // on all ESP8266 modules.  The latter requires extra H/W so it is less common.
@@ -113,6 +132,8 @@
 #define SPIFFS_CACHE 1          // Enable if you use you SPIFFS in R/W mode
 //#define SPIFFS_MAX_FILESYSTEM_SIZE 0x20000
 #define SPIFFS_MAX_OPEN_FILES 4 // maximum number of open files for SPIFFS
+//#define SPIFFS_CACHE_PAGES 4  // initial page cache size, see file.fscfg()
+//#define SPIFFS_NAME_CACHE 64  // remember where up to N files are, 8 bytes RAM each
 #define FS_OBJ_NAME_LEN 31      // maximum length of a filename
 
 //#define BUILD_FATFS
@@ -149,6 +170,16 @@
 //#define TIMER_SUSPEND_ENABLE
 //#define PMSLEEP_ENABLE
 
+// By default every tmr object owns its own SDK timer.  Applications with many
+// timers can instead multiplex them all onto a single SDK timer driven by a
+// hierarchical timing wheel.  TMR_WHEEL_TOLERANCE (in mS) lets expirations
+// that fall within the same window be dispatched as one batch, at the cost of
+// each timer firing up to that much later; it can be changed at runtime using
+// tmr.wheel().
+
+//#define TMR_WHEEL
+//#define TMR_WHEEL_TOLERANCE 1
+
 // The net module optionally offers net info functionnality. Uncomment the following
 // to enable the functionnality.
 #define NET_PING_ENABLE
@@ -254,6 +285,14 @@
 #  define LUA_FLASH_STORE                 0x0
 #endif
 
+#ifndef LUA_FLASH_STORE1
+#  ifdef LUA_FLASH_STORE_DUAL_BANK
+#    define LUA_FLASH_STORE1              LUA_FLASH_STORE
+#  else
+#    define LUA_FLASH_STORE1              0x0
+#  endif
+#endif
+
 #ifndef SPIFFS_FIXED_LOCATION
   #define SPIFFS_FIXED_LOCATION           0x0
   // You'll rarely need to customize this, because nowadays
@@ -269,6 +308,16 @@
 // consumed. It enables a nice node.startupcounts() function to get the results.
 //#define PLATFORM_STARTUP_COUNT
 
+// Each task priority has a fixed length SDK queue, backed by an overflow spill
+// list which grows on demand up to TASK_SPILL_MAX entries.  The queue lengths
+// can be increased if bursty interrupt or network traffic causes tasks to be
+// dropped; see node.task.stats() for the per priority counters.
+//#define TASK_QUEUE_LEN_LOW        8
+//#define TASK_QUEUE_LEN_MEDIUM     8
+//#define TASK_QUEUE_LEN_HIGH       8
+//#define TASK_SPILL_LEN            8   // must be a power of 2
+//#define TASK_SPILL_MAX           64   // must be a power of 2
+
 #define LUA_TASK_PRIO             USER_TASK_PRIO_0
 #define LUA_PROCESS_LINE_SIG      2
 // LUAI_OPTIMIZE_DEBUG 0 = Keep all debug; 1 = keep line number info; 2 = remove all debug
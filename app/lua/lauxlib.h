@@ -173,6 +173,8 @@ LUALIB_API int  (luaL_pushlfsmodule) (lua_State *L);
 LUALIB_API int  (luaL_pushlfsdts) (lua_State *L);
 
 LUALIB_API void (luaL_lfsreload) (lua_State *L);
+LUALIB_API void (luaL_lfsload) (lua_State *L);
+LUALIB_API int  (luaL_lfsconfirm) (lua_State *L);
 LUALIB_API int  (luaL_pcallx) (lua_State *L, int narg, int nres);
 LUALIB_API int  (luaL_posttask) ( lua_State* L, int prio );
 #define  LUA_TASK_LOW    0
@@ -35,6 +35,10 @@ static uint32_t flashAddrPhys;
 static uint32_t flashSector;
 static uint32_t curOffset;
 
+/* The LFS banks; bank 1 is only sized if a second LFS partition exists */
+static struct { uint32_t addrPhys, size; } flashBank[2];
+static int flashBankActive;                /* the bank in use in this boot */
+
 #define ALIGN(s)      (((s)+sizeof(size_t)-1) & ((size_t) (- (signed) sizeof(size_t))))
 #define ALIGN_BITS(s) (((uint32_t)s) & (sizeof(size_t)-1))
 #define ALL_SET       (~0)
@@ -137,6 +141,88 @@ static void flashErase(uint32_t start, uint32_t end){
     platform_flash_erase_sector( flashSector + i );
 }
 
+/* =====================================================================================
+ * Dual bank LFS.  If a second LFS partition is allocated, then images are always
+ * loaded into the bank that isn't in use, so a failed or interrupted load leaves
+ * the running image intact.  Which bank to map is decided at startup from the
+ * state word in each bank's header.  This is written as ~0 and its flags are
+ * cleared one at a time, which needs no sector erase:
+ *
+ * -  A new image is preferred, and its BOOTED flag is cleared as it starts.
+ * -  node.LFS.confirm() clears CONFIRMED, and RETIRED in the other bank.
+ * -  An image found booted but not confirmed by the next startup has its FAILED
+ *    flag cleared, so that startup rolls back to the other bank.
+ *
+ * Images without a state word rank below a confirmed one.  The headers are read
+ * through the uncached flash API as the mapped copy can be stale.
+ */
+enum { LFS_RANK_NONE, LFS_RANK_FAILED, LFS_RANK_TRIAL, LFS_RANK_RETIRED,
+       LFS_RANK_CONFIRMED, LFS_RANK_NEW };
+
+static void setFlashBank(int b) {
+  flashSize     = flashBank[b].size;
+  flashAddrPhys = flashBank[b].addrPhys;
+  flashAddr     = cast(char *, platform_flash_phys2mapped(flashAddrPhys));
+  flashSector   = platform_flash_get_sector_of_address(flashAddrPhys);
+  curOffset     = 0;
+}
+
+static void bankHeader(int b, FlashHeader *h) {
+  memset(h, 0, sizeof(*h));
+  if (flashBank[b].size)
+    platform_s_flash_read(h, flashBank[b].addrPhys, sizeof(*h));
+}
+
+static int bankRank(const FlashHeader *h) {
+  lu_int32 s = h->state;
+  if ((h->flash_sig & (~FLASH_SIG_ABSOLUTE)) != FLASH_SIG)
+    return LFS_RANK_NONE;
+  if ((s | LFS_STATE_MASK) != ALL_SET)           /* image predates states */
+    return LFS_RANK_RETIRED;
+  if (!(s & LFS_STATE_FAILED))
+    return LFS_RANK_FAILED;
+  if (!(s & LFS_STATE_RETIRED))
+    return LFS_RANK_RETIRED;
+  if (!(s & LFS_STATE_CONFIRMED))
+    return LFS_RANK_CONFIRMED;
+  return (s & LFS_STATE_BOOTED) ? LFS_RANK_NEW : LFS_RANK_TRIAL;
+}
+
+static void bankClearState(int b, lu_int32 flag) {
+  FlashHeader h;
+  bankHeader(b, &h);
+  if (h.state & flag) {
+    h.state &= ~flag;
+    platform_s_flash_write(&h.state, flashBank[b].addrPhys +
+                           ((char *) &h.state - (char *) &h), sizeof(h.state));
+  }
+}
+
+/* Returns the bank to map.  With a single bank this is always bank 0 */
+static int bankSelect(void) {
+  FlashHeader h[2];
+  int b, rank[2];
+  for (b = 0; b < 2; b++) {
+    flashBank[b].size = platform_flash_get_partition(
+      b ? NODEMCU_LFS1_PARTITION : NODEMCU_LFS0_PARTITION, &flashBank[b].addrPhys);
+    bankHeader(b, h + b);
+    rank[b] = bankRank(h + b);
+  }
+  if (flashBank[1].size == 0)
+    return 0;
+  for (b = 0; b < 2; b++) {
+    if (rank[b] == LFS_RANK_TRIAL) {
+      NODE_ERR("LFS bank %d not confirmed, rolling back\n", b);
+      bankClearState(b, LFS_STATE_FAILED);
+      rank[b] = LFS_RANK_FAILED;
+    }
+  }
+  b = rank[1] > rank[0];
+  if (rank[b] == LFS_RANK_NEW)
+    bankClearState(b, LFS_STATE_BOOTED);
+  return b;
+}
+
 /* =====================================================================================
  * luaN_init() is exported via lflash.h.
  * The first is the startup hook used in lstate.c and the last two are
@@ -148,15 +234,13 @@ static void flashErase(uint32_t start, uint32_t end){
  */
 LUAI_FUNC void luaN_init (lua_State *L) {
 
-  flashSize = platform_flash_get_partition (NODEMCU_LFS0_PARTITION, &flashAddrPhys);
+  flashBankActive = bankSelect();
+  setFlashBank(flashBankActive);
   if (flashSize == 0) {
     return;   // Nothing to do if the size is zero
   }
   G(L)->LFSsize   = flashSize;
-  flashAddr       = cast(char *, platform_flash_phys2mapped(flashAddrPhys));
-  flashSector     = platform_flash_get_sector_of_address(flashAddrPhys);
   FlashHeader *fh = cast(FlashHeader *, flashAddr);
-  curOffset       = 0;
 
   /*
    * For the LFS to be valid, its signature has to be correct for this build
@@ -197,65 +281,101 @@ static void procFirstPass (void);
 /* luaL_lfsreload() is exported via lauxlib.h */
 
 /*
- * Library function called by node.flashreload(filename).
+ * Load the LFS image named at stack index 1.  With a dual bank LFS this goes into
+ * the bank not in use, which is only mapped after a restart.
+ *
+ * -  If an error occurs before the 2nd pass, or with a dual bank LFS, the LFS in
+ *    use is unchanged so it is safe to return the error to the calling Lua.
+ * -  Otherwise the LFS in use has been overwritten, so the ESP is rebooted.
  */
-LUALIB_API void luaL_lfsreload (lua_State *L) {
+static void lfsLoad (lua_State *L, int restart) {
   const char *fn = lua_tostring(L, 1), *msg = "";
-  int status;
+  int dual = flashBank[1].size != 0;
+  int status, written;
 
   if (G(L)->LFSsize == 0) {
     lua_pushstring(L, "No LFS partition allocated");
     return;
   }
-
- /*
-  * Do a protected call of loadLFS.
-  *
-  * -  This will normally rewrite the LFS and reboot, with no return.
-  * -  If an error occurs then it is sent to the UART.
-  * -  If this occured in the 1st pass, the previous LFS is unchanged so it is
-  *    safe to return to the calling Lua.
-  * -  If in the 1st pass, then the ESP is rebooted.
-  */
-  status = lua_cpcall(L, &loadLFS, cast(void *,fn));
-
-  if (!out || out->fullBlkCB == procFirstPass) {
-   /*
-    * Never entered the 2nd pass, so it is safe to return the error.  Note
-    * that I've gone to some trouble to ensure that all dynamically allocated
-    * working areas have been freed, so that we have no memory leaks.
-    */
-    if (status == LUA_ERRMEM)
-      msg = "Memory allocation error";
-    else if (out && out->error)
-      msg = out->error;
-    else
-      msg = "Unknown Error";
-
-   /* We can clean up and return error */
-    lua_cpcall(L, &loadLFSgc, NULL);
-    lua_settop(L, 0);
-    lua_pushstring(L, msg);
+  if (!dual && !restart) {
+    lua_pushstring(L, "No second LFS partition allocated");
     return;
   }
+  if (dual) {
+    FlashHeader h;
+    bankHeader(flashBankActive, &h);
+    if (bankRank(&h) == LFS_RANK_TRIAL) {
+      /* the other bank holds the only image to roll back to */
+      lua_pushstring(L, "LFS image in use is not confirmed");
+      return;
+    }
+    setFlashBank(1 - flashBankActive);
+  }
+
+  status  = lua_cpcall(L, &loadLFS, cast(void *,fn));
+  written = out && out->fullBlkCB != procFirstPass;
 
-  if (status == 0) {
-    /* Successful LFS rewrite */
+  if (status == LUA_ERRMEM)
+    msg = "Memory allocation error";
+  else if (status != 0)
+    msg = (out && out->error) ? out->error : "Unknown Error";
+  else
     msg = "LFS region updated.  Restarting.";
-  } else {
-    /* We have errored during the second pass so clear the LFS and reboot */
-    if (status == LUA_ERRMEM)
-      msg = "Memory allocation error";
-    else if (out->error)
-      msg = out->error;
-    else
-      msg = "Unknown Error";
-
-    flashErase(0,-1);
+
+  if (status != 0 && written)
+    flashErase(0,-1);                 /* never leave a part written image */
+
+  if (written && !dual) {
+    NODE_ERR(msg);
+    while (1) {}  // Force WDT as the ROM software_reset() doesn't seem to work
+  }
+ /*
+  * Note that I've gone to some trouble to ensure that all dynamically allocated
+  * working areas have been freed, so that we have no memory leaks.
+  */
+  lua_cpcall(L, &loadLFSgc, NULL);
+  setFlashBank(flashBankActive);
+  if (status == 0 && restart) {
+    NODE_ERR(msg);
+    while (1) {}
   }
-  NODE_ERR(msg);
+  lua_settop(L, 0);
+  if (status == 0)
+    lua_pushnil(L);
+  else
+    lua_pushstring(L, msg);
+}
+
+/*
+ * Library function called by node.LFS.reload(filename).  This normally rewrites
+ * the LFS and reboots, with no return.
+ */
+LUALIB_API void luaL_lfsreload (lua_State *L) {
+  lfsLoad(L, 1);
+}
+
+/*
+ * Library function called by node.LFS.load(filename) to load the inactive bank of
+ * a dual bank LFS while the application keeps running.  Returns nil on success.
+ */
+LUALIB_API void luaL_lfsload (lua_State *L) {
+  lfsLoad(L, 0);
+}
 
-  while (1) {}  // Force WDT as the ROM software_reset() doesn't seem to work
+/*
+ * Library function called by node.LFS.confirm().  Confirms the image in use from
+ * a dual bank LFS, and retires the other bank's image if it was the confirmed one.
+ */
+LUALIB_API int luaL_lfsconfirm (lua_State *L) {
+  FlashHeader h;
+  int b = flashBankActive;
+  if (flashBank[1].size == 0 || G(L)->ROstrt.hash == NULL)
+    return 0;
+  bankClearState(b, LFS_STATE_CONFIRMED);
+  bankHeader(1 - b, &h);
+  if (bankRank(&h) == LFS_RANK_CONFIRMED)
+    bankClearState(1 - b, LFS_STATE_RETIRED);
+  return 1;
 }
 
 
@@ -268,6 +388,7 @@ LUA_API void lua_getlfsconfig (lua_State *L, int *config) {
   config[3] = (G(L)->ROstrt.hash) ? cast(FlashHeader *, flashAddr)->flash_size : 0;
                                                            /* LFS region used */
   config[4] = 0;                                       /* Not used in Lua 5.1 */
+  config[5] = flashBankActive;                                /* LFS bank in use */
 }
 
 
@@ -429,8 +550,10 @@ void procSecondPass (void) {
   * On first block, set the flash_sig has the in progress bit set and this
   * is not cleared until end.
   */
-  if (out->ndx <= WRITE_BLOCKSIZE)
+  if (out->ndx <= WRITE_BLOCKSIZE) {
     buf[0] = out->flash_sig | FLASH_SIG_IN_PROGRESS;
+    cast(FlashHeader *, buf)->state = ALL_SET;
+  }
 
   flashBlock(buf, len*WORDSIZE);
 
@@ -524,5 +647,6 @@ static int loadLFSgc (lua_State *L) {
       vfs_close(in->fd);
     luaM_free(L, in);
   }
+  in = NULL; out = NULL;
   return 0;
 }
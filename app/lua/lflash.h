@@ -30,6 +30,13 @@
 #define FLASH_SIG_IN_PROGRESS 0x08
 #define FLASH_SIG  (0xfafaa050 | FLASH_FORMAT_VERSION |FLASH_SIG_B2 | FLASH_SIG_B1)
 
+/* Bank state flags in the header of a dual bank LFS, see lflash.c */
+#define LFS_STATE_BOOTED      0x01
+#define LFS_STATE_CONFIRMED   0x02
+#define LFS_STATE_RETIRED     0x04
+#define LFS_STATE_FAILED      0x08
+#define LFS_STATE_MASK        0x0F
+
 typedef lu_int32 FlashAddr;
 typedef struct {
   lu_int32  flash_sig;      /* a stabdard fingerprint identifying an LFS image */
@@ -38,7 +45,7 @@ typedef struct {
   FlashAddr pROhash;        /* address of ROstrt hash */
   lu_int32  nROuse;         /* number of elements in ROstrt */
   int       nROsize;        /* size of ROstrt */
-  lu_int32  fill1;          /* reserved */
+  lu_int32  state;          /* LFS_STATE_XXX bank flags, cleared once each */
   lu_int32  fill2;          /* reserved */
 } FlashHeader;
 
@@ -95,6 +95,22 @@ typedef lu_int32 Instruction;
 #endif
 
 
+/*
+** Size of the ROTable key cache. 'N' is the number of lines (must be a
+** power of 2) and 'M' is the number of slots in each line.  Both can be
+** overridden in user_config.h.
+*/
+#ifndef KEYCACHE_N
+#define KEYCACHE_N	32
+#endif
+#ifndef KEYCACHE_M
+#define KEYCACHE_M	4
+#endif
+#if (KEYCACHE_N & (KEYCACHE_N - 1)) != 0
+#error "KEYCACHE_N must be a power of 2"
+#endif
+
+
 /* minimum size for string buffer */
 #ifndef LUA_MINBUFFER
 #define LUA_MINBUFFER	32
@@ -110,11 +110,12 @@ LUALIB_API int luaL_posttask( lua_State* L, int prio ) {          // [-1, +0, -]
 //void *cl = clvalue(L->top-1);
   int task_fn_ref = luaL_ref(L, LUA_REGISTRYINDEX);
 //dbg_printf("posting Reg[%u]=%p\n",task_fn_ref,cl);
-  if(!platform_post(prio, task_handle, (platform_task_param_t)task_fn_ref)) {
+  int status = platform_post(prio, task_handle, (platform_task_param_t)task_fn_ref);
+  if (status == PLATFORM_TASK_POST_FAIL) {
     luaL_unref(L, LUA_REGISTRYINDEX, task_fn_ref);
     luaL_error(L, "Task queue overflow. Task not posted");
   }
-  return task_fn_ref;
+  return status;      /* WOULDBLOCK if parked in the overflow spill list */
 }
 #else
 LUALIB_API int luaL_posttask( lua_State* L, int prio ) { 
@@ -33,6 +33,7 @@
 #include "lstate.h"
 #include "ltable.h"
 #include "lstring.h"
+#include "lnodemcu.h"
 
 
 /*
@@ -752,14 +753,40 @@ int luaH_isdummy (Node *n) { return n == dummynode; }
 ** Note that this hash does a couple of prime multiples and a modulus 2^X
 ** with is all evaluated in H/W, and adequately randomizes the lookup.
 */
-#define LA_LINES 32
-#define LA_SLOTS 4
-static size_t cache [LA_LINES][LA_SLOTS];
+static size_t cache [KEYCACHE_N][KEYCACHE_M];
 
-#define HASH(a,b) ((((29*(size_t)(a)) ^ (37*((b)->tsv.hash)))>>4) % LA_LINES)
+#define HASH(a,b) ((((29*(size_t)(a)) ^ (37*((b)->tsv.hash)))>>4) & (KEYCACHE_N-1))
 #define NDX_SHFT 24
 #define ADDR_MASK (((size_t) 1<<24)-1)
 
+/*
+** If KEYCACHE_STATS is defined then per-line hit, miss and eviction counts
+** are collected for tuning KEYCACHE_N and KEYCACHE_M.  See node.info().
+*/
+#ifdef KEYCACHE_STATS
+static struct {
+  unsigned hits, misses, evictions;
+} kcstats[KEYCACHE_N];
+#define kcstat(l,f) (kcstats[l].f++)
+#else
+#define kcstat(l,f) ((void) 0)
+#endif
+
+LUA_API int lua_getkeycachestats (lua_State *L, int line, unsigned *stats) {
+  UNUSED(L);
+#ifdef KEYCACHE_STATS
+  if (stats && line >= 0 && line < KEYCACHE_N) {
+    stats[0] = kcstats[line].hits;
+    stats[1] = kcstats[line].misses;
+    stats[2] = kcstats[line].evictions;
+  }
+  return KEYCACHE_N;
+#else
+  UNUSED(line); UNUSED(stats);
+  return 0;
+#endif
+}
+
 /*
  * Find a string key entry in a rotable and return it.  Note that this internally
  * uses a null key to denote a metatable search.
@@ -768,7 +795,8 @@ static const TValue* rotable_findentry(ROTable *t, TString *key, unsigned *ppos)
   const ROTable_entry *e = cast(const ROTable_entry *, t->entry);
   const int tl = getlsizenode(t);
   const char *strkey = getstr(key);
-  size_t *cl = cache[HASH(t, key)];
+  const int hash = HASH(t, key);
+  size_t *cl = cache[hash];
   int i, j = 1, l;
 
   if (!e || gettt(key) != LUA_TSTRING)
@@ -776,15 +804,17 @@ static const TValue* rotable_findentry(ROTable *t, TString *key, unsigned *ppos)
 
   l = key->tsv.len;
   /* scan the ROTable lookaside cache and return if hit found */
-  for (i=0; i<LA_SLOTS; i++) {
+  for (i=0; i<KEYCACHE_M; i++) {
     int cl_ndx = cl[i] >> NDX_SHFT;
     if ((((size_t)t - cl[i]) & ADDR_MASK) == 0 && cl_ndx < tl &&
         strcmp(e[cl_ndx].key, strkey) == 0) {
        if (ppos)
           *ppos = cl_ndx;
+      kcstat(hash, hits);
       return &e[cl_ndx].value;
     }
   }
+  kcstat(hash, misses);
 
  /*
   * A lot of search misses are metavalues, but tables typically only have at
@@ -799,6 +829,24 @@ static const TValue* rotable_findentry(ROTable *t, TString *key, unsigned *ppos)
       if (j>=0)
         break;
     }
+  } else if (!(getflags(t) & LROT_MASK_SORTED)) {
+ /*
+  * Tables flagged as sorted have their ordinary keys in strcmp() order after
+  * any metavalues, so these can be binary searched.
+  */
+    int lo = 0, hi = tl - 1;
+    while (lo < tl && strncmp(e[lo].key, "__", 2) == 0)
+      lo++;
+    while (lo <= hi) {
+      i = (lo + hi) >> 1;
+      j = strcmp(e[i].key, strkey);
+      if (j == 0)
+        break;
+      else if (j < 0)
+        lo = i + 1;
+      else
+        hi = i - 1;
+    }
   } else {
  /*
   * Ordinary (non-meta) keys can be unsorted.  This is for legacy compatiblity,
@@ -820,7 +868,9 @@ static const TValue* rotable_findentry(ROTable *t, TString *key, unsigned *ppos)
   if (ppos)
     *ppos = i;
   /* In the case of a hit, update the lookaside cache */
-  for (j = LA_SLOTS-1; j>0; j--)
+  if (cl[KEYCACHE_M-1])
+    kcstat(hash, evictions);
+  for (j = KEYCACHE_M-1; j>0; j--)
     cl[j] = cl[j-1];
   cl[0] = ((size_t)t & ADDR_MASK) + (i << NDX_SHFT);
   return &e[i].value;
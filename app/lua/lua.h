@@ -401,6 +401,7 @@ LUA_API int  (lua_freeheap) (void);
 
 LUA_API void (lua_getlfsconfig) (lua_State *L, int *);
 LUA_API int  (lua_pushlfsindex) (lua_State *L);
+LUA_API int  (lua_getkeycachestats) (lua_State *L, int line, unsigned *stats);
 
 #define EGC_NOT_ACTIVE        0   // EGC disabled
 #define EGC_ON_ALLOC_FAILURE  1   // run EGC on allocation failure
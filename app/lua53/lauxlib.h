@@ -288,6 +288,8 @@ extern void dbg_printf(const char *fmt, ...);
 LUALIB_API int  (luaL_pushlfsmodules) (lua_State *L);
 LUALIB_API int  (luaL_pushlfsdts) (lua_State *L);
 LUALIB_API void (luaL_lfsreload) (lua_State *L);
+LUALIB_API void (luaL_lfsload) (lua_State *L);
+LUALIB_API int  (luaL_lfsconfirm) (lua_State *L);
 LUALIB_API int  (luaL_posttask) (lua_State* L, int prio);
 LUALIB_API int  (luaL_pcallx) (lua_State *L, int narg, int nres);
 
@@ -196,14 +196,19 @@ typedef unsigned long Instruction;
 
 
 /*
-** Size of cache for strings in the API. 'N' is the number of
-** sets (better be a prime) and "M" is the size of each set (M == 1
-** makes a direct cache.)
+** Size of cache for strings in the API and ROTable keys. 'N' is the number
+** of sets (must be a power of 2) and "M" is the size of each set (M == 1
+** makes a direct cache.)  Both can be overridden in user_config.h.
 */
 #if !defined(KEYCACHE_N)
 #define KEYCACHE_N	    32
+#endif
+#if !defined(KEYCACHE_M)
 #define KEYCACHE_M		4
 #endif
+#if (KEYCACHE_N & (KEYCACHE_N - 1)) != 0
+#error "KEYCACHE_N must be a power of 2"
+#endif
 
 
 /* minimum size for string buffer */
@@ -76,6 +76,11 @@ extern void dbg_printf(const char *fmt, ...);                // DEBUG
 #define unlockFlashWrite()
 #define lockFlashWrite()
 
+/* The LFS banks; bank 1 is only sized if a second LFS partition exists */
+static struct { lu_int32 addrPhys, size; } LFSbank[2];
+static int LFSbankActive;                  /* the bank in use in this boot */
+#define LFSdualBank() (LFSbank[1].size != 0)
+
 #else // LUA_USE_HOST
 
 //==== Emulate Platform_XXX() API within host luac.cross -e environement =====//
@@ -168,6 +173,8 @@ static void platform_s_flash_write(const void *from, lu_int32 to, lu_int32 len)
 }
 
 #define flush_icache(F)   /* not needed */
+#define LFSbankActive 0
+#define LFSdualBank() 0
 
 #endif
 
@@ -294,6 +301,7 @@ LUA_API void lua_getlfsconfig (lua_State *L, int *config) {
   } else { 
     config[3] = config[4] = 0;
   }
+  config[5] = LFSbankActive;                          /* LFS bank in use */
 }
 
 LUA_API int  (lua_pushlfsindex) (lua_State *L) {
@@ -358,7 +366,7 @@ LUALIB_API int  (luaL_pushlfsmodules) (lua_State *L) {
 }
 
 LUALIB_API int  (luaL_pushlfsdts) (lua_State *L) {
-  int config[5];
+  int config[6];
   lua_getlfsconfig(L, config);
   lua_pushinteger(L, config[4]);
   return 1;
@@ -438,6 +446,9 @@ static void eraseLFS(LFSflashState *F) {
       continue;
 #endif
     platform_flash_erase_sector(s);
+#ifdef LUA_USE_ESP
+    system_soft_wdt_feed();  /* a bank can also be erased while running */
+#endif
     printf(".");
   }
   printf(" to 0x%06x\n", F->addrPhys + F->size-1);
@@ -494,6 +505,119 @@ LUAI_FUNC void *luaN_writeFlash(void *vF, const void *rec, size_t n) {
 }
 
 
+static LFSflashState *newFlashState(void) {
+  size_t Fsize = sizeof(LFSflashState) + OSIZE*WORDSIZE + ISIZE;
+  /* outlining the buffers just makes debugging easier.  Sorry */
+  LFSflashState *F = calloc(Fsize, 1);
+  if (F) {
+    F->oBuff = wordptr(F + 1);
+    F->inBuff = byteptr(F->oBuff + OSIZE);
+  }
+  return F;
+}
+
+/* Erase the LFS region set up in F and load the image file F->f into it */
+static int loadImage(lua_State *L, LFSflashState *F) {
+  ZIO z;
+  int status;
+  eraseLFS(F);
+  luaZ_init(L, &z, readF, F);
+  lua_lock(L);
+#ifdef LUA_USE_HOST
+  F->allocmask = (LFSaddr == LFSregion) ? sizeof(size_t) - 1 :
+                                          sizeof(lu_int32) - 1;
+  status = luaU_undumpLFS(L, &z, LFSaddr != LFSregion);
+#else
+  status = luaU_undumpLFS(L, &z, 0);
+#endif
+  lua_unlock(L);
+  return status;
+}
+
+#ifdef LUA_USE_ESP
+/*
+** Dual bank LFS.  If a second LFS partition is allocated, then images are
+** always loaded into the bank that isn't in use, so a failed or interrupted
+** load leaves the running image intact.  Which bank to map is decided at
+** startup from the state word in each bank's header:
+**
+**   -  A new image is preferred, and its BOOTED flag is cleared as it starts.
+**   -  node.LFS.confirm() clears CONFIRMED, and RETIRED in the other bank.
+**   -  An image found booted but not confirmed by the next startup has its
+**      FAILED flag cleared, so that startup rolls back to the other bank.
+**
+** Images without a state word rank below a confirmed one.  Headers are read
+** through the uncached flash API as the mapped copy can be stale.
+*/
+enum { LFS_RANK_NONE, LFS_RANK_FAILED, LFS_RANK_TRIAL, LFS_RANK_RETIRED,
+       LFS_RANK_CONFIRMED, LFS_RANK_NEW };
+
+static void bankHeader (int b, LFSHeader *h) {
+  memset(h, 0, sizeof(*h));
+  if (LFSbank[b].size)
+    platform_s_flash_read(h, LFSbank[b].addrPhys, sizeof(*h));
+}
+
+static int bankRank (const LFSHeader *h) {
+  lu_int32 s = h->state;
+  if (h->flash_sig != FLASH_SIG)
+    return LFS_RANK_NONE;
+  if ((s | LFS_STATE_MASK) != ~(lu_int32)0)      /* image predates states */
+    return LFS_RANK_RETIRED;
+  if (!(s & LFS_STATE_FAILED))
+    return LFS_RANK_FAILED;
+  if (!(s & LFS_STATE_RETIRED))
+    return LFS_RANK_RETIRED;
+  if (!(s & LFS_STATE_CONFIRMED))
+    return LFS_RANK_CONFIRMED;
+  return (s & LFS_STATE_BOOTED) ? LFS_RANK_NEW : LFS_RANK_TRIAL;
+}
+
+static void bankClearState (int b, lu_int32 flag) {
+  LFSHeader h;
+  bankHeader(b, &h);
+  if (h.state & flag) {
+    h.state &= ~flag;
+    platform_s_flash_write(&h.state,
+                           LFSbank[b].addrPhys + byteoffset(&h.state, &h),
+                           sizeof(h.state));
+  }
+}
+
+/*
+** Returns the bank to map on a normal startup.  If a reload is pending, this
+** is the bank to keep, the image is loaded into the other one, and no state
+** is changed.  With a single bank this is always bank 0.
+*/
+static int bankSelect (int reload) {
+  LFSHeader h[2];
+  int b, rank[2];
+  for (b = 0; b < 2; b++) {
+    LFSbank[b].size = platform_flash_get_partition(
+      b ? NODEMCU_LFS1_PARTITION : NODEMCU_LFS0_PARTITION, &LFSbank[b].addrPhys);
+    bankHeader(b, h + b);
+    rank[b] = bankRank(h + b);
+  }
+  if (LFSbank[1].size == 0)
+    return 0;
+  for (b = 0; b < 2 && !reload; b++) {
+    if (rank[b] == LFS_RANK_TRIAL) {
+      lua_writestringerror("LFS bank %s not confirmed, rolling back\n",
+                           b ? "1" : "0");
+      bankClearState(b, LFS_STATE_FAILED);
+      rank[b] = LFS_RANK_FAILED;
+    }
+  }
+  b = rank[1] > rank[0] ||
+      (rank[1] == rank[0] && h[1].timestamp > h[0].timestamp);
+  if (reload)
+    return b;
+  if (rank[b] == LFS_RANK_NEW)
+    bankClearState(b, LFS_STATE_BOOTED);
+  return b;
+}
+#endif
+
 /*
 ** Hook used in Lua Startup to carry out the optional LFS startup processes.
 */
@@ -506,13 +630,17 @@ LUAI_FUNC int luaN_init (lua_State *L) {
   * are initialised.  This is detected because F is NULL on first entry.
   */
   if (F == NULL) {
-    size_t Fsize = sizeof(LFSflashState) + OSIZE*WORDSIZE + ISIZE;
-    /* outlining the buffers just makes debugging easier.  Sorry */
-    F = calloc(Fsize, 1);
-    F->oBuff = wordptr(F + 1);
-    F->inBuff = byteptr(F->oBuff + OSIZE);
+    F = newFlashState();
     n = platform_rcr_read(PLATFORM_RCR_FLASHLFS, cast(void**, &F->LFSfileName));
+#ifdef LUA_USE_ESP
+    LFSbankActive = bankSelect(n >= 0);
+    /* a reload goes into the other bank of a dual bank LFS */
+    int b = (n >= 0 && LFSdualBank()) ? 1 - LFSbankActive : LFSbankActive;
+    F->addrPhys = LFSbank[b].addrPhys;
+    F->size     = LFSbank[b].size;
+#else
     F->size = platform_flash_get_partition (NODEMCU_LFS0_PARTITION, &F->addrPhys);
+#endif
     if (F->size) {
       F->addr  = cast(lu_int32 *, platform_flash_phys2mapped(F->addrPhys));
       fh = cast(LFSHeader *, F->addr);
@@ -538,7 +666,6 @@ LUAI_FUNC int luaN_init (lua_State *L) {
   } else {  /* hook 2 called from protected pmain, so can throw errors. */
     int status = 0;
     if (F->LFSfileName) {                         /* hook == 2 LFS image load */
-      ZIO z;
      /*
       * To avoid reboot loops, the load is only attempted once, so we
       * always deleted the RCR record if we enter this path. Also note
@@ -557,23 +684,22 @@ LUAI_FUNC int luaN_init (lua_State *L) {
      luaopen_file(L);
 #endif
       if (!(F->f = l_open(F->LFSfileName))) {
-        free(F);
-        return luaL_error(L, "cannot open %s", F->LFSfileName);
+        lua_pushfstring(L, "cannot open %s", F->LFSfileName);
+        status = LUA_ERRFILE;
+      } else {
+        status = loadImage(L, F);
+        l_close(F->f);
       }
-      eraseLFS(F);
-      luaZ_init(L, &z, readF, F);
-      lua_lock(L);
-#ifdef LUA_USE_HOST
-      F->allocmask = (LFSaddr == LFSregion) ? sizeof(size_t) - 1 :
-                                              sizeof(lu_int32) - 1;
-      status = luaU_undumpLFS(L, &z, LFSaddr != LFSregion);
-#else
-      status = luaU_undumpLFS(L, &z, 0);
-#endif
-      lua_unlock(L);
-      l_close(F->f);
       free(F);
       F = NULL;
+      if (status != LUA_OK && LFSdualBank()) {
+       /*
+        * The bank in use is intact but isn't mapped in this boot, so report
+        * the error and restart into it rather than run without LFS.
+        */
+        lua_writestringerror("LFS load failed: %s\n", lua_tostring(L, -1));
+        status = LUA_OK;
+      }
       if (status == LUA_OK)
         lua_pushstring(L, "!LFSrestart!");                /* Signal a restart */
       lua_error(L);                          /* throw error / restart request */
@@ -621,6 +747,71 @@ LUALIB_API void luaL_lfsreload (lua_State *L) {
 #endif
 }
 
+/*
+** Load an LFS image file into the inactive bank of a dual bank LFS while
+** the application keeps running.  The image is mapped on the next restart.
+** Returns nil on success or an error message.
+*/
+LUALIB_API void luaL_lfsload (lua_State *L) {
+#ifdef LUA_USE_ESP
+  const char *img = lua_tostring(L, 1);
+  LFSflashState *F;
+  LFSHeader h;
+  int b = 1 - LFSbankActive;
+  lua_settop(L, 1);
+  if (LFSbank[1].size == 0) {
+    lua_pushstring(L, "No second LFS partition allocated");
+    return;
+  }
+  bankHeader(LFSbankActive, &h);
+  if (bankRank(&h) == LFS_RANK_TRIAL) {
+    /* the other bank holds the only image to roll back to */
+    lua_pushstring(L, "LFS image in use is not confirmed");
+    return;
+  }
+  if ((F = newFlashState()) == NULL) {
+    lua_pushstring(L, "not enough memory");
+    return;
+  }
+  F->addrPhys = LFSbank[b].addrPhys;
+  F->size     = LFSbank[b].size;
+  F->addr     = cast(lu_int32 *, platform_flash_phys2mapped(F->addrPhys));
+  if (!img || !(F->f = l_open(img))) {
+    free(F);
+    lua_pushfstring(L, "cannot open %s", img ? img : "?");
+    return;
+  }
+  if (loadImage(L, F) == LUA_OK)
+    lua_pushnil(L);         /* otherwise the error message is left on the stack */
+  l_close(F->f);
+  free(F);
+#else
+  lua_pushstring(L, "No second LFS partition allocated");
+#endif
+}
+
+/*
+** Confirm the image in use from a dual bank LFS, so the next startup doesn't
+** roll back to the other bank.  This retires the other bank's image if it
+** was the confirmed one.  Returns 0 if there is nothing to confirm.
+*/
+LUALIB_API int luaL_lfsconfirm (lua_State *L) {
+#ifdef LUA_USE_ESP
+  LFSHeader h;
+  int b = LFSbankActive;
+  if (LFSbank[1].size == 0 || G(L)->ROstrt.hash == NULL)
+    return 0;
+  bankClearState(b, LFS_STATE_CONFIRMED);
+  bankHeader(1 - b, &h);
+  if (bankRank(&h) == LFS_RANK_CONFIRMED)
+    bankClearState(1 - b, LFS_STATE_RETIRED);
+  return 1;
+#else
+  UNUSED(L);
+  return 0;
+#endif
+}
+
 
 #ifdef LUA_USE_ESP
 extern void lua_main(void);
@@ -656,11 +847,12 @@ LUALIB_API int luaL_posttask ( lua_State* L, int prio ) {         // [-1, +0, -]
   }
   if (lua_isfunction(L, -1) && prio >= LUA_TASK_LOW && prio <= LUA_TASK_HIGH) {
     int task_fn_ref = luaL_ref(L, LUA_REGISTRYINDEX);
-    if(!platform_post(prio, task_handle, (platform_task_param_t)task_fn_ref)) {
+    int status = platform_post(prio, task_handle, (platform_task_param_t)task_fn_ref);
+    if (status == PLATFORM_TASK_POST_FAIL) {
       luaL_unref(L, LUA_REGISTRYINDEX, task_fn_ref);
       luaL_error(L, "Task queue overflow. Task not posted");
     }
-    return task_fn_ref;
+    return status;      /* WOULDBLOCK if parked in the overflow spill list */
   } else {
     return luaL_error(L, "invalid posk task");
   }
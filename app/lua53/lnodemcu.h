@@ -65,6 +65,14 @@
 #define LROT_MASK_NEWINDEX   LROT_MASK(NEWINDEX)
 #define LROT_MASK_GC_INDEX   (LROT_MASK_GC | LROT_MASK_INDEX)
 
+/*
+ * Tables whose non-metamethod keys are declared in strcmp() order can also
+ * include LROT_MASK_SORTED so that key cache misses use a binary search rather
+ * than a linear scan of the flash-resident entries. (The flag sits above the
+ * fast tagmethod bits so it doesn't interfere with fasttm().)
+ */
+#define LROT_MASK_SORTED     cast(lu_byte, 0x80)
+
 
 #define LUA_MAX_ROTABLE_NAME 32  /* Maximum length of a rotable name and of a string key*/
 
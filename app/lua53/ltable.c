@@ -37,6 +37,7 @@
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
+#include "lnodemcu.h"
 #include "lvm.h"
 
 
@@ -731,6 +732,34 @@ int luaH_isdummy (const Table *t) { return isdummy(t); }
 #define NDX_SHFT 24
 #define ADDR_MASK (((size_t) 1<<24)-1)
 
+/*
+** If KEYCACHE_STATS is defined then per-line hit, miss and eviction counts
+** are collected for tuning KEYCACHE_N and KEYCACHE_M.  See node.info().
+*/
+#ifdef KEYCACHE_STATS
+static struct {
+  unsigned hits, misses, evictions;
+} kcstats[KEYCACHE_N];
+#define kcstat(l,f) (kcstats[l].f++)
+#else
+#define kcstat(l,f) ((void) 0)
+#endif
+
+LUA_API int lua_getkeycachestats (lua_State *L, int line, unsigned *stats) {
+  UNUSED(L);
+#ifdef KEYCACHE_STATS
+  if (stats && line >= 0 && line < KEYCACHE_N) {
+    stats[0] = kcstats[line].hits;
+    stats[1] = kcstats[line].misses;
+    stats[2] = kcstats[line].evictions;
+  }
+  return KEYCACHE_N;
+#else
+  UNUSED(line); UNUSED(stats);
+  return 0;
+#endif
+}
+
 /*
  * Find a string key entry in a rotable and return it.
  */
@@ -753,9 +782,11 @@ static const TValue* rotable_findentry(ROTable *t, TString *key, unsigned *ppos)
         strcmp(e[cl_ndx].key, strkey) == 0) {
       if (ppos)
         *ppos = cl_ndx;
+      kcstat(hash, hits);
       return &e[cl_ndx].value;
     }
   }
+  kcstat(hash, misses);
  /*
   * In practice most table scans are from a table miss due to the key cache
   * short-circuiting almost all table hits. ROTable keys can be unsorted
@@ -782,6 +813,23 @@ static const TValue* rotable_findentry(ROTable *t, TString *key, unsigned *ppos)
         j = 0; break;
       }
     }
+  } else if (!(getflags(t) & LROT_MASK_SORTED)) {
+    /* Sorted table so skip any metavalues and binary search the rest */
+    int lo = 0, hi = tl - 1;
+    while (lo < tl && ismeta(e[lo].key))
+      lo++;
+    while (lo <= hi) {
+      int c;
+      i = (lo + hi) >> 1;
+      c = strcmp(e[i].key, strkey);
+      if (c == 0) {
+        j = 0; break;
+      } else if (c < 0) {
+        lo = i + 1;
+      } else {
+        hi = i - 1;
+      }
+    }
   } else {
     for(i = 0; i < tl; i++) {
       if (eq4(e[i].key) && !strcmp(e[i].key, strkey)) {
@@ -794,6 +842,8 @@ static const TValue* rotable_findentry(ROTable *t, TString *key, unsigned *ppos)
   if (ppos)
     *ppos = i;
   /* In the case of a hit, update the lookaside cache */
+  if (cl[KEYCACHE_M-1])
+    kcstat(hash, evictions);
   for (j = KEYCACHE_M-1; j>0; j--)
     cl[j] = cl[j-1];
   cl[0] = ((size_t)t & ADDR_MASK) + (i << NDX_SHFT);
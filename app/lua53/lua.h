@@ -481,6 +481,7 @@ LUA_API int (lua_freeheap) (void);
 LUA_API void (lua_getlfsconfig) (lua_State *L, int *);
 LUA_API int  (lua_pushlfsindex) (lua_State *L);
 LUA_API int  (lua_pushlfsfunc) (lua_State *L);
+LUA_API int  (lua_getkeycachestats) (lua_State *L, int line, unsigned *stats);
 
 
 #define luaN_freearray(L,a,l) luaM_freearray(L,a,l)
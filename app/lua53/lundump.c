@@ -89,6 +89,7 @@ typedef struct {
   lu_int32    pvLen;       /* Length of the same */
   GCObject   *protogc;     /* LFS proto linked list */
   lu_byte     useStrRefs;  /* Flag if set then TStings are a index into TS */
+  lu_byte     TSdupFound;  /* Bitmask of duplicate fixed strings loaded */
   lu_byte     mode;        /* Either LFS or RAM */
 } LoadState;
 static l_noret error(LoadState *S, const char *why) {
@@ -285,9 +286,10 @@ static void LoadConstants (LoadState *S, Proto *f) {
 **
 ** Recovery of dead resources on error handled by the Lua GC as standard in
 ** the case of RAM loading.  In the case of loading an LFS image into flash,
-** the error recovery could be done through the S->protogc list, but given
-** that the immediate action is to restart the CPU, there is little point
-** in adding the extra functionality to recover these dangling resources.
+** the Proto records on the S->protogc list are freed on error, but not any
+** part-built vectors that they reference.  A load on startup is followed by
+** a restart anyway, and a runtime load into an inactive LFS bank only loses
+** these on a corrupt image.
 */
 static void LoadProtos (LoadState *S, Proto *f) {
   int i, n = LoadInt(S);
@@ -499,11 +501,11 @@ static void addTS(LoadState *S, int l, int extra) {
 */
 static void addTSnodup(LoadState *S, const char *s, int extra) {
   int i, l = strlen(s);
-  static struct {const char *k; int found; } t[] = {{"nil", 0},{"function", 0}};
+  static const char *const t[] = {"nil", "function"};
   for (i = 0; i < sizeof(t)/sizeof(*t); i++) {
-    if (!strcmp(t[i].k, s)) {
-      if (t[i].found) return;  /* ignore the duplicate copy */
-      t[i].found = 1; /* flag that this constant is already loaded */
+    if (!strcmp(t[i], s)) {
+      if (S->TSdupFound & (1<<i)) return;  /* ignore the duplicate copy */
+      S->TSdupFound |= 1<<i; /* flag that this constant is already loaded */
       break;
       }
   }
@@ -615,12 +617,15 @@ static void undumpLFS(lua_State *L, void *ud) {
 }
 /*
 ** Load precompiled LFS image.  This is called from a hook in the firmware
-** startup if LFS reload is required.
+** startup if LFS reload is required, or to load the inactive bank of a dual
+** bank LFS while the application is running.  In the latter case a failed
+** load must not leak the in-RAM Protos still held on the protogc list.
 */
 LUAI_FUNC int luaU_undumpLFS(lua_State *L, ZIO *Z, int isabs) {
   LFSHeader fh = {0};
   LoadState S  = {0};
   int status;
+  fh.state = ~0;
   S.L = L;
   S.Z = Z;
   S.mode = isabs && sizeof(size_t) != sizeof(lu_int32) ? MODE_LFSA : MODE_LFS;
@@ -632,6 +637,11 @@ LUAI_FUNC int luaU_undumpLFS(lua_State *L, ZIO *Z, int isabs) {
   luaM_freearray(L, S.buff, S.buffLen);
   luaM_freearray(L, S.list, S.listLen);
   luaM_freearray(L, S.pv, S.pvLen);
+  while (S.protogc) {
+    Proto *f = gco2p(S.protogc);
+    S.protogc = f->next;
+    luaM_free(L, f);
+  }
   L->nny--;
   return status;
 }
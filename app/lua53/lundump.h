@@ -71,7 +71,7 @@ struct FlashHeader{
   lu_int32 protoHead;     /* offset of linked list of Protos in LFS */
   lu_int32 shortTShead;   /* offset of linked list of short TStrings in LFS */
   lu_int32 longTShead;    /* offset of linked list of long TStrings in LFS */
-  lu_int32 reserved;
+  lu_int32 state;         /* LFS_STATE_XXX bank flags, cleared once each */
 };
 
 #ifdef LUA_USE_HOST
@@ -89,6 +89,16 @@ LUAI_FUNC void luaN_setabsolute(lu_int32 addr);
 #define FLASH_SIG_IN_PROGRESS 0x08
 #define FLASH_SIG  (0xfafaa050 | FLASH_FORMAT_VERSION)
 
+/*
+** The header state word is written as ~0 and its flags are cleared one at a
+** time by later writes, which needs no sector erase.  See lnodemcu.c
+*/
+#define LFS_STATE_BOOTED      0x01
+#define LFS_STATE_CONFIRMED   0x02
+#define LFS_STATE_RETIRED     0x04
+#define LFS_STATE_FAILED      0x08
+#define LFS_STATE_MASK        0x0F
+
 #define FLASH_FORMAT_MASK    0xF00
 
 #endif
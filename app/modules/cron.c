@@ -6,6 +6,8 @@
 #include "user_interface.h"
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 #include "ets_sys.h"
 #include "time.h"
@@ -23,12 +25,31 @@ struct cronent_desc {
 typedef struct cronent_ud {
   struct cronent_desc desc;
   int cb_ref;
+  int tab_ix;    // index in the entry table, 0 if unscheduled
+  int heap_ix;   // position in cron_heap, -1 if not queued
+  uint32_t next; // next fire time (UTC seconds), 0 if it never matches
 } cronent_ud_t;
 
+// Give up looking for a match after this many days; 28 years covers the
+// rarest valid match (29 February on a given weekday)
+#define CRON_MAX_DAYS  (28 * 366)
+// Maximum time to sleep before re-checking the RTC, in mS
+#define CRON_MAX_WAIT  3600000
+// Treat the RTC as having been set if it is this far from where it should be
+#define CRON_MAX_SKEW  30
+
 static ETSTimer cron_timer;
 
 static int cronent_table_ref;
 
+// Scheduled entries, as a min-heap ordered by next fire time
+static cronent_ud_t **cron_heap;
+static int cron_heap_len, cron_heap_size;
+// Whether the heap has been built against a valid RTC time
+static bool cron_synced;
+// RTC time (seconds) at which cron_timer is due
+static uint32_t cron_wake;
+
 static uint64_t lcron_parsepart(lua_State *L, char *str, char **end, uint8_t min, uint8_t max) {
   uint64_t res = 0;
 
@@ -82,57 +103,141 @@ static int lcron_parsedesc(lua_State *L, char *str, struct cronent_desc *desc) {
   return 0;
 }
 
+// Returns the start of the first minute at or after 'from' matching desc
+static uint32_t lcron_nexttime(const struct cronent_desc *desc, uint32_t from) {
+  uint32_t t = (from + 59) / 60 * 60;
+
+  for (int days = 0; days < CRON_MAX_DAYS; days++) {
+    time_t tt = t;
+    struct tm tm;
+    uint32_t day = t - t % 86400;
+    gmtime_r(&tt, &tm);
+    if ((desc->mon & (1 << tm.tm_mon)) &&
+        (desc->dom & ((uint32_t)1 << (tm.tm_mday - 1))) &&
+        (desc->dow & (1 << tm.tm_wday))) {
+      for (int hour = tm.tm_hour; hour < 24; hour++) {
+        if (!(desc->hour & ((uint32_t)1 << hour))) continue;
+        int min = hour == tm.tm_hour ? tm.tm_min : 0;
+        uint64_t mins = desc->min >> min;
+        if (mins) return day + hour * 3600 + (min + __builtin_ctzll(mins)) * 60;
+      }
+    }
+    t = day + 86400;
+  }
+  return 0;
+}
+
+static int lcron_heap_less(int a, int b) {
+  return cron_heap[a]->next < cron_heap[b]->next;
+}
+
+static void lcron_heap_swap(int a, int b) {
+  cronent_ud_t *ent = cron_heap[a];
+  cron_heap[a] = cron_heap[b];
+  cron_heap[b] = ent;
+  cron_heap[a]->heap_ix = a;
+  cron_heap[b]->heap_ix = b;
+}
+
+static void lcron_heap_fix(int i) {
+  while (i > 0 && lcron_heap_less(i, (i - 1) / 2)) {
+    lcron_heap_swap(i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+  for (;;) {
+    int c = 2 * i + 1;
+    if (c >= cron_heap_len) break;
+    if (c + 1 < cron_heap_len && lcron_heap_less(c + 1, c)) c++;
+    if (!lcron_heap_less(c, i)) break;
+    lcron_heap_swap(i, c);
+    i = c;
+  }
+}
+
+static void lcron_heap_remove(cronent_ud_t *ent) {
+  int i = ent->heap_ix;
+  if (i < 0) return;
+  ent->heap_ix = -1;
+  if (i != --cron_heap_len) {
+    cron_heap[i] = cron_heap[cron_heap_len];
+    cron_heap[i]->heap_ix = i;
+    lcron_heap_fix(i);
+  }
+}
+
+// (Re)queues the entry to fire at its next matching time from 'from'
+static int lcron_heap_queue(cronent_ud_t *ent, uint32_t from) {
+  lcron_heap_remove(ent);
+  ent->next = lcron_nexttime(&ent->desc, from);
+  if (ent->next == 0) return 0;
+  if (cron_heap_len == cron_heap_size) {
+    int size = cron_heap_size ? 2 * cron_heap_size : 4;
+    cronent_ud_t **heap = realloc(cron_heap, size * sizeof(*heap));
+    if (!heap) return -1;
+    cron_heap = heap;
+    cron_heap_size = size;
+  }
+  ent->heap_ix = cron_heap_len++;
+  cron_heap[ent->heap_ix] = ent;
+  lcron_heap_fix(ent->heap_ix);
+  return 0;
+}
+
+static void lcron_arm(void);
+
+static uint32_t lcron_now(void) {
+  struct rtc_timeval tv;
+  rtctime_gettimeofday(&tv);
+  return tv.tv_sec;
+}
+
+// Pins the entry at stack index idx in the entry table and queues it
+static void lcron_pin(lua_State *L, int idx, cronent_ud_t *ud) {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, cronent_table_ref);
+  if (ud->tab_ix == 0) {
+    // Find a free index
+    int ix = 1;
+    while (lua_rawgeti(L, -1, ix), !lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      ix++;
+    }
+    lua_pop(L, 1); // pop the nil off the stack
+    lua_pushvalue(L, idx);
+    lua_rawseti(L, -2, ix);
+    ud->tab_ix = ix;
+  }
+  lua_pop(L, 1);
+  // Until the RTC is valid, entries are queued by cron_handle_tmr
+  int err = cron_synced ? lcron_heap_queue(ud, lcron_now()) : 0;
+  lcron_arm();
+  if (err) luaL_error(L, "out of memory");
+}
+
 static int lcron_create(lua_State *L) {
   // Check arguments
   char *strdesc = (char*)luaL_checkstring(L, 1);
   luaL_checktype(L, 2, LUA_TFUNCTION);
 
-  // Grab the table of all entries onto the stack
-  lua_rawgeti(L, LUA_REGISTRYINDEX, cronent_table_ref);
-
-  // Find a free index
-  int ix = 1;
-  while(lua_rawgeti(L, -1, ix) != LUA_TNIL) {
-    lua_pop(L, 1);
-    ix++;
-  }
-  lua_pop(L, 1); // pop the nil off the stack
-
   // Allocate userdata onto the stack
   cronent_ud_t *ud = lua_newuserdata(L, sizeof(cronent_ud_t));
+  ud->cb_ref = LUA_NOREF;
+  ud->tab_ix = 0;
+  ud->heap_ix = -1;
   // Set metatable
   luaL_getmetatable(L, "cron.entry");
   lua_setmetatable(L, -2);
+  // Set entry
+  lcron_parsedesc(L, strdesc, &ud->desc);
   // Set callback
   lua_pushvalue(L, 2);
   ud->cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
-  // Set entry
-  lcron_parsedesc(L, strdesc, &ud->desc);
 
-  // Store entry to table while preserving userdata
-  lua_pushvalue(L, -1); // clone userdata
-  lua_rawseti(L, -3, ix); // -userdata; userdata, cronent table, cb, desc
+  // Store entry to table and queue it
+  lcron_pin(L, -1, ud);
 
   return 1; // just the userdata
 }
 
-// Finds index, leaves table at top of stack for convenience
-static size_t lcron_findindex(lua_State *L, cronent_ud_t *ud) {
-  lua_rawgeti(L, LUA_REGISTRYINDEX, cronent_table_ref);
-  size_t count = lua_objlen(L, -1);
-
-  for (size_t i = 1; i <= count; i++) {
-    lua_rawgeti(L, -1, i);
-    cronent_ud_t *eud = lua_touserdata(L, -1);
-    lua_pop(L, 1);
-    if (eud == ud) {
-      return i;
-    }
-  }
-
-  return count + 1;
-}
-
 static int lcron_schedule(lua_State *L) {
   cronent_ud_t *ud = luaL_checkudata(L, 1, "cron.entry");
   char *strdesc = (char*)luaL_optstring(L, 2, NULL);
@@ -143,10 +248,7 @@ static int lcron_schedule(lua_State *L) {
     ud->desc = desc;
   }
 
-  size_t i = lcron_findindex(L, ud);
-
-  lua_pushvalue(L, 1); // copy ud to top of stack
-  lua_rawseti(L, -2, i); // install into table
+  lcron_pin(L, 1, ud);
 
   return 0;
 }
@@ -162,10 +264,15 @@ static int lcron_handler(lua_State *L) {
 
 static int lcron_unschedule(lua_State *L) {
   cronent_ud_t *ud = luaL_checkudata(L, 1, "cron.entry");
-  size_t i = lcron_findindex(L, ud);
 
-  lua_pushnil(L);
-  lua_rawseti(L, -2, i);
+  lcron_heap_remove(ud);
+  if (ud->tab_ix) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cronent_table_ref);
+    lua_pushnil(L);
+    lua_rawseti(L, -2, ud->tab_ix);
+    ud->tab_ix = 0;
+  }
+  lcron_arm();
 
   return 0;
 }
@@ -178,6 +285,22 @@ static int lcron_delete(lua_State *L) {
 }
 
 static int lcron_reset(lua_State *L) {
+  // Any entries still referenced from Lua are no longer scheduled
+  while (cron_heap_len > 0) {
+    cron_heap[0]->tab_ix = 0;
+    lcron_heap_remove(cron_heap[0]);
+  }
+  if (cronent_table_ref != LUA_NOREF) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cronent_table_ref);
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      ((cronent_ud_t *)lua_touserdata(L, -1))->tab_ix = 0;
+      lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+  }
+  lcron_arm();
+
   lua_newtable(L);
   luaL_unref(L, LUA_REGISTRYINDEX, cronent_table_ref);
   cronent_table_ref = luaL_ref(L, LUA_REGISTRYINDEX);
@@ -185,55 +308,70 @@ static int lcron_reset(lua_State *L) {
   return 0;
 }
 
-static void cron_handle_time(uint8_t mon, uint8_t dom, uint8_t dow, uint8_t hour, uint8_t min) {
-  lua_State *L = lua_getstate();
-  struct cronent_desc desc;
-  desc.mon  = (uint16_t)1 << (mon - 1);
-  desc.dom  = (uint32_t)1 << (dom - 1);
-  desc.dow  = ( uint8_t)1 << dow;
-  desc.hour = (uint32_t)1 << hour;
-  desc.min  = (uint64_t)1 << min;
+// Arms the timer for the earliest queued entry, or to poll for the RTC
+static void lcron_arm(void) {
+  struct rtc_timeval tv;
+  uint32_t wait;
 
-  lua_rawgeti(L, LUA_REGISTRYINDEX, cronent_table_ref);
-  size_t count = lua_objlen(L, -1);
+  os_timer_disarm(&cron_timer);
+  if (!cron_synced) { // Wait for RTC time
+    os_timer_arm(&cron_timer, 1000, 0);
+    return;
+  }
+  rtctime_gettimeofday(&tv);
+  if (cron_heap_len > 0 && cron_heap[0]->next <= tv.tv_sec) {
+    cron_wake = tv.tv_sec;
+    wait = 1;
+  } else if (cron_heap_len > 0 && cron_heap[0]->next - tv.tv_sec <= CRON_MAX_WAIT / 1000) {
+    cron_wake = cron_heap[0]->next;
+    wait = (cron_wake - tv.tv_sec) * 1000 - tv.tv_usec / 1000;
+  } else {
+    cron_wake = tv.tv_sec + CRON_MAX_WAIT / 1000;
+    wait = CRON_MAX_WAIT;
+  }
+  os_timer_arm(&cron_timer, wait, 0);
+}
 
-  for (size_t i = 1; i <= count; i++) {
-    lua_rawgeti(L, -1, i);
-    cronent_ud_t *ent = lua_touserdata(L, -1);
+// Requeues every pinned entry relative to the current time
+static void lcron_requeue(lua_State *L, uint32_t now) {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, cronent_table_ref);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    lcron_heap_queue(lua_touserdata(L, -1), now);
     lua_pop(L, 1);
-
-    if ((ent->desc.mon  & desc.mon ) == 0) continue;
-    if ((ent->desc.dom  & desc.dom ) == 0) continue;
-    if ((ent->desc.dow  & desc.dow ) == 0) continue;
-    if ((ent->desc.hour & desc.hour) == 0) continue;
-    if ((ent->desc.min  & desc.min ) == 0) continue;
-
-    lua_rawgeti(L, LUA_REGISTRYINDEX, ent->cb_ref);
-    lua_rawgeti(L, -2, i); // get ud again
-    luaL_pcallx(L, 1, 0);
   }
-
-  lua_pop(L, 1); // pop table
+  lua_pop(L, 1);
 }
 
 static void cron_handle_tmr() {
-  struct rtc_timeval tv;
-  rtctime_gettimeofday(&tv);
-  if (tv.tv_sec == 0) { // Wait for RTC time
-    os_timer_arm(&cron_timer, 1000, 0);
+  lua_State *L = lua_getstate();
+  uint32_t now = lcron_now();
+
+  if (now == 0) { // Wait for RTC time
+    cron_synced = false;
+    lcron_arm();
     return;
   }
-  time_t t = tv.tv_sec;
-  struct tm tm;
-  gmtime_r(&t, &tm);
-  uint32_t diff = 60000 - tm.tm_sec * 1000 - tv.tv_usec / 1000;
-  if (tm.tm_sec == 59) {
-    t++;
-    diff += 60000;
-    gmtime_r(&t, &tm);
+  // The first time the RTC is valid, or if it has been set since, the queue
+  // has to be rebuilt.  Any matches in a skipped interval are not run.
+  if (!cron_synced || now + CRON_MAX_SKEW < cron_wake ||
+      now > cron_wake + CRON_MAX_SKEW) {
+    cron_synced = true;
+    lcron_requeue(L, now);
+  }
+
+  // Fire everything due.  Each entry is requeued before its callback runs, so
+  // that the callback can reschedule or unschedule it (or anything else).
+  while (cron_heap_len > 0 && cron_heap[0]->next <= now) {
+    cronent_ud_t *ent = cron_heap[0];
+    lcron_heap_queue(ent, ent->next + 60 > now ? ent->next + 60 : now);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ent->cb_ref);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cronent_table_ref);
+    lua_rawgeti(L, -1, ent->tab_ix);
+    lua_remove(L, -2);
+    luaL_pcallx(L, 1, 0);
   }
-  os_timer_arm(&cron_timer, diff, 0);
-  cron_handle_time(tm.tm_mon + 1, tm.tm_mday, tm.tm_wday, tm.tm_hour, tm.tm_min);
+  lcron_arm();
 }
 
 
@@ -260,7 +398,6 @@ int luaopen_cron( lua_State *L ) {
   SWTIMER_REG_CB(cron_handle_tmr, SWTIMER_RESTART);
     //cron_handle_tmr determines when to execute a scheduled cron job
     //My guess: To be sure to give the other modules required by cron enough time to get to a ready state, restart cron_timer.
-  os_timer_arm(&cron_timer, 1000, 0);
   luaL_rometatable(L, "cron.entry", LROT_TABLEREF(cronent));
 
   cronent_table_ref = LUA_NOREF;
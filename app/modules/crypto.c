@@ -6,6 +6,7 @@
 #include "platform.h"
 #include <stdint.h>
 #include <stddef.h>
+#include <string.h>
 #include "vfs.h"
 #include "../crypto/digests.h"
 #include "../crypto/mech.h"
@@ -21,6 +22,14 @@ typedef struct {
   uint8_t *k_opad;
 } digest_user_datum_t;
 
+typedef struct {
+  crypto_stream_t stream;
+  bool finalized;
+} cipher_user_datum_t;
+
+// Size of the pieces in which file and pipe input is read and processed
+#define CRYPTO_CHUNK 256
+
 /**
   * hash = crypto.sha1(input)
   *
@@ -71,6 +80,7 @@ static int crypto_mask( lua_State* L )
 static inline int bad_mech (lua_State *L) { return luaL_error (L, "unknown hash mech"); }
 static inline int bad_mem  (lua_State *L) { return luaL_error (L, "insufficient memory"); }
 static inline int bad_file (lua_State *L) { return luaL_error (L, "file does not exist"); }
+static inline int bad_key  (lua_State *L) { return luaL_error (L, "invalid key"); }
 
 /* rawdigest = crypto.hash("MD5", str)
  * strdigest = encoder.toHex(rawdigest)
@@ -157,23 +167,61 @@ static int crypto_new_hmac (lua_State *L)
 }
 
 
+/* Passes the input at stack index src to fn.  This is either a string, or
+ * an object such as a file or pipe with a read(n) method, which is read a
+ * chunk at a time until it returns nil or an empty string, so that large
+ * inputs can be processed without holding them in the heap.  */
+typedef void (*crypto_input_fn) (lua_State *L, void *arg, const char *data, size_t len);
+
+static void crypto_input (lua_State *L, int src, crypto_input_fn fn, void *arg)
+{
+  size_t len = 0;
+  if (lua_isstring (L, src)) {
+    const char *data = lua_tolstring (L, src, &len);
+    fn (L, arg, data, len);
+    return;
+  }
+  luaL_argcheck (L, lua_istable (L, src) || lua_isuserdata (L, src), src,
+                 "string, file or pipe expected");
+
+  char chunk[CRYPTO_CHUNK];
+  for (;;) {
+    lua_getfield (L, src, "read");
+    lua_pushvalue (L, src);
+    lua_pushinteger (L, CRYPTO_CHUNK);
+    lua_call (L, 2, 1);
+    const char *data = lua_tolstring (L, -1, &len);
+    if (!data || !len)
+      break;
+    // fn may add to a luaL_Buffer, so the chunk can't be left on the stack
+    // while a longer string is processed piecewise
+    if (len > CRYPTO_CHUNK)
+      luaL_error (L, "read returned more than %d bytes", CRYPTO_CHUNK);
+    // copy the chunk so that it can be popped before fn touches the stack
+    memcpy (chunk, data, len);
+    lua_pop (L, 1);
+    fn (L, arg, chunk, len);
+  }
+  lua_pop (L, 1);
+}
+
+static void hash_input (lua_State *L, void *arg, const char *data, size_t len)
+{
+  digest_user_datum_t *dudat = (digest_user_datum_t *)arg;
+  dudat->mech_info->update (dudat->ctx, data, len);
+}
+
 /* Called as object, params:
    1 - userdata "this"
-   2 - new string to add to the hash state  */
+   2 - new string, file or pipe to add to the hash state  */
 static int crypto_hash_update (lua_State *L)
 {
   NODE_DBG("enter crypto_hash_update.\n");
   digest_user_datum_t *dudat;
-  size_t sl;
 
   dudat = (digest_user_datum_t *)luaL_checkudata(L, 1, "crypto.hash");
-
-  const digest_mech_info_t *mi = dudat->mech_info;
-
-  size_t len = 0;
-  const char *data = luaL_checklstring (L, 2, &len);
-
-  mi->update (dudat->ctx, data, len);
+  luaL_checkany (L, 2);
+  crypto_input (L, 2, hash_input, dudat);
 
   return 0;  // No return value
 }
@@ -313,6 +361,146 @@ static int lcrypto_decrypt (lua_State *L)
   return crypto_encdec (L, false);
 }
 
+/* General Usage for incremental encryption and decryption:
+ * enc = crypto.new_encrypt("AES-CTR", key, iv)
+ * out = enc:update("Data") .. enc:update(fileobj) .. enc:finalize()
+ * or, to pass the output on as it is produced rather than return it,
+ * enc:update(fileobj, outfile); enc:finalize(outfile)
+ */
+
+typedef struct {
+  cipher_user_datum_t *cudat;
+  int dst;              // output function or object, or 0 to collect in b
+  luaL_Buffer b;
+} cipher_output_t;
+
+static void cipher_emit (lua_State *L, cipher_output_t *co, const char *data, size_t len)
+{
+  if (!len)
+    return;
+  if (!co->dst) {
+    luaL_addlstring (&co->b, data, len);
+    return;
+  }
+  if (lua_isfunction (L, co->dst)) {
+    lua_pushvalue (L, co->dst);
+  } else {
+    lua_getfield (L, co->dst, "write");
+    lua_pushvalue (L, co->dst);
+  }
+  lua_pushlstring (L, data, len);
+  lua_call (L, lua_isfunction (L, co->dst) ? 1 : 2, 0);
+}
+
+static void cipher_input (lua_State *L, void *arg, const char *data, size_t len)
+{
+  cipher_output_t *co = (cipher_output_t *)arg;
+  char out[CRYPTO_CHUNK + CRYPTO_MAX_BLOCKSIZE];
+
+  while (len) {
+    size_t n = len > CRYPTO_CHUNK ? CRYPTO_CHUNK : len;
+    cipher_emit (L, co, out, crypto_stream_update (&co->cudat->stream, data, n, out));
+    data += n;
+    len -= n;
+  }
+}
+
+static cipher_user_datum_t *cipher_begin (lua_State *L, cipher_output_t *co, int dst)
+{
+  cipher_user_datum_t *cudat = (cipher_user_datum_t *)luaL_checkudata(L, 1, "crypto.cipher");
+  if (cudat->finalized)
+    luaL_error (L, "cipher already finalized");
+
+  co->cudat = cudat;
+  if (lua_isnoneornil (L, dst)) {
+    co->dst = 0;
+    luaL_buffinit (L, &co->b);
+  } else {
+    luaL_argcheck (L, lua_isfunction (L, dst) || lua_istable (L, dst) ||
+                      lua_isuserdata (L, dst), dst, "function, file or pipe expected");
+    co->dst = dst;
+  }
+  return cudat;
+}
+
+static int cipher_end (lua_State *L, cipher_output_t *co)
+{
+  if (co->dst)
+    return 0;
+  luaL_pushresult (&co->b);
+  return 1;
+}
+
+static int crypto_new_cipher (lua_State *L, bool enc)
+{
+  const crypto_mech_t *mech = get_mech (L, 1);
+  size_t klen, ivlen;
+  const char *key = luaL_checklstring (L, 2, &klen);
+  const char *iv = luaL_optlstring (L, 3, "", &ivlen);
+  if (klen != 16)   // the SDK's AES only takes 128 bit keys
+    return bad_key (L);
+
+  cipher_user_datum_t *cudat = (cipher_user_datum_t *)lua_newuserdata(L, sizeof(*cudat));
+  cudat->stream.ctx = NULL;
+  cudat->finalized  = true;  // until the stream is successfully initialised
+  luaL_getmetatable(L, "crypto.cipher");
+  lua_setmetatable(L, -2);
+
+  if (!crypto_stream_init (&cudat->stream, mech, enc ? OP_ENCRYPT : OP_DECRYPT,
+                           key, klen, iv, ivlen))
+    return bad_mem (L);
+  cudat->finalized = false;
+  return 1;
+}
+
+/* crypto.new_encrypt("MECH", "KEY" [, "IV"]) */
+static int lcrypto_new_encrypt (lua_State *L)
+{
+  return crypto_new_cipher (L, true);
+}
+
+/* crypto.new_decrypt("MECH", "KEY" [, "IV"]) */
+static int lcrypto_new_decrypt (lua_State *L)
+{
+  return crypto_new_cipher (L, false);
+}
+
+/* Called as object, params:
+   1 - userdata "this"
+   2 - string, file or pipe to process
+   3 - optional function, file or pipe to pass the output to
+   Returns the output, or nothing if passed to 3 */
+static int crypto_cipher_update (lua_State *L)
+{
+  cipher_output_t co;
+  cipher_begin (L, &co, 3);
+  luaL_checkany (L, 2);
+  crypto_input (L, 2, cipher_input, &co);
+  return cipher_end (L, &co);
+}
+
+/* Called as object, with an optional output function, file or pipe.
+   Pads and processes any partial block and frees the cipher context. */
+static int crypto_cipher_finalize (lua_State *L)
+{
+  cipher_output_t co;
+  cipher_user_datum_t *cudat = cipher_begin (L, &co, 2);
+  char out[CRYPTO_MAX_BLOCKSIZE];
+
+  size_t n = crypto_stream_finalize (&cudat->stream, out);
+  crypto_stream_deinit (&cudat->stream);
+  cudat->finalized = true;
+  cipher_emit (L, &co, out, n);
+  return cipher_end (L, &co);
+}
+
+static int crypto_cipher_gc (lua_State *L)
+{
+  cipher_user_datum_t *cudat = (cipher_user_datum_t *)luaL_checkudata(L, 1, "crypto.cipher");
+  crypto_stream_deinit (&cudat->stream);
+  return 0;
+}
+
 // Hash function map
 
 LROT_BEGIN(crypto_hash_map, NULL, LROT_MASK_INDEX)
@@ -321,6 +509,15 @@ LROT_BEGIN(crypto_hash_map, NULL, LROT_MASK_INDEX)
   LROT_FUNCENTRY( finalize, crypto_hash_finalize )
 LROT_END(crypto_hash_map, NULL, LROT_MASK_INDEX)
 
+// Cipher function map
+
+LROT_BEGIN(crypto_cipher_map, NULL, LROT_MASK_GC_INDEX)
+  LROT_FUNCENTRY( __gc, crypto_cipher_gc )
+  LROT_TABENTRY( __index, crypto_cipher_map )
+  LROT_FUNCENTRY( update, crypto_cipher_update )
+  LROT_FUNCENTRY( finalize, crypto_cipher_finalize )
+LROT_END(crypto_cipher_map, NULL, LROT_MASK_GC_INDEX)
+
 
 
 // Module function map
@@ -334,12 +531,15 @@ LROT_BEGIN(crypto, NULL, 0)
   LROT_FUNCENTRY( new_hmac, crypto_new_hmac )
   LROT_FUNCENTRY( encrypt, lcrypto_encrypt )
   LROT_FUNCENTRY( decrypt, lcrypto_decrypt )
+  LROT_FUNCENTRY( new_encrypt, lcrypto_new_encrypt )
+  LROT_FUNCENTRY( new_decrypt, lcrypto_new_decrypt )
 LROT_END(crypto, NULL, 0)
 
 
 int luaopen_crypto ( lua_State *L )
 {
   luaL_rometatable(L, "crypto.hash", LROT_TABLEREF(crypto_hash_map));
+  luaL_rometatable(L, "crypto.cipher", LROT_TABLEREF(crypto_cipher_map));
   return 0;
 }
 
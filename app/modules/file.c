@@ -186,15 +186,23 @@ static int file_format( lua_State* L )
   return 0;
 }
 
+// Lua: addr, size, cache_pages, write_back = fscfg([cache_pages[, write_back]])
 static int file_fscfg (lua_State *L)
 {
   uint32_t phys_addr, phys_size;
+  int32_t pages = luaL_optinteger(L, 1, -1);
+  int32_t write_back = lua_isnoneornil(L, 2) ? -1 : lua_toboolean(L, 2);
 
+  if (vfs_fscache("/FLASH", &pages, &write_back) != VFS_RES_OK) {
+    return luaL_error(L, "cannot change cache, check size and close all files");
+  }
   vfs_fscfg("/FLASH", &phys_addr, &phys_size);
 
   lua_pushinteger (L, phys_addr);
   lua_pushinteger (L, phys_size);
-  return 2;
+  lua_pushinteger (L, pages);
+  lua_pushboolean (L, write_back);
+  return 4;
 }
 
 // Lua: open(filename, mode)
@@ -618,7 +626,21 @@ static int file_fsinfo( lua_State* L )
   lua_pushinteger(L, total-used);
   lua_pushinteger(L, used);
   lua_pushinteger(L, total);
-  return 3;
+
+  struct vfs_fsstats st;
+  if (vfs_fsstats("", &st) != VFS_RES_OK) {
+    return 3;
+  }
+  lua_createtable(L, 0, 4);
+  lua_pushinteger(L, st.cache_hits);
+  lua_setfield(L, -2, "cache_hits");
+  lua_pushinteger(L, st.cache_misses);
+  lua_setfield(L, -2, "cache_misses");
+  lua_pushinteger(L, st.gc_runs);
+  lua_setfield(L, -2, "gc_runs");
+  lua_pushinteger(L, st.erases);
+  lua_setfield(L, -2, "erases");
+  return 4;
 }
 
 typedef struct {
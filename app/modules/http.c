@@ -11,9 +11,63 @@
 #include "cpu_esp8266.h"
 #include "http/httpclient.h"
 #include <ctype.h>
-static int http_callback_registry  = LUA_NOREF;
+#include <stdint.h>
 
-static void http_callback( char * response, int http_status, char ** full_response_p, int body_size )
+// Pushes a table of the headers in a response, skipping the status line
+static void http_push_headers( lua_State *L, const char *p )
+{
+  lua_newtable(L);
+
+  // Need to skip the HTTP/1.1 header line
+  while (*p && *p != '\n') {
+    p++;
+  }
+  if (*p == '\n') {
+    p++;
+  }
+
+  while (*p && *p != '\r' && *p != '\n') {
+    const char *eol = p;
+    while (*eol && *eol != '\r') {
+      eol++;
+    }
+
+    const char *colon = p;
+    while (*colon != ':' && colon < eol) {
+      colon++;
+    }
+
+    if (*colon != ':') {
+      break;
+    }
+
+    const char *value = colon + 1;
+    while (*value == ' ') {
+      value++;
+    }
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    while (p < colon) {
+      luaL_addchar(&b, tolower((unsigned char) *p));
+      p++;
+    }
+    luaL_pushresult(&b);
+
+    lua_pushlstring(L, value, eol - value);
+    lua_settable(L, -3);
+
+    p = eol + 1;
+    if (*p == '\n') {
+      p++;
+    }
+  }
+}
+
+// Each request carries the registry reference of its callback as the argument
+#define HTTP_REF(arg) ((int)(intptr_t)(arg))
+
+static void http_callback( char * response, int http_status, char ** full_response_p, int body_size, void * arg )
 {
   const char *full_response = full_response_p ? *full_response_p : NULL;
 
@@ -27,64 +81,17 @@ static void http_callback( char * response, int http_status, char ** full_respon
     dbg_printf( "response=%s<EOF>\n", response );
   }
 #endif
-  if (http_callback_registry != LUA_NOREF)
+  if (HTTP_REF(arg) != LUA_NOREF)
   {
     lua_State *L = lua_getstate();
 
-    lua_rawgeti(L, LUA_REGISTRYINDEX, http_callback_registry);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, HTTP_REF(arg));
 
     lua_pushinteger(L, http_status);
     if ( http_status != HTTP_STATUS_GENERIC_ERROR && response)
     {
       lua_pushlstring(L, response, (size_t)body_size);
-      lua_newtable(L);
-
-      const char *p = full_response;
-
-      // Need to skip the HTTP/1.1 header line
-      while (*p && *p != '\n') {
-        p++;
-      }
-      if (*p == '\n') {
-        p++;
-      }
-
-      while (*p && *p != '\r' && *p != '\n') {
-        const char *eol = p;
-        while (*eol && *eol != '\r') {
-          eol++;
-        }
-
-        const char *colon = p;
-        while (*colon != ':' && colon < eol) {
-          colon++;
-        }
-
-        if (*colon != ':') {
-          break;
-        }
-
-        const char *value = colon + 1;
-        while (*value == ' ') {
-          value++;
-        }
-
-        luaL_Buffer b;
-        luaL_buffinit(L, &b);
-        while (p < colon) {
-          luaL_addchar(&b, tolower((unsigned char) *p));
-          p++;
-        }
-        luaL_pushresult(&b);
-
-        lua_pushlstring(L, value, eol - value);
-        lua_settable(L, -3);
-
-        p = eol + 1;
-        if (*p == '\n') {
-          p++;
-        }
-      }
+      http_push_headers(L, full_response);
     }
     else
     {
@@ -97,13 +104,97 @@ static void http_callback( char * response, int http_status, char ** full_respon
       *full_response_p = NULL;
     }
 
-    luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = LUA_NOREF;
+    luaL_unref(L, LUA_REGISTRYINDEX, HTTP_REF(arg));
 
     luaL_pcallx(L, 3, 0); // With 3 arguments and 0 result
   }
 }
 
+// Pushes field "name" of the table of streaming callbacks, returning its type
+static int http_stream_field( lua_State *L, void *arg, const char *name )
+{
+  lua_rawgeti(L, LUA_REGISTRYINDEX, HTTP_REF(arg));
+  lua_getfield(L, -1, name);
+  lua_remove(L, -2);
+  return lua_type(L, -1);
+}
+
+static void http_stream_headers( void *arg, int http_status, const char *headers )
+{
+  lua_State *L = lua_getstate();
+
+  if (http_stream_field(L, arg, "headers") != LUA_TFUNCTION) {
+    lua_pop(L, 1);
+    return;
+  }
+  lua_pushinteger(L, http_status);
+  http_push_headers(L, headers);
+  luaL_pcallx(L, 2, 0);
+}
+
+// The body goes to the "data" function, or to the write method of anything else
+// such as a file or pipe object.  The transfer is aborted on an error or if the
+// first value returned is false or nil, but not if no value is returned at all.
+static int http_stream_data( void *arg, const char *data, int len )
+{
+  lua_State *L = lua_getstate();
+  int top = lua_gettop(L);
+  int nargs = 1;
+
+  switch (http_stream_field(L, arg, "data")) {
+    case LUA_TFUNCTION:
+      break;
+    case LUA_TNIL:
+      lua_pop(L, 1);
+      return 0;
+    default:
+      lua_getfield(L, -1, "write");
+      lua_insert(L, -2);
+      nargs = 2;
+      break;
+  }
+  lua_pushlstring(L, data, len);
+  int abort = luaL_pcallx(L, nargs, LUA_MULTRET) != 0 ||
+              (lua_gettop(L) > top && !lua_toboolean(L, top + 1));
+  lua_settop(L, top);
+  return abort;
+}
+
+static void http_stream_done( void *arg, int http_status )
+{
+  lua_State *L = lua_getstate();
+  int type = http_stream_field(L, arg, "complete");
+
+  luaL_unref(L, LUA_REGISTRYINDEX, HTTP_REF(arg));
+  if (type == LUA_TFUNCTION) {
+    lua_pushinteger(L, http_status);
+    luaL_pcallx(L, 1, 0);
+  } else {
+    lua_pop(L, 1);
+  }
+}
+
+// Issues the request with the callback at index idx, if there is one, which is
+// either a function or a table of streaming callbacks
+static void http_send( lua_State *L, int idx, const char *url, const char *method,
+                       const char *headers, const char *body )
+{
+  int ref = LUA_NOREF;
+
+  if (lua_isfunction(L, idx) || lua_istable(L, idx)) {
+    lua_pushvalue(L, idx);  // copy argument (func) to the top of stack
+    ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  if (lua_istable(L, idx)) {
+    http_stream_t stream = {
+      http_stream_headers, http_stream_data, http_stream_done, (void *)(intptr_t)ref
+    };
+    http_stream_request(url, method, headers, body, &stream);
+  } else {
+    http_request(url, method, headers, body, http_callback, (void *)(intptr_t)ref, 0);
+  }
+}
+
 // Lua: http.request( url, method, header, body, function(status, reponse) end )
 static int http_lapi_request( lua_State *L )
 {
@@ -128,13 +219,7 @@ static int http_lapi_request( lua_State *L )
     body = luaL_checklstring(L, 4, &length);
   }
 
-  if (lua_isfunction(L, 5)) {
-    lua_pushvalue(L, 5);  // copy argument (func) to the top of stack
-    luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
-  }
-
-  http_request(url, method, headers, body, http_callback, 0);
+  http_send(L, 5, url, method, headers, body);
   return 0;
 }
 
@@ -161,14 +246,7 @@ static int http_lapi_post( lua_State *L )
     body = luaL_checklstring(L, 3, &length);
   }
 
-  if (lua_isfunction(L, 4)) {
-    lua_pushvalue(L, 4);  // copy argument (func) to the top of stack
-    if (http_callback_registry != LUA_NOREF)
-      luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
-  }
-
-  http_post(url, headers, body, http_callback);
+  http_send(L, 4, url, "POST", headers, body);
   return 0;
 }
 
@@ -195,14 +273,7 @@ static int http_lapi_put( lua_State *L )
     body = luaL_checklstring(L, 3, &length);
   }
 
-  if (lua_isfunction(L, 4)) {
-    lua_pushvalue(L, 4);  // copy argument (func) to the top of stack
-    if (http_callback_registry != LUA_NOREF)
-      luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
-  }
-
-  http_put(url, headers, body, http_callback);
+  http_send(L, 4, url, "PUT", headers, body);
   return 0;
 }
 
@@ -229,14 +300,7 @@ static int http_lapi_delete( lua_State *L )
     body = luaL_checklstring(L, 3, &length);
   }
 
-  if (lua_isfunction(L, 4)) {
-    lua_pushvalue(L, 4);  // copy argument (func) to the top of stack
-    if (http_callback_registry != LUA_NOREF)
-      luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
-  }
-
-  http_delete(url, headers, body, http_callback);
+  http_send(L, 4, url, "DELETE", headers, body);
   return 0;
 }
 
@@ -258,17 +322,46 @@ static int http_lapi_get( lua_State *L )
     headers = luaL_checklstring(L, 2, &length);
   }
 
-  if (lua_isfunction(L, 3)) {
-    lua_pushvalue(L, 3);  // copy argument (func) to the top of stack
-    if (http_callback_registry != LUA_NOREF)
-      luaL_unref(L, LUA_REGISTRYINDEX, http_callback_registry);
-    http_callback_registry = luaL_ref(L, LUA_REGISTRYINDEX);
-  }
+  http_send(L, 3, url, "GET", headers, NULL);
+  return 0;
+}
+
+// Lua: http.pool( [size[, idle_timeout_ms]] )
+static int http_lapi_pool( lua_State *L )
+{
+  int size = luaL_optinteger(L, 1, 4);
+  int idle = luaL_optinteger(L, 2, HTTP_POOL_IDLE_TIMEOUT_MS);
 
-  http_get(url, headers, http_callback);
+  luaL_argcheck(L, size >= 0, 1, "invalid size");
+  luaL_argcheck(L, idle > 0, 2, "invalid timeout");
+  http_pool_config(size, idle);
   return 0;
 }
 
+// Lua: http.poolstats( [reset] )
+static int http_lapi_poolstats( lua_State *L )
+{
+  http_pool_stats_t st;
+
+  http_pool_stats(&st, lua_toboolean(L, 1));
+  lua_createtable(L, 0, 6);
+  lua_pushinteger(L, st.hits);
+  lua_setfield(L, -2, "hits");
+  lua_pushinteger(L, st.misses);
+  lua_setfield(L, -2, "misses");
+  lua_pushinteger(L, st.pipelined);
+  lua_setfield(L, -2, "pipelined");
+  lua_pushinteger(L, st.retries);
+  lua_setfield(L, -2, "retries");
+  lua_pushinteger(L, st.handshakes);
+  lua_setfield(L, -2, "handshakes");
+  lua_pushinteger(L, st.handshakes ? st.handshake_us / st.handshakes : 0);
+  lua_setfield(L, -2, "handshake_avg_us");
+  lua_pushinteger(L, st.handshake_max_us);
+  lua_setfield(L, -2, "handshake_max_us");
+  return 1;
+}
+
 // Module function map
 LROT_BEGIN(http, NULL, 0)
   LROT_FUNCENTRY( request, http_lapi_request )
@@ -276,6 +369,8 @@ LROT_BEGIN(http, NULL, 0)
   LROT_FUNCENTRY( put, http_lapi_put )
   LROT_FUNCENTRY( delete, http_lapi_delete )
   LROT_FUNCENTRY( get, http_lapi_get )
+  LROT_FUNCENTRY( pool, http_lapi_pool )
+  LROT_FUNCENTRY( poolstats, http_lapi_poolstats )
 
   LROT_NUMENTRY( OK, 0 )
   LROT_NUMENTRY( ERROR, HTTP_STATUS_GENERIC_ERROR )
@@ -3,6 +3,20 @@
 #include "module.h"
 #include "lauxlib.h"
 #include "platform.h"
+#include <string.h>
+
+// Compiled transaction: the address followed by a segment list, each
+// segment being a flags byte, a 16-bit length and, for writes, the data
+#define I2C_SEG_READ    0x01
+#define I2C_SEG_RESTART 0x02
+#define I2C_SEG_MAXLEN  0xFFFF
+
+typedef struct {
+  uint16_t address;
+  uint16_t nreads;
+  uint32_t len;
+  uint8_t code[1];
+} i2c_transaction_t;
 
 // Lua: speed = i2c.setup( id, sda, scl, speed )
 static int i2c_setup( lua_State *L )
@@ -145,6 +159,209 @@ static int i2c_read( lua_State *L )
   return 1;
 }
 
+// Validates the write data at stack index idx, which may be a number, a
+// string or a table of numbers, returning its length.  If out is given,
+// the data is also copied there.
+static size_t i2c_seg_data( lua_State *L, int idx, uint8_t *out )
+{
+  size_t len, i;
+  int numdata;
+
+  if( lua_type( L, idx ) == LUA_TNUMBER )
+  {
+    numdata = ( int )luaL_checkinteger( L, idx );
+    if( numdata < 0 || numdata > 255 )
+      luaL_error( L, "wrong arg range" );
+    if( out )
+      *out = numdata;
+    return 1;
+  }
+  if( lua_istable( L, idx ) )
+  {
+    len = lua_objlen( L, idx );
+    for( i = 0; i < len; i ++ )
+    {
+      lua_rawgeti( L, idx, i + 1 );
+      numdata = ( int )luaL_checkinteger( L, -1 );
+      lua_pop( L, 1 );
+      if( numdata < 0 || numdata > 255 )
+        luaL_error( L, "wrong arg range" );
+      if( out )
+        out[ i ] = numdata;
+    }
+    return len;
+  }
+  const char *pdata = luaL_checklstring( L, idx, &len );
+  if( out )
+    memcpy( out, pdata, len );
+  return len;
+}
+
+// Compiles the segment list at stack index idx into code, or if code is
+// NULL just returns the length of code needed
+static size_t i2c_compile( lua_State *L, int idx, uint8_t *code, uint16_t *nreads )
+{
+  size_t n = lua_objlen( L, idx ), i, len = 0, dlen;
+
+  luaL_argcheck( L, n > 0, idx, "no segments" );
+  *nreads = 0;
+  for( i = 1; i <= n; i ++ )
+  {
+    uint8_t flags = 0;
+    lua_rawgeti( L, idx, i );
+    if( !lua_istable( L, -1 ) )
+      luaL_error( L, "segment %d is not a table", i );
+    lua_getfield( L, -1, "restart" );
+    if( lua_toboolean( L, -1 ) )
+      flags |= I2C_SEG_RESTART;
+    lua_getfield( L, -2, "read" );
+    lua_getfield( L, -3, "write" );
+    if( lua_isnil( L, -2 ) == lua_isnil( L, -1 ) )
+      luaL_error( L, "segment %d needs one of read or write", i );
+    if( !lua_isnil( L, -2 ) )
+    {
+      if( lua_type( L, -2 ) != LUA_TNUMBER || lua_tointeger( L, -2 ) < 0 )
+        luaL_error( L, "segment %d read length is invalid", i );
+      flags |= I2C_SEG_READ;
+      dlen = lua_tointeger( L, -2 );
+      ( *nreads ) ++;
+    }
+    else
+    {
+      dlen = i2c_seg_data( L, lua_gettop( L ), code ? code + len + 3 : NULL );
+    }
+    if( dlen > I2C_SEG_MAXLEN )
+      luaL_error( L, "segment %d is too long", i );
+    if( code )
+    {
+      code[ len ] = flags;
+      code[ len + 1 ] = dlen & 0xFF;
+      code[ len + 2 ] = dlen >> 8;
+    }
+    len += 3 + ( ( flags & I2C_SEG_READ ) ? 0 : dlen );
+    lua_pop( L, 4 );
+  }
+  return len;
+}
+
+// Lua: trans = i2c.transaction( address, segments )
+static int i2c_transaction( lua_State *L )
+{
+  int address = luaL_checkinteger( L, 1 );
+  uint16_t nreads;
+  size_t len;
+
+  if ( address < 0 || address > 127 )
+    return luaL_error( L, "wrong arg range" );
+  luaL_checktype( L, 2, LUA_TTABLE );
+  len = i2c_compile( L, 2, NULL, &nreads );
+
+  i2c_transaction_t *t = ( i2c_transaction_t * )lua_newuserdata( L, sizeof( *t ) + len );
+  t->address = address;
+  t->len = len;
+  i2c_compile( L, 2, t->code, &t->nreads );
+  luaL_getmetatable( L, "i2c.transaction" );
+  lua_setmetatable( L, -2 );
+  return 1;
+}
+
+// Runs the transaction, pushing a string for each read segment or true if
+// there are none.  If a byte is not acknowledged, the transfer is stopped
+// and nil and the number of the failing segment are returned.
+static int i2c_run( lua_State *L, unsigned id, const i2c_transaction_t *t )
+{
+  const uint8_t *p = t->code, *end = t->code + t->len;
+  int seg = 0, nret = 0, dir = -1;
+  luaL_Buffer b;
+  size_t i, n;
+
+  if( !platform_i2c_configured( id ) )
+    return luaL_error( L, "i2c %d is not configured", id );
+  luaL_checkstack( L, t->nreads + 2, "too many reads" );
+
+  while( p < end )
+  {
+    uint8_t flags = p[ 0 ];
+    int rd = flags & I2C_SEG_READ;
+    n = p[ 1 ] | ( p[ 2 ] << 8 );
+    p += 3;
+    seg ++;
+    // A change of direction needs a (repeated) start and the address
+    if( rd != dir || ( flags & I2C_SEG_RESTART ) )
+    {
+      platform_i2c_send_start( id );
+      if( !platform_i2c_send_address( id, t->address, rd ?
+            PLATFORM_I2C_DIRECTION_RECEIVER : PLATFORM_I2C_DIRECTION_TRANSMITTER ) )
+        goto nack;
+      dir = rd;
+    }
+    if( rd )
+    {
+      // The last byte read before a stop or restart must not be acked
+      int more = p < end && ( p[ 0 ] & I2C_SEG_READ ) && !( p[ 0 ] & I2C_SEG_RESTART );
+      luaL_buffinit( L, &b );
+      for( i = 0; i < n; i ++ )
+        luaL_addchar( &b, ( char )platform_i2c_recv_byte( id, more || i < n - 1 ) );
+      luaL_pushresult( &b );
+      nret ++;
+    }
+    else
+    {
+      for( i = 0; i < n; i ++ )
+        if( !platform_i2c_send_byte( id, p[ i ] ) )
+          goto nack;
+      p += n;
+    }
+  }
+  platform_i2c_send_stop( id );
+  if( nret == 0 )
+  {
+    lua_pushboolean( L, 1 );
+    nret = 1;
+  }
+  return nret;
+
+nack:
+  platform_i2c_send_stop( id );
+  lua_pop( L, nret );
+  lua_pushnil( L );
+  lua_pushinteger( L, seg );
+  return 2;
+}
+
+// Lua: data1, ... = i2c.transfer( id, trans ) or
+//      data1, ... = i2c.transfer( id, address, segments )
+static int i2c_transfer( lua_State *L )
+{
+  unsigned id = luaL_checkinteger( L, 1 );
+
+  MOD_CHECK_ID( i2c, id );
+  if( lua_isuserdata( L, 2 ) )
+    return i2c_run( L, id, ( i2c_transaction_t * )luaL_checkudata( L, 2, "i2c.transaction" ) );
+
+  // compile a one-off transaction
+  lua_settop( L, 3 );
+  lua_pushcfunction( L, i2c_transaction );
+  lua_insert( L, 2 );
+  lua_call( L, 2, 1 );
+  return i2c_run( L, id, ( i2c_transaction_t * )lua_touserdata( L, 2 ) );
+}
+
+// Lua: data1, ... = trans:transfer( id )
+static int i2c_transaction_transfer( lua_State *L )
+{
+  i2c_transaction_t *t = ( i2c_transaction_t * )luaL_checkudata( L, 1, "i2c.transaction" );
+  unsigned id = luaL_checkinteger( L, 2 );
+
+  MOD_CHECK_ID( i2c, id );
+  return i2c_run( L, id, t );
+}
+
+LROT_BEGIN(i2c_trans, NULL, LROT_MASK_INDEX)
+  LROT_TABENTRY( __index, i2c_trans )
+  LROT_FUNCENTRY( transfer, i2c_transaction_transfer )
+LROT_END(i2c_trans, NULL, LROT_MASK_INDEX)
+
 // Module function map
 LROT_BEGIN(i2c, NULL, 0)
   LROT_FUNCENTRY( setup, i2c_setup )
@@ -153,6 +370,8 @@ LROT_BEGIN(i2c, NULL, 0)
   LROT_FUNCENTRY( address, i2c_address )
   LROT_FUNCENTRY( write, i2c_write )
   LROT_FUNCENTRY( read, i2c_read )
+  LROT_FUNCENTRY( transaction, i2c_transaction )
+  LROT_FUNCENTRY( transfer, i2c_transfer )
   LROT_NUMENTRY( FASTPLUS, PLATFORM_I2C_SPEED_FASTPLUS )
   LROT_NUMENTRY( FAST, PLATFORM_I2C_SPEED_FAST )
   LROT_NUMENTRY( SLOW, PLATFORM_I2C_SPEED_SLOW )
@@ -161,4 +380,9 @@ LROT_BEGIN(i2c, NULL, 0)
 LROT_END(i2c, NULL, 0)
 
 
-NODEMCU_MODULE(I2C, "i2c", i2c, NULL);
+int luaopen_i2c( lua_State *L ) {
+  luaL_rometatable( L, "i2c.transaction", LROT_TABLEREF(i2c_trans) );
+  return 0;
+}
+
+NODEMCU_MODULE(I2C, "i2c", i2c, luaopen_i2c);
@@ -14,8 +14,10 @@
 
 #include "mqtt/mqtt_msg.h"
 #include "mqtt/msg_queue.h"
+#include "mqtt/topic_trie.h"
 
 #include "user_interface.h"
+#include "vfs.h"
 
 #define MQTT_BUF_SIZE 1460
 #define MQTT_DEFAULT_KEEPALIVE 60
@@ -23,6 +25,9 @@
 #define MQTT_MAX_USER_LEN     64
 #define MQTT_MAX_PASS_LEN     64
 #define MQTT_SEND_TIMEOUT     5 /* seconds */
+#define MQTT_DEFAULT_INFLIGHT 4    /* QoS 1/2 publishes awaiting acknowledgement */
+#define MQTT_DEFAULT_MAX_QUEUED 32
+#define MQTT_DEFAULT_MAX_QUEUED_BYTES 8192
 
 typedef enum {
   MQTT_INIT,
@@ -51,7 +56,10 @@ typedef enum {
 typedef struct mqtt_state_t
 {
   msg_queue_t* pending_msg_q;
+  msg_queue_t* inflight_msg_q; // sent QoS 1/2 messages awaiting acknowledgement
   uint16_t next_message_id;
+  uint32_t retransmits;
+  uint32_t spool_dropped;
 
   uint8_t * recv_buffer; // heap buffer for multi-packet rx
   uint8_t * recv_buffer_wp; // write pointer in multi-packet rx
@@ -76,6 +84,7 @@ typedef struct lmqtt_userdata
   int cb_suback_ref;
   int cb_unsuback_ref;
   int cb_puback_ref;
+  topic_node_t *topic_handlers;   // per-subscription message callbacks
 
   /* Configuration options */
   struct {
@@ -86,6 +95,9 @@ typedef struct lmqtt_userdata
     int will_message_ref;
     int keepalive;
     uint16_t max_message_length;
+    uint16_t inflight_window;
+    uint16_t max_queued;
+    uint32_t max_queued_bytes;
     struct {
       unsigned will_qos : 2;
       bool will_retain : 1;
@@ -94,6 +106,16 @@ typedef struct lmqtt_userdata
     } flags;
   } conf;
 
+  /* Offline spool of outbound publishes */
+  struct {
+    char *path;               // spool file, NULL if not spooling
+    uint32_t max_bytes;
+    bool replaying;           // a spooled message is in the send queue
+    uint16_t last_len;        // length of the record being replayed
+    uint16_t unsynced;        // deliveries not yet recorded in the file
+    uint32_t consumed;        // and the bytes they hold
+  } spool;
+
   mqtt_state_t  mqtt_state;
   bool connected;     // indicate socket connected, not mqtt prot connected.
   bool keepalive_sent;
@@ -130,6 +152,243 @@ static void mqtt_socket_cb_lua_noarg(lua_State *L, lmqtt_userdata *mud, int cb)
 }
 
 
+/*
+** The offline spool is a file holding a small header followed by a ring of
+** records, each a 16-bit length and a PUBLISH message as framed by
+** mqtt_msg_publish().  Records are appended behind the oldest undelivered
+** one, wrapping at the end of the ring, so space is reused as soon as it has
+** been delivered.  The file is removed once all records are delivered.
+**
+** Each replayed message is only marked as delivered once it is acknowledged
+** (or sent, for QoS 0) so that nothing is lost across a reset.  To save
+** flash wear the header is only rewritten every MQTT_SPOOL_SYNC deliveries,
+** or on the next append, so up to that many may be sent again after a reset.
+*/
+#define MQTT_SPOOL_MAGIC 0x324c5053  /* "SPL2" */
+#define MQTT_DEFAULT_SPOOL_SIZE 16384
+#define MQTT_SPOOL_SYNC 8
+
+typedef struct {
+  uint32_t magic;
+  uint32_t cap;     // size of the ring, fixed when the file is created
+  uint32_t rd;      // ring offset of the next record to replay
+  uint32_t used;    // bytes of undelivered records
+} mqtt_spool_hdr_t;
+
+/* Read or write len bytes at ring offset pos, wrapping at the end */
+static bool mqtt_spool_rw(int fd, const mqtt_spool_hdr_t *hdr, uint32_t pos,
+                          uint8_t *buf, uint32_t len, bool write)
+{
+  while (len) {
+    uint32_t n = hdr->cap - pos;
+    if (n > len)
+      n = len;
+    if (vfs_lseek(fd, sizeof(*hdr) + pos, VFS_SEEK_SET) < 0 ||
+        (write ? vfs_write(fd, buf, n) : vfs_read(fd, buf, n)) != n)
+      return false;
+    buf += n;
+    len -= n;
+    pos = 0;
+  }
+  return true;
+}
+
+/*
+** Open the spool, with any deliveries not yet written to it applied to hdr.
+** If there is no valid spool file then one is only created if create is set.
+*/
+static int mqtt_spool_open(lmqtt_userdata *mud, mqtt_spool_hdr_t *hdr, bool create)
+{
+  int fd = vfs_open(mud->spool.path, "r+");
+  if (fd) {
+    if (vfs_read(fd, hdr, sizeof(*hdr)) == sizeof(*hdr) && hdr->magic == MQTT_SPOOL_MAGIC &&
+        hdr->cap > 0 && hdr->rd < hdr->cap && hdr->used <= hdr->cap &&
+        mud->spool.consumed <= hdr->used) {
+      hdr->rd = (hdr->rd + mud->spool.consumed) % hdr->cap;
+      hdr->used -= mud->spool.consumed;
+      return fd;
+    }
+    vfs_close(fd);    /* not a spool file, so start afresh */
+  }
+  mud->spool.consumed = mud->spool.unsynced = 0;
+  if (!create)
+    return 0;
+  fd = vfs_open(mud->spool.path, "w+");
+  if (fd) {
+    hdr->magic = MQTT_SPOOL_MAGIC;
+    hdr->cap = mud->spool.max_bytes - sizeof(*hdr);
+    hdr->rd = hdr->used = 0;
+    if (vfs_write(fd, hdr, sizeof(*hdr)) != sizeof(*hdr)) {
+      vfs_close(fd);
+      fd = 0;
+    }
+  }
+  return fd;
+}
+
+static bool mqtt_spool_write_hdr(lmqtt_userdata *mud, int fd, const mqtt_spool_hdr_t *hdr)
+{
+  if (vfs_lseek(fd, 0, VFS_SEEK_SET) < 0 ||
+      vfs_write(fd, hdr, sizeof(*hdr)) != sizeof(*hdr))
+    return false;
+  mud->spool.consumed = mud->spool.unsynced = 0;
+  return true;
+}
+
+/* Write any deliveries not yet recorded to the spool, removing it if empty */
+static void mqtt_spool_sync(lmqtt_userdata *mud)
+{
+  mqtt_spool_hdr_t hdr;
+  int fd;
+
+  if (!mud->spool.path || !mud->spool.unsynced || !(fd = mqtt_spool_open(mud, &hdr, false)))
+    return;
+  if (hdr.used == 0 || !mqtt_spool_write_hdr(mud, fd, &hdr)) {
+    vfs_close(fd);
+    vfs_remove(mud->spool.path);
+  } else {
+    vfs_close(fd);
+  }
+  mud->spool.consumed = mud->spool.unsynced = 0;
+}
+
+static bool mqtt_spool_append(lmqtt_userdata *mud, const uint8_t *data, uint16_t len)
+{
+  mqtt_spool_hdr_t hdr;
+  bool ok = false;
+  int fd = mqtt_spool_open(mud, &hdr, true);
+
+  if (fd) {
+    uint32_t wr = (hdr.rd + hdr.used) % hdr.cap;
+    if (hdr.used + sizeof(len) + len <= hdr.cap &&
+        mqtt_spool_rw(fd, &hdr, wr, (uint8_t *) &len, sizeof(len), true) &&
+        mqtt_spool_rw(fd, &hdr, (wr + sizeof(len)) % hdr.cap, (uint8_t *) data, len, true)) {
+      hdr.used += sizeof(len) + len;
+      ok = mqtt_spool_write_hdr(mud, fd, &hdr);
+    }
+    vfs_close(fd);
+  }
+  if (!ok)
+    mud->mqtt_state.spool_dropped++;
+  return ok;
+}
+
+/*
+** Read the oldest undelivered record into buf, returning its length or 0 if
+** the spool is empty.  The spool is removed once it is empty or if it is
+** found to be corrupt.
+*/
+static uint16_t mqtt_spool_read(lmqtt_userdata *mud, uint8_t *buf, uint16_t buflen)
+{
+  mqtt_spool_hdr_t hdr;
+  uint16_t len = 0;
+  int fd;
+
+  if (!mud->spool.path || !(fd = mqtt_spool_open(mud, &hdr, false)))
+    return 0;
+  if (hdr.used >= sizeof(len) &&
+      mqtt_spool_rw(fd, &hdr, hdr.rd, (uint8_t *) &len, sizeof(len), false) &&
+      sizeof(len) + len <= hdr.used && len <= buflen &&
+      mqtt_spool_rw(fd, &hdr, (hdr.rd + sizeof(len)) % hdr.cap, buf, len, false)) {
+    vfs_close(fd);
+    mud->spool.last_len = len;
+    return len;
+  }
+  vfs_close(fd);      /* all delivered, or corrupt, so discard the spool */
+  vfs_remove(mud->spool.path);
+  mud->spool.consumed = mud->spool.unsynced = 0;
+  return 0;
+}
+
+/* Mark the record last read as delivered */
+static void mqtt_spool_consume(lmqtt_userdata *mud)
+{
+  mud->spool.consumed += sizeof(uint16_t) + mud->spool.last_len;
+  if (++mud->spool.unsynced >= MQTT_SPOOL_SYNC)
+    mqtt_spool_sync(mud);
+}
+
+/*
+** Queue the next spooled message, one at a time so that replay is paced by
+** the broker's acknowledgements and stays in order.
+*/
+static void mqtt_spool_replay(lmqtt_userdata *mud)
+{
+  mqtt_message_t msg;
+  uint8_t *buf;
+
+  if (!mud->spool.path || mud->spool.replaying ||
+      !mud->connected || mud->connState != MQTT_DATA)
+    return;
+  /* This can be called from the receive path, so keep it off the stack */
+  if (!(buf = malloc(MQTT_BUF_SIZE)))
+    return;
+  msg.data = buf;
+  msg.length = mqtt_spool_read(mud, buf, MQTT_BUF_SIZE);
+  if (msg.length == 0) {
+    free(buf);
+    return;
+  }
+
+  uint16_t msg_id = 0, topic_len = msg.length;
+  int qos = mqtt_get_qos(buf);
+  const char *topic = mqtt_get_publish_topic(buf, &topic_len);
+  if (!topic || (qos && topic + topic_len + 2 > (char *) buf + msg.length)) {
+    mqtt_spool_consume(mud);                 /* skip a bad record */
+    free(buf);
+    mqtt_spool_replay(mud);                  /* and go on to the next */
+    return;
+  }
+  if (qos) {                                 /* allocate a fresh message id */
+    uint8_t *id = (uint8_t *) topic + topic_len;
+    msg_id = mqtt_next_message_id(mud);
+    id[0] = msg_id >> 8;
+    id[1] = msg_id & 0xff;
+  }
+  msg_queue_t *node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), &msg,
+                                  msg_id, MQTT_MSG_TYPE_PUBLISH, qos);
+  if (node) {
+    node->spooled = true;
+    mud->spool.replaying = true;
+  }
+  free(buf);
+}
+
+/* A message has been delivered; if it came from the spool, replay the next */
+static void mqtt_spool_delivered(lmqtt_userdata *mud, msg_queue_t *node)
+{
+  if (!node->spooled)
+    return;
+  mqtt_spool_consume(mud);
+  mud->spool.replaying = false;
+  mqtt_spool_replay(mud);
+}
+
+/*
+** On losing the connection, move any publishes not yet delivered into the
+** spool.  Those replayed from it are still there so are simply dropped.
+*/
+static void mqtt_spool_queue(lmqtt_userdata *mud, msg_queue_t *node)
+{
+  for (; node; node = node->next) {
+    if (node->msg_type == MQTT_MSG_TYPE_PUBLISH && !node->spooled) {
+      node->msg.data[0] &= ~0x08;            /* clear any DUP flag */
+      mqtt_spool_append(mud, node->msg.data, node->msg.length);
+    }
+  }
+  mud->spool.replaying = false;
+}
+
+static void mqtt_free_queues(lmqtt_userdata *mud)
+{
+  while (mud->mqtt_state.pending_msg_q) {
+    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+  }
+  while (mud->mqtt_state.inflight_msg_q) {
+    msg_destroy(msg_dequeue(&(mud->mqtt_state.inflight_msg_q)));
+  }
+}
+
 static void mqtt_socket_disconnected(void *arg)    // tcp only
 {
   NODE_DBG("enter mqtt_socket_disconnected.\n");
@@ -139,9 +398,11 @@ static void mqtt_socket_disconnected(void *arg)    // tcp only
 
   os_timer_disarm(&mud->mqttTimer);
 
-  while (mud->mqtt_state.pending_msg_q) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+  if (mud->spool.path) {
+    mqtt_spool_queue(mud, mud->mqtt_state.inflight_msg_q);
+    mqtt_spool_queue(mud, mud->mqtt_state.pending_msg_q);
   }
+  mqtt_free_queues(mud);
 
   if(mud->mqtt_state.recv_buffer) {
     free(mud->mqtt_state.recv_buffer);
@@ -200,6 +461,18 @@ static void mqtt_socket_reconnected(void *arg, sint8_t err)
   NODE_DBG("leave mqtt_socket_reconnected.\n");
 }
 
+static void mqtt_push_handler(int ref, void *arg)
+{
+  lua_State *L = (lua_State *) arg;
+  luaL_checkstack(L, 1, "too many topic handlers");
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+}
+
+static void mqtt_unref_handler(int ref, void *arg)
+{
+  luaL_unref((lua_State *) arg, LUA_REGISTRYINDEX, ref);
+}
+
 static void deliver_publish(lmqtt_userdata * mud, uint8_t* message, uint16_t length, uint8_t is_overflow)
 {
   NODE_DBG("enter deliver_publish (len=%d, overflow=%d).\n", length, is_overflow);
@@ -213,27 +486,49 @@ static void deliver_publish(lmqtt_userdata * mud, uint8_t* message, uint16_t len
   event_data.data_length = length;
   event_data.data = mqtt_get_publish_data(message, &event_data.data_length);
 
-  int cb_ref = !is_overflow ? mud->cb_message_ref : mud->cb_overflow_ref;
-
-  if(cb_ref == LUA_NOREF)
-    return;
   if(mud->self_ref == LUA_NOREF)
     return;
-  lua_State *L = lua_getstate();
-  if(event_data.topic && (event_data.topic_length > 0)){
-    lua_rawgeti(L, LUA_REGISTRYINDEX, cb_ref);
-    lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);
-    lua_pushlstring(L, event_data.topic, event_data.topic_length);
-  } else {
+  if(!event_data.topic || (event_data.topic_length == 0)){
     NODE_DBG("get wrong packet.\n");
     return;
   }
+
+  lua_State *L = lua_getstate();
+  int top = lua_gettop(L);
+  int i, j, nargs, nhandlers = 0;
+
+  /*
+   * Push the handlers of all matching subscriptions before calling any, as a
+   * handler is free to (un)subscribe.  Only if none match does the message
+   * fall back to the "message" callback, and if that isn't set either then
+   * the message is dropped without creating any Lua strings.
+   */
+  if (!is_overflow)
+    nhandlers = topic_trie_match(mud->topic_handlers, event_data.topic,
+                                 event_data.topic_length, mqtt_push_handler, L);
+  if (nhandlers == 0) {
+    int cb_ref = !is_overflow ? mud->cb_message_ref : mud->cb_overflow_ref;
+    if(cb_ref == LUA_NOREF)
+      return;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, cb_ref);
+    nhandlers = 1;
+  }
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, mud->self_ref);
+  lua_pushlstring(L, event_data.topic, event_data.topic_length);
   if(event_data.data && (event_data.data_length > 0)){
     lua_pushlstring(L, event_data.data, event_data.data_length);
-    lua_call(L, 3, 0);
+    nargs = 3;
   } else {
-    lua_call(L, 2, 0);
+    nargs = 2;
+  }
+  for (i = 1; i <= nhandlers; i++) {
+    lua_pushvalue(L, top + i);
+    for (j = 1; j <= nargs; j++)
+      lua_pushvalue(L, top + nhandlers + j);
+    lua_call(L, nargs, 0);
   }
+  lua_settop(L, top);
   NODE_DBG("leave deliver_publish.\n");
 }
 
@@ -267,6 +562,11 @@ static sint8 mqtt_send_if_possible(struct lmqtt_userdata *mud)
 
   msg_queue_t *pending_msg = msg_peek(&(mud->mqtt_state.pending_msg_q));
   if (pending_msg && !pending_msg->sent) {
+    if (pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->publish_qos > 0 &&
+        msg_size(&(mud->mqtt_state.inflight_msg_q)) >= mud->conf.inflight_window) {
+      NODE_DBG("send_if_poss, in-flight window full\n");
+      return ESPCONN_OK;
+    }
     pending_msg->sent = 1;
     NODE_DBG("Sent: %d\n", pending_msg->msg.length);
 #ifdef CLIENT_SSL_ENABLE
@@ -289,6 +589,22 @@ static sint8 mqtt_send_if_possible(struct lmqtt_userdata *mud)
   return espconn_status;
 }
 
+/*
+** Remove the message acknowledged by an incoming PUBACK, PUBREC or PUBCOMP.
+** This is normally in the in-flight list, but can still be at the head of the
+** send queue if the ack overtakes the local sent callback.
+*/
+static msg_queue_t *mqtt_take_acked(lmqtt_userdata *mud, uint16_t msg_id, int msg_type)
+{
+  msg_queue_t *node = msg_unlink(&(mud->mqtt_state.inflight_msg_q), msg_id, msg_type);
+  if (!node) {
+    msg_queue_t *head = msg_peek(&(mud->mqtt_state.pending_msg_q));
+    if (head && head->sent && head->msg_type == msg_type && head->msg_id == msg_id)
+      node = msg_dequeue(&(mud->mqtt_state.pending_msg_q));
+  }
+  return node;
+}
+
 static void mqtt_socket_received(void *arg, char *pdata, unsigned short len)
 {
   NODE_DBG("enter mqtt_socket_received (rxlen=%u).\n", len);
@@ -433,6 +749,9 @@ READPACKET:
         NODE_DBG("MQTT: Connected\r\n");
         mud->keepalive_sent = 0;
 
+        // Start the replay first so that publishes made by the connect
+        // callback are spooled behind the older records, not sent ahead
+        mqtt_spool_replay(mud);
         mqtt_socket_cb_lua_noarg(lua_getstate(), mud, mud->cb_connect_ref);
         break;
       }
@@ -525,6 +844,7 @@ READPACKET:
       }
 
       msg_queue_t *pending_msg = msg_peek(&(mud->mqtt_state.pending_msg_q));
+      msg_queue_t *acked;
       NODE_DBG("MQTT_DATA: type: %d, qos: %d, msg_id: %d, pending_id: %d, msg length: %u, buffer length: %u\r\n",
                msg_type,
                msg_qos,
@@ -568,22 +888,25 @@ READPACKET:
           deliver_publish(mud, in_buffer, (uint16_t)message_length, 0);
           break;
         case MQTT_MSG_TYPE_PUBACK:
-          if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->msg_id == msg_id){
+          if((acked = mqtt_take_acked(mud, msg_id, MQTT_MSG_TYPE_PUBLISH)) != NULL){
             NODE_DBG("MQTT: Publish with QoS = 1 successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            mqtt_spool_delivered(mud, acked);
+            msg_destroy(acked);
 
             mqtt_socket_cb_lua_noarg(lua_getstate(), mud, mud->cb_puback_ref);
           }
 
           break;
         case MQTT_MSG_TYPE_PUBREC:
-          if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBLISH && pending_msg->msg_id == msg_id){
+          if((acked = mqtt_take_acked(mud, msg_id, MQTT_MSG_TYPE_PUBLISH)) != NULL){
             NODE_DBG("MQTT: Publish  with QoS = 2 Received PUBREC\r\n");
-            // Note: actually, should not destroy the msg until PUBCOMP is received.
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            // The PUBREL replaces the PUBLISH until PUBCOMP is received.
             temp_msg = mqtt_msg_pubrel(&msgb, msg_id);
-            msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
+            msg_queue_t *node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
                       msg_id, MQTT_MSG_TYPE_PUBREL, (int)mqtt_get_qos(temp_msg->data) );
+            if (node)
+              node->spooled = acked->spooled;
+            msg_destroy(acked);
             NODE_DBG("MQTT: Response PUBREL\r\n");
           }
           break;
@@ -597,9 +920,10 @@ READPACKET:
           }
           break;
         case MQTT_MSG_TYPE_PUBCOMP:
-          if(pending_msg && pending_msg->msg_type == MQTT_MSG_TYPE_PUBREL && pending_msg->msg_id == msg_id){
+          if((acked = mqtt_take_acked(mud, msg_id, MQTT_MSG_TYPE_PUBREL)) != NULL){
             NODE_DBG("MQTT: Publish  with QoS = 2 successful\r\n");
-            msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+            mqtt_spool_delivered(mud, acked);
+            msg_destroy(acked);
 
             mqtt_socket_cb_lua_noarg(lua_getstate(), mud, mud->cb_puback_ref);
           }
@@ -679,17 +1003,25 @@ static void mqtt_socket_sent(void *arg)
   NODE_DBG("sent1, queue size: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)));
 
   msg_queue_t *node = msg_peek(&(mud->mqtt_state.pending_msg_q));
-  if (node) {
+  if (node && node->sent) {
     switch (node->msg_type) {
     case MQTT_MSG_TYPE_PUBLISH:
       // qos = 0, publish and forget.  Run the callback now because we
       // won't get a puback from the server and it's not clear when else
       // we should tell the user the message drained from the egress queue
       if (node->publish_qos == 0) {
-        msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
+        node = msg_dequeue(&(mud->mqtt_state.pending_msg_q));
+        mqtt_spool_delivered(mud, node);
+        msg_destroy(node);
         mqtt_socket_cb_lua_noarg(lua_getstate(), mud, mud->cb_puback_ref);
-        mqtt_send_if_possible(mud);
+        break;
       }
+      /* FALLTHROUGH */
+    case MQTT_MSG_TYPE_PUBREL:
+      // Move it to the in-flight list so the next message can go out
+      // while this one awaits its PUBACK / PUBREC / PUBCOMP.
+      msg_append(&(mud->mqtt_state.inflight_msg_q),
+                 msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
       break;
     case MQTT_MSG_TYPE_PUBACK:
       /* FALLTHROUGH */
@@ -697,14 +1029,14 @@ static void mqtt_socket_sent(void *arg)
       /* FALLTHROUGH */
     case MQTT_MSG_TYPE_PINGREQ:
       msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-      mqtt_send_if_possible(mud);
       break;
     case MQTT_MSG_TYPE_DISCONNECT:
       msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
       mqtt_socket_do_disconnect(mud);
-      break;
+      return;
     }
   }
+  mqtt_send_if_possible(mud);
 
   NODE_DBG("sent2, queue size: %d\n", msg_size(&(mud->mqtt_state.pending_msg_q)));
   NODE_DBG("leave mqtt_socket_sent.\n");
@@ -773,6 +1105,31 @@ static void mqtt_socket_connected(void *arg)
   return;
 }
 
+/*
+** The timer only expires after a full keepalive period without any local send
+** completing, so anything still in flight has gone unacknowledged for at
+** least that long.  Put it back at the front of the send queue, with DUP set
+** on PUBLISHes, to be retransmitted.
+*/
+static bool mqtt_requeue_inflight(lmqtt_userdata *mud)
+{
+  msg_queue_t *node, *tail = NULL;
+
+  for (node = mud->mqtt_state.inflight_msg_q; node; node = node->next) {
+    node->sent = 0;
+    if (node->msg_type == MQTT_MSG_TYPE_PUBLISH)
+      mqtt_set_dup(node->msg.data);
+    mud->mqtt_state.retransmits++;
+    tail = node;
+  }
+  if (!tail)
+    return false;
+  tail->next = mud->mqtt_state.pending_msg_q;
+  mud->mqtt_state.pending_msg_q = mud->mqtt_state.inflight_msg_q;
+  mud->mqtt_state.inflight_msg_q = NULL;
+  return true;
+}
+
 void mqtt_socket_timer(void *arg)
 {
   NODE_DBG("enter mqtt_socket_timer.\n");
@@ -799,7 +1156,10 @@ void mqtt_socket_timer(void *arg)
     mqtt_socket_do_disconnect(mud);
     mqtt_connack_fail(mud, MQTT_CONN_FAIL_TIMEOUT_RECEIVING);
   } else if(mud->connState == MQTT_DATA){
-    if(!msg_peek(&(mud->mqtt_state.pending_msg_q))) {
+    if (!mud->sending && mqtt_requeue_inflight(mud)) {
+      NODE_DBG("MQTT: retransmitting unacknowledged messages\n");
+      mqtt_send_if_possible(mud);
+    } else if(!msg_peek(&(mud->mqtt_state.pending_msg_q))) {
       // no queued event.
       if (mud->keepalive_sent) {
         // Oh dear -- keepalive timer expired and still no ack of previous message
@@ -904,7 +1264,12 @@ static int mqtt_socket_client( lua_State* L )
     mud->conf.max_message_length = DEFAULT_MAX_MESSAGE_LENGTH;
   }
 
+  mud->conf.inflight_window = MQTT_DEFAULT_INFLIGHT;
+  mud->conf.max_queued = MQTT_DEFAULT_MAX_QUEUED;
+  mud->conf.max_queued_bytes = MQTT_DEFAULT_MAX_QUEUED_BYTES;
+
   mud->mqtt_state.pending_msg_q = NULL;
+  mud->mqtt_state.inflight_msg_q = NULL;
   mud->mqtt_state.recv_buffer = NULL;
   mud->mqtt_state.recv_buffer_size = 0;
   mud->mqtt_state.recv_buffer_state = MQTT_RECV_NORMAL;
@@ -930,9 +1295,7 @@ static int mqtt_delete( lua_State* L )
     free(mud->pesp_conn.proto.tcp);
   mud->pesp_conn.proto.tcp = NULL;
 
-  while(mud->mqtt_state.pending_msg_q) {
-    msg_destroy(msg_dequeue(&(mud->mqtt_state.pending_msg_q)));
-  }
+  mqtt_free_queues(mud);
 
   //--------- alloc-ed in mqtt_socket_received()
   if(mud->mqtt_state.recv_buffer) {
@@ -941,6 +1304,14 @@ static int mqtt_delete( lua_State* L )
   }
   // ----
 
+  // ---- alloc-ed in mqtt_socket_subscribe()
+  topic_trie_free(&mud->topic_handlers, mqtt_unref_handler, L);
+
+  // ---- alloc-ed in mqtt_socket_spool()
+  mqtt_spool_sync(mud);
+  free(mud->spool.path);
+  mud->spool.path = NULL;
+
   // free (unref) callback ref
   luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_connect_ref);
   mud->cb_connect_ref = LUA_NOREF;
@@ -1238,6 +1609,27 @@ static int mqtt_socket_on( lua_State* L )
   return 0;
 }
 
+/*
+** Register the function at idx as the message handler for a topic filter,
+** replacing any previous handler for the same filter.
+*/
+static void mqtt_set_handler(lua_State *L, lmqtt_userdata *mud, const char *topic, size_t len, int idx)
+{
+  int old_ref = LUA_NOREF;
+  lua_pushvalue(L, idx);
+  int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  if (topic_trie_insert(&mud->topic_handlers, topic, len, ref, &old_ref) != 0) {
+    luaL_unref(L, LUA_REGISTRYINDEX, ref);
+    luaL_error(L, "invalid topic filter or out of memory");
+  }
+  luaL_unref(L, LUA_REGISTRYINDEX, old_ref);
+}
+
+static void mqtt_clear_handler(lua_State *L, lmqtt_userdata *mud, const char *topic, size_t len)
+{
+  luaL_unref(L, LUA_REGISTRYINDEX, topic_trie_remove(&mud->topic_handlers, topic, len));
+}
+
 // Lua: bool = mqtt:unsubscribe(topic, function())
 static int mqtt_socket_unsubscribe( lua_State* L ) {
   NODE_DBG("enter mqtt_socket_unsubscribe.\n");
@@ -1270,7 +1662,8 @@ static int mqtt_socket_unsubscribe( lua_State* L ) {
     uint8_t overflow = 0;
 
     while( lua_next( L, stack ) != 0 ) {
-      topic = luaL_checkstring( L, -2 );
+      topic = luaL_checklstring( L, -2, &il );
+      mqtt_clear_handler(L, mud, topic, il);
 
       if (topic_count == 0) {
         msg_id = mqtt_next_message_id(mud);
@@ -1310,6 +1703,7 @@ static int mqtt_socket_unsubscribe( lua_State* L ) {
     if( topic == NULL ){
       return luaL_error( L, "need topic name" );
     }
+    mqtt_clear_handler(L, mud, topic, il);
     msg_id = mqtt_next_message_id(mud);
     temp_msg = mqtt_msg_unsubscribe( &msgb, topic, msg_id );
   }
@@ -1340,7 +1734,7 @@ static int mqtt_socket_unsubscribe( lua_State* L ) {
   return 1;
 }
 
-// Lua: bool = mqtt:subscribe(topic, qos, function())
+// Lua: bool = mqtt:subscribe(topic, qos, function(), function(client, topic, message))
 static int mqtt_socket_subscribe( lua_State* L ) {
   NODE_DBG("enter mqtt_socket_subscribe.\n");
 
@@ -1372,8 +1766,17 @@ static int mqtt_socket_subscribe( lua_State* L ) {
     uint8_t overflow = 0;
 
     while( lua_next( L, stack ) != 0 ) {
-      topic = luaL_checkstring( L, -2 );
-      qos = luaL_checkinteger( L, -1 );
+      topic = luaL_checklstring( L, -2, &il );
+      if (lua_istable( L, -1 )) {   // {qos, handler}
+        lua_rawgeti( L, -1, 1 );
+        qos = luaL_checkinteger( L, -1 );
+        lua_rawgeti( L, -2, 2 );
+        if (lua_isfunction( L, -1 ))
+          mqtt_set_handler(L, mud, topic, il, -1);
+        lua_pop( L, 2 );
+      } else {
+        qos = luaL_checkinteger( L, -1 );
+      }
 
       if (topic_count == 0) {
         msg_id = mqtt_next_message_id(mud);
@@ -1414,6 +1817,8 @@ static int mqtt_socket_subscribe( lua_State* L ) {
       return luaL_error( L, "need topic name" );
     }
     qos = luaL_checkinteger( L, stack );
+    if (lua_isfunction(L, stack + 2))
+      mqtt_set_handler(L, mud, topic, il, stack + 2);
     msg_id = mqtt_next_message_id(mud);
     temp_msg = mqtt_msg_subscribe( &msgb, topic, qos, msg_id );
     stack++;
@@ -1457,7 +1862,10 @@ static int mqtt_socket_publish( lua_State* L )
   mud = (lmqtt_userdata *)luaL_checkudata(L, stack, "mqtt.socket");
   stack++;
 
-  if(!mud->connected){
+  // Publishes are spooled while offline, and also while the spool drains
+  bool spool = mud->spool.path &&
+               (!mud->connected || mud->connState != MQTT_DATA || mud->spool.replaying);
+  if(!mud->connected && !spool){
     return luaL_error( L, "not connected" );
   }
 
@@ -1474,7 +1882,7 @@ static int mqtt_socket_publish( lua_State* L )
   uint8_t retain = luaL_checkinteger( L, stack);
   stack ++;
 
-  if (qos != 0) {
+  if (qos != 0 && !spool) {
     msg_id = mqtt_next_message_id(mud);
   }
 
@@ -1486,12 +1894,28 @@ static int mqtt_socket_publish( lua_State* L )
                        qos, retain,
                        msg_id);
 
+  // Refuse to queue more than the configured limits to protect the heap
+  if (!spool && ((mud->conf.max_queued &&
+       msg_size(&(mud->mqtt_state.pending_msg_q)) >= mud->conf.max_queued) ||
+      (mud->conf.max_queued_bytes &&
+       msg_bytes(&(mud->mqtt_state.pending_msg_q)) + temp_msg->length > mud->conf.max_queued_bytes))) {
+    NODE_DBG("publish, queue limit reached\n");
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+
   if (lua_isfunction(L, stack)){
     lua_pushvalue(L, stack);  // copy argument (func) to the top of stack
     luaL_unref(L, LUA_REGISTRYINDEX, mud->cb_puback_ref);
     mud->cb_puback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   }
 
+  if (spool) {
+    lua_pushboolean(L, temp_msg->length > 0 &&
+                       mqtt_spool_append(mud, temp_msg->data, temp_msg->length));
+    return 1;
+  }
+
   msg_queue_t *node = msg_enqueue(&(mud->mqtt_state.pending_msg_q), temp_msg,
                       msg_id, MQTT_MSG_TYPE_PUBLISH, (int)qos );
 
@@ -1510,6 +1934,66 @@ static int mqtt_socket_publish( lua_State* L )
   return 1;
 }
 
+// Lua: mqtt:inflight( window[, max_queued[, max_queued_bytes]] )
+static int mqtt_socket_inflight( lua_State* L )
+{
+  lmqtt_userdata *mud = luaL_checkudata( L, 1, "mqtt.socket" );
+  int window = luaL_checkinteger( L, 2 );
+  luaL_argcheck( L, window >= 1 && window <= 0xFFFF, 2, "out of range" );
+  mud->conf.inflight_window = window;
+  if ( lua_isnumber(L, 3) )
+    mud->conf.max_queued = luaL_checkinteger( L, 3 ) & 0xFFFF;
+  if ( lua_isnumber(L, 4) )
+    mud->conf.max_queued_bytes = luaL_checkinteger( L, 4 );
+  mqtt_send_if_possible(mud);
+  return 0;
+}
+
+// Lua: stats = mqtt:stats()
+static int mqtt_socket_stats( lua_State* L )
+{
+  lmqtt_userdata *mud = luaL_checkudata( L, 1, "mqtt.socket" );
+  lua_createtable( L, 0, 4 );
+  lua_pushinteger( L, msg_size(&(mud->mqtt_state.inflight_msg_q)) );
+  lua_setfield( L, -2, "inflight" );
+  lua_pushinteger( L, msg_size(&(mud->mqtt_state.pending_msg_q)) );
+  lua_setfield( L, -2, "queued" );
+  lua_pushinteger( L, msg_bytes(&(mud->mqtt_state.pending_msg_q)) );
+  lua_setfield( L, -2, "queued_bytes" );
+  lua_pushinteger( L, mud->mqtt_state.retransmits );
+  lua_setfield( L, -2, "retransmitted" );
+  lua_pushinteger( L, mud->mqtt_state.spool_dropped );
+  lua_setfield( L, -2, "spool_dropped" );
+  return 1;
+}
+
+// Lua: mqtt:spool( path[, max_bytes] ) or mqtt:spool( nil )
+static int mqtt_socket_spool( lua_State* L )
+{
+  lmqtt_userdata *mud = luaL_checkudata( L, 1, "mqtt.socket" );
+  size_t l;
+  const char *path = lua_isnil( L, 2 ) ? NULL : luaL_checklstring( L, 2, &l );
+  uint32_t max_bytes = luaL_optinteger( L, 3, MQTT_DEFAULT_SPOOL_SIZE );
+
+  luaL_argcheck( L, !path || l < FS_OBJ_NAME_LEN, 2, "filename too long" );
+  luaL_argcheck( L, max_bytes > sizeof(mqtt_spool_hdr_t), 3, "out of range" );
+  if (mud->spool.replaying)
+    return luaL_error( L, "spool is being replayed" );
+
+  mqtt_spool_sync(mud);
+  free(mud->spool.path);
+  mud->spool.path = NULL;
+  if (path) {
+    if (!(mud->spool.path = malloc(l + 1)))
+      return luaL_error( L, "not enough memory" );
+    memcpy(mud->spool.path, path, l + 1);
+    mud->spool.max_bytes = max_bytes;
+    mqtt_spool_replay(mud);
+    mqtt_send_if_possible(mud);
+  }
+  return 0;
+}
+
 // Lua: mqtt:lwt( topic, message, [qos, [retain]])
 static int mqtt_socket_lwt( lua_State* L )
 {
@@ -1552,6 +2036,9 @@ LROT_BEGIN(mqtt_socket, NULL, LROT_MASK_GC_INDEX)
   LROT_FUNCENTRY( subscribe, mqtt_socket_subscribe )
   LROT_FUNCENTRY( unsubscribe, mqtt_socket_unsubscribe )
   LROT_FUNCENTRY( lwt, mqtt_socket_lwt )
+  LROT_FUNCENTRY( inflight, mqtt_socket_inflight )
+  LROT_FUNCENTRY( stats, mqtt_socket_stats )
+  LROT_FUNCENTRY( spool, mqtt_socket_spool )
   LROT_FUNCENTRY( on, mqtt_socket_on )
 LROT_END(mqtt_socket, NULL, LROT_MASK_GC_INDEX)
 
@@ -4,6 +4,7 @@
 #include "lauxlib.h"
 #include "platform.h"
 #include "lmem.h"
+#include "vfs.h"
 
 #include <string.h>
 #include <strings.h>
@@ -38,13 +39,23 @@ static const net_table_name NET_TABLES[] = {
 #define NET_TABLE_TCP_SERVER NET_TABLES[0]
 #define NET_TABLE_TCP_CLIENT NET_TABLES[1]
 #define NET_TABLE_UDP_SOCKET NET_TABLES[2]
+#define NET_TABLE_RXBUF      "net.rxbuf"
+#define NET_TABLE_SENDFILE   "net.sendfile"
 
 #define TYPE_TCP TYPE_TCP_CLIENT
 #define TYPE_UDP TYPE_UDP_SOCKET
 
+// Receive mode options, set at creation and inherited by accepted sockets
+typedef struct lnet_rxmode {
+  uint8_t  buffered;      // deliver net.rxbuf objects rather than strings
+  int16_t  delim;         // deliver when this byte arrives, or -1
+  uint16_t threshold;     // deliver once this many bytes are pending, or 0
+} lnet_rxmode;
+
 typedef struct lnet_userdata {
   enum net_type type;
   int self_ref;
+  lnet_rxmode rx;
   union {
     struct tcp_pcb *tcp_pcb;
     struct udp_pcb *udp_pcb;
@@ -65,6 +76,13 @@ typedef struct lnet_userdata {
       int cb_connect_ref;
       int cb_disconnect_ref;
       int cb_reconnect_ref;
+      struct pbuf *rx_chain;   // pending data in buffered receive mode
+      // Outbound send queue: sendq_ref is a table of items at [sq_head, sq_tail)
+      int sendq_ref;
+      uint16_t sq_head;
+      uint16_t sq_tail;
+      uint32_t sq_offset;      // bytes already written from the head string
+      uint32_t sq_bytes;       // bytes of queued strings not yet written
     } client;
   };
 } lnet_userdata;
@@ -105,6 +123,9 @@ lnet_userdata *net_create( lua_State *L, enum net_type type ) {
   ud->type = type;
   ud->self_ref = LUA_NOREF;
   ud->pcb = NULL;
+  ud->rx.buffered = 0;
+  ud->rx.delim = -1;
+  ud->rx.threshold = 0;
 
   switch (type) {
     case TYPE_TCP_CLIENT:
@@ -112,6 +133,10 @@ lnet_userdata *net_create( lua_State *L, enum net_type type ) {
       ud->client.cb_reconnect_ref = LUA_NOREF;
       ud->client.cb_disconnect_ref = LUA_NOREF;
       ud->client.hold = 0;
+      ud->client.rx_chain = NULL;
+      ud->client.sendq_ref = LUA_NOREF;
+      ud->client.sq_head = ud->client.sq_tail = 0;
+      ud->client.sq_offset = ud->client.sq_bytes = 0;
       /* FALLTHROUGH */
     case TYPE_UDP_SOCKET:
       ud->client.wait_dns = 0;
@@ -128,11 +153,14 @@ lnet_userdata *net_create( lua_State *L, enum net_type type ) {
 
 #pragma mark - LWIP callbacks
 
+static void net_sendq_free(lua_State *L, lnet_userdata *ud);
+
 static void net_err_cb(void *arg, err_t err) {
   lnet_userdata *ud = (lnet_userdata*)arg;
   if (!ud || ud->type != TYPE_TCP_CLIENT || ud->self_ref == LUA_NOREF) return;
   ud->pcb = NULL; // Will be freed at LWIP level
   lua_State *L = lua_getstate();
+  net_sendq_free(L, ud);
   int ref;
   if (err != ERR_OK && ud->client.cb_reconnect_ref != LUA_NOREF)
     ref = ud->client.cb_reconnect_ref;
@@ -227,6 +255,98 @@ static void net_recv_cb(lnet_userdata *ud, struct pbuf *p, ip_addr_t *addr, u16_
   pbuf_free(p);
 }
 
+#pragma mark - Buffered receive
+
+/*
+ * In buffered receive mode the pbuf chain is handed to Lua wrapped in a
+ * net.rxbuf userdata, rather than being copied into one string per segment.
+ * A buffer is a view (offset, len) onto a referenced pbuf chain, so slicing is
+ * copy-free.  The buffer handed to the receive callback also carries the TCP
+ * window credit for its bytes: tcp_recved() is only called when it is released
+ * or collected, so the TCP window provides back-pressure to the sender.
+ */
+typedef struct lnet_rxbuf {
+  struct pbuf *p;
+  uint16_t offset;
+  uint16_t len;
+  uint16_t credit;
+  int sock_ref;
+} lnet_rxbuf;
+
+static lnet_rxbuf *net_rxbuf_new(lua_State *L, struct pbuf *p, uint16_t offset, uint16_t len) {
+  lnet_rxbuf *b = (lnet_rxbuf *)lua_newuserdata(L, sizeof(lnet_rxbuf));
+  b->p = p;
+  b->offset = offset;
+  b->len = len;
+  b->credit = 0;
+  b->sock_ref = LUA_NOREF;
+  luaL_getmetatable(L, NET_TABLE_RXBUF);
+  lua_setmetatable(L, -2);
+  return b;
+}
+
+static void net_rxbuf_deliver(lnet_userdata *ud) {
+  struct pbuf *p = ud->client.rx_chain;
+  lua_State *L = lua_getstate();
+  ud->client.rx_chain = NULL;
+  if (!p) return;
+  if (ud->client.cb_receive_ref == LUA_NOREF) {
+    if (ud->tcp_pcb) tcp_recved(ud->tcp_pcb, p->tot_len);
+    pbuf_free(p);
+    return;
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.cb_receive_ref);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
+  lnet_rxbuf *b = net_rxbuf_new(L, p, 0, p->tot_len);
+  b->credit = p->tot_len;
+  lua_pushvalue(L, -2);
+  b->sock_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_call(L, 2, 0);
+}
+
+static void net_rxbuf_recv(lnet_userdata *ud, struct pbuf *p) {
+  uint16_t limit = ud->rx.threshold;
+  uint16_t wnd = TCP_WND;
+  int deliver;
+
+  if (ud->client.rx_chain)
+    pbuf_cat(ud->client.rx_chain, p);
+  else
+    ud->client.rx_chain = p;
+  /*
+   * The window isn't reopened until delivery, so always deliver once there
+   * isn't room left in it for another full segment.
+   */
+  if (limit == 0 && ud->rx.delim < 0)
+    limit = 1;
+  deliver = ud->client.rx_chain->tot_len >= limit ||
+            ud->client.rx_chain->tot_len + TCP_MSS > wnd;
+  if (!deliver && ud->rx.delim >= 0) {
+    char c = (char) ud->rx.delim;
+    deliver = pbuf_memfind(p, &c, 1, 0) != 0xFFFF;
+  }
+  if (deliver)
+    net_rxbuf_deliver(ud);
+}
+
+static void net_rxbuf_release(lua_State *L, lnet_rxbuf *b) {
+  if (b->p) {
+    pbuf_free(b->p);
+    b->p = NULL;
+    b->len = 0;
+  }
+  if (b->sock_ref != LUA_NOREF) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, b->sock_ref);
+    lnet_userdata *ud = (lnet_userdata *)lua_touserdata(L, -1);
+    if (ud && ud->type == TYPE_TCP_CLIENT && ud->tcp_pcb && b->credit)
+      tcp_recved(ud->tcp_pcb, b->credit);
+    lua_pop(L, 1);
+    luaL_unref(L, LUA_REGISTRYINDEX, b->sock_ref);
+    b->sock_ref = LUA_NOREF;
+  }
+  b->credit = 0;
+}
+
 static void net_udp_recv_cb(void *arg, struct udp_pcb *pcb, struct pbuf *p, ip_addr_t *addr, u16_t port) {
   lnet_userdata *ud = (lnet_userdata*)arg;
   if (!ud || !ud->pcb || ud->type != TYPE_UDP_SOCKET || ud->self_ref == LUA_NOREF) {
@@ -241,19 +361,222 @@ static err_t net_tcp_recv_cb(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, er
   if (!ud || !ud->pcb || ud->type != TYPE_TCP_CLIENT || ud->self_ref == LUA_NOREF)
     return ERR_ABRT;
   if (!p) {
+    if (ud->rx.buffered)
+      net_rxbuf_deliver(ud);
     net_err_cb(arg, err);
     return tcp_close(tpcb);
   }
+  if (ud->rx.buffered) {
+    net_rxbuf_recv(ud, p);
+    return ERR_OK;
+  }
   net_recv_cb(ud, p, 0, 0);
   tcp_recved(tpcb, ud->client.hold ? 0 : TCP_WND);
   return ERR_OK;
 }
 
+#pragma mark - Send queue
+
+/*
+ * A TCP socket can queue strings, pipes and open file objects for sending.
+ * The queue is drained into tcp_write() whenever there is send buffer space:
+ * once when items are queued and then from net_sent_cb() as data is acked, so
+ * large payloads are streamed out without a Lua round trip per segment.  Pipes
+ * are drained until empty and files are read until EOF.  The queued items are
+ * held in a Lua table so that they can't be collected while pending.
+ */
+extern int pipe_read(lua_State *L);
+extern int pipe_unread(lua_State *L);
+LROT_TABLE(pipe_meta);
+
+typedef struct {  /* Must match the file module's file.obj layout */
+  int fd;
+} net_file_ud;
+
+/*
+ * A sendfile item streams a byte range of a file straight from the VFS into
+ * the TCP send buffer.  If it was given a path, then it owns the fd and closes
+ * it once the range has been sent; if given a file object then it holds a ref
+ * to stop that being collected (and closed) under it.
+ */
+typedef struct lnet_sendfile {
+  int fd;
+  int file_ref;
+  uint32_t offset;
+  uint32_t remaining;
+  uint8_t started;
+} lnet_sendfile;
+
+static lnet_sendfile *net_sendfile_test(lua_State *L, int ndx) {
+  lnet_sendfile *sf = NULL;
+  if (lua_getmetatable(L, ndx)) {
+    luaL_getmetatable(L, NET_TABLE_SENDFILE);
+    if (lua_rawequal(L, -1, -2))
+      sf = (lnet_sendfile *)lua_touserdata(L, ndx);
+    lua_pop(L, 2);
+  }
+  return sf;
+}
+
+static void net_sendfile_close(lua_State *L, lnet_sendfile *sf) {
+  if (sf->fd && sf->file_ref == LUA_NOREF)
+    vfs_close(sf->fd);
+  luaL_unref(L, LUA_REGISTRYINDEX, sf->file_ref);
+  sf->file_ref = LUA_NOREF;
+  sf->fd = 0;
+  sf->remaining = 0;
+}
+
+#define net_sendq_empty(ud) ((ud)->client.sq_head == (ud)->client.sq_tail)
+
+static void net_sendq_pop(lua_State *L, lnet_userdata *ud, int tbl) {
+  lua_pushnil(L);
+  lua_rawseti(L, tbl, ud->client.sq_head++);
+  ud->client.sq_offset = 0;
+  if (net_sendq_empty(ud))
+    ud->client.sq_head = ud->client.sq_tail = 0;
+}
+
+static void net_sendq_pump(lua_State *L, lnet_userdata *ud) {
+  char *scratch = NULL;
+  int blocked = 0, top = lua_gettop(L), tbl = top + 1;
+
+  if (ud->client.sendq_ref == LUA_NOREF || !ud->tcp_pcb)
+    return;
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.sendq_ref);
+
+  while (!blocked && !net_sendq_empty(ud)) {
+    struct tcp_pcb *pcb = ud->tcp_pcb;
+    size_t room = tcp_sndbuf(pcb), len;
+    u8_t flags = TCP_WRITE_FLAG_COPY;
+    const char *data;
+    int done = 0;
+
+    if (room == 0)
+      break;
+    if (ud->client.sq_tail - ud->client.sq_head > 1)
+      flags |= TCP_WRITE_FLAG_MORE;
+    lua_rawgeti(L, tbl, ud->client.sq_head);
+
+    switch (lua_type(L, -1)) {
+      case LUA_TSTRING:
+        data = lua_tolstring(L, -1, &len) + ud->client.sq_offset;
+        len -= ud->client.sq_offset;
+        if (len > room) {
+          len = room;
+          flags |= TCP_WRITE_FLAG_MORE;
+        }
+        if (tcp_write(pcb, data, len, flags) != ERR_OK) {
+          blocked = 1;
+        } else {
+          ud->client.sq_offset += len;
+          ud->client.sq_bytes  -= len;
+          done = lua_objlen(L, -1) == ud->client.sq_offset;
+        }
+        break;
+
+      case LUA_TTABLE:  /* a pipe */
+        lua_pushcfunction(L, pipe_read);
+        lua_pushvalue(L, -2);
+        lua_pushinteger(L, room);
+        lua_call(L, 2, 1);
+        if (lua_isnil(L, -1)) {
+          done = 1;
+        } else {
+          data = lua_tolstring(L, -1, &len);
+          if (tcp_write(pcb, data, len, flags | TCP_WRITE_FLAG_MORE) != ERR_OK) {
+            lua_pushcfunction(L, pipe_unread);  /* put it back for next time */
+            lua_pushvalue(L, -3);
+            lua_pushvalue(L, -3);
+            lua_call(L, 2, 0);
+            blocked = 1;
+          }
+        }
+        break;
+
+      case LUA_TUSERDATA: { /* a file object or a sendfile range */
+        lnet_sendfile *sf = net_sendfile_test(L, -1);
+        size_t want = room < TCP_MSS ? room : TCP_MSS;
+        int32_t n = 0;
+        int fd;
+        if (sf) {
+          if (!sf->started) {
+            vfs_lseek(sf->fd, sf->offset, VFS_SEEK_SET);
+            sf->started = 1;
+          }
+          fd = sf->fd;
+          if (want > sf->remaining)
+            want = sf->remaining;
+        } else {
+          fd = ((net_file_ud *)lua_touserdata(L, -1))->fd;
+        }
+        if (!scratch && !(scratch = malloc(TCP_MSS))) {
+          blocked = 1;
+          break;
+        }
+        if (want)
+          n = vfs_read(fd, scratch, want);
+        if (n <= 0) {
+          done = 1;
+          if (sf) {
+            ud->client.sq_bytes -= sf->remaining;
+            net_sendfile_close(L, sf);
+          }
+        } else if (tcp_write(pcb, scratch, n, flags | TCP_WRITE_FLAG_MORE) != ERR_OK) {
+          vfs_lseek(fd, -n, VFS_SEEK_CUR);
+          blocked = 1;
+        } else if (sf) {
+          sf->remaining -= n;
+          ud->client.sq_bytes -= n;
+        }
+        break;
+      }
+
+      default:
+        done = 1;
+        break;
+    }
+    lua_settop(L, tbl);
+    if (done)
+      net_sendq_pop(L, ud, tbl);
+  }
+  free(scratch);
+  lua_settop(L, top);
+  tcp_output(ud->tcp_pcb);
+}
+
+// Append the value at the top of the stack to the send queue, and pop it
+static void net_sendq_append(lua_State *L, lnet_userdata *ud) {
+  if (ud->client.sendq_ref == LUA_NOREF) {
+    lua_newtable(L);
+    ud->client.sendq_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    ud->client.sq_head = ud->client.sq_tail = 0;
+  }
+  lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.sendq_ref);
+  lua_insert(L, -2);
+  lua_rawseti(L, -2, ud->client.sq_tail++);
+  lua_pop(L, 1);
+}
+
+static void net_sendq_free(lua_State *L, lnet_userdata *ud) {
+  luaL_unref(L, LUA_REGISTRYINDEX, ud->client.sendq_ref);
+  ud->client.sendq_ref = LUA_NOREF;
+  ud->client.sq_head = ud->client.sq_tail = 0;
+  ud->client.sq_offset = ud->client.sq_bytes = 0;
+}
+
 static err_t net_sent_cb(void *arg, struct tcp_pcb *tpcb, u16_t len) {
   lnet_userdata *ud = (lnet_userdata*)arg;
   if (!ud || !ud->pcb || ud->type != TYPE_TCP_CLIENT || ud->self_ref == LUA_NOREF) return ERR_ABRT;
-  if (ud->client.cb_sent_ref == LUA_NOREF) return ERR_OK;
   lua_State *L = lua_getstate();
+  if (ud->client.sendq_ref != LUA_NOREF) {
+    net_sendq_pump(L, ud);
+    /* Only signal "sent" once the queue has been fully drained and acked */
+    if (!net_sendq_empty(ud) || tpcb->unacked || tpcb->unsent)
+      return ERR_OK;
+    net_sendq_free(L, ud);
+  }
+  if (ud->client.cb_sent_ref == LUA_NOREF) return ERR_OK;
   lua_rawgeti(L, LUA_REGISTRYINDEX, ud->client.cb_sent_ref);
   lua_rawgeti(L, LUA_REGISTRYINDEX, ud->self_ref);
   lua_call(L, 1, 0);
@@ -269,6 +592,7 @@ static err_t net_accept_cb(void *arg, struct tcp_pcb *newpcb, err_t err) {
   lua_rawgeti(L, LUA_REGISTRYINDEX, ud->server.cb_accept_ref);
 
   lnet_userdata *nud = net_create(L, TYPE_TCP_CLIENT);
+  nud->rx = ud->rx;
   lua_pushvalue(L, 2);
   nud->self_ref = luaL_ref(L, LUA_REGISTRYINDEX);
   nud->tcp_pcb = newpcb;
@@ -288,27 +612,49 @@ static err_t net_accept_cb(void *arg, struct tcp_pcb *newpcb, err_t err) {
 
 #pragma mark - Lua API - create
 
+// Parse the optional { rxbuf = bool, threshold = n, delimiter = c } table
+static void net_rxmode_opts( lua_State *L, lnet_rxmode *rx ) {
+  int i, top = lua_gettop(L) - 1;   // the new userdata is at the top
+  for (i = 1; i <= top && !lua_istable(L, i); i++) {}
+  if (i > top) return;
+  lua_getfield(L, i, "rxbuf");
+  rx->buffered = lua_toboolean(L, -1);
+  lua_getfield(L, i, "threshold");
+  rx->threshold = luaL_optinteger(L, -1, 0);
+  lua_getfield(L, i, "delimiter");
+  if (lua_isstring(L, -1)) {
+    size_t l;
+    const char *d = lua_tolstring(L, -1, &l);
+    luaL_argcheck(L, l == 1, i, "delimiter must be a single character");
+    rx->delim = (uint8_t) d[0];
+  }
+  lua_pop(L, 3);
+}
+
 // Lua: net.createUDPSocket()
 int net_createUDPSocket( lua_State *L ) {
   net_create(L, TYPE_UDP_SOCKET);
   return 1;
 }
 
-// Lua: net.createServer(type, timeout)
+// Lua: net.createServer(timeout[, opts])
 int net_createServer( lua_State *L ) {
   int type, timeout;
 
-  timeout = luaL_optlong(L, 1, 30);
+  // the timeout may be omitted before the options table
+  timeout = lua_istable(L, 1) ? 30 : luaL_optinteger(L, 1, 30);
 
   lnet_userdata *u = net_create(L, TYPE_TCP_SERVER);
   u->server.timeout = timeout;
+  net_rxmode_opts(L, &u->rx);
   return 1;
 }
 
-// Lua: net.createConnection(type, secure)
+// Lua: net.createConnection(type, secure), net.createConnection(opts)
 int net_createConnection( lua_State *L ) {
 
-  net_create(L, TYPE_TCP_CLIENT);
+  lnet_userdata *u = net_create(L, TYPE_TCP_CLIENT);
+  net_rxmode_opts(L, &u->rx);
   return 1;
 }
 
@@ -564,6 +910,109 @@ int net_send( lua_State *L ) {
   return lwip_lua_checkerr(L, err);
 }
 
+// Lua: client:queue(item[, item ...]) -- items are strings, pipes or file objects
+int net_queue( lua_State *L ) {
+  lnet_userdata *ud = net_get_udata(L);
+  int i, n = lua_gettop(L);
+  if (!ud || ud->type != TYPE_TCP_CLIENT)
+    return luaL_error(L, "invalid user data");
+  if (!ud->pcb || ud->self_ref == LUA_NOREF)
+    return luaL_error(L, "not connected");
+
+  for (i = 2; i <= n; i++) {
+    int ok = 0;
+    switch (lua_type(L, i)) {
+      case LUA_TSTRING:
+        ok = 1;
+        break;
+      case LUA_TTABLE:
+      case LUA_TUSERDATA:
+        if (lua_getmetatable(L, i)) {
+          if (lua_istable(L, i))
+            lua_pushrotable(L, LROT_TABLEREF(pipe_meta));
+          else
+            luaL_getmetatable(L, "file.obj");
+          ok = lua_rawequal(L, -1, -2);
+          lua_pop(L, 2);
+        }
+        break;
+    }
+    luaL_argcheck(L, ok, i, "string, pipe or file object expected");
+  }
+
+  for (i = 2; i <= n; i++) {
+    if (lua_type(L, i) == LUA_TSTRING)
+      ud->client.sq_bytes += lua_objlen(L, i);
+    lua_pushvalue(L, i);
+    net_sendq_append(L, ud);
+  }
+  net_sendq_pump(L, ud);
+  return 0;
+}
+
+// Lua: client:sendfile(path_or_file[, offset[, len]])
+int net_sendfile( lua_State *L ) {
+  lnet_userdata *ud = net_get_udata(L);
+  lnet_sendfile *sf;
+  uint32_t size;
+  int fd, file_ref = LUA_NOREF;
+  if (!ud || ud->type != TYPE_TCP_CLIENT)
+    return luaL_error(L, "invalid user data");
+  if (!ud->pcb || ud->self_ref == LUA_NOREF)
+    return luaL_error(L, "not connected");
+  lua_Integer offset = luaL_optinteger(L, 3, 0);
+  lua_Integer len    = luaL_optinteger(L, 4, -1);
+  luaL_argcheck(L, offset >= 0, 3, "invalid offset");
+
+  if (lua_type(L, 2) == LUA_TSTRING) {
+    fd = vfs_open(lua_tostring(L, 2), "r");
+    if (!fd)
+      return luaL_error(L, "cannot open %s", lua_tostring(L, 2));
+  } else {
+    fd = ((net_file_ud *)luaL_checkudata(L, 2, "file.obj"))->fd;
+    if (!fd)
+      return luaL_error(L, "file closed");
+    lua_pushvalue(L, 2);
+    file_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  size = vfs_size(fd);
+  if (offset > size)
+    offset = size;
+  if (len < 0 || len > size - offset)
+    len = size - offset;
+
+  sf = (lnet_sendfile *)lua_newuserdata(L, sizeof(lnet_sendfile));
+  sf->fd = fd;
+  sf->file_ref = file_ref;
+  sf->offset = offset;
+  sf->remaining = len;
+  sf->started = 0;
+  luaL_getmetatable(L, NET_TABLE_SENDFILE);
+  lua_setmetatable(L, -2);
+
+  ud->client.sq_bytes += len;
+  net_sendq_append(L, ud);
+  net_sendq_pump(L, ud);
+  lua_pushinteger(L, len);
+  return 1;
+}
+
+static int net_sendfile_free( lua_State *L ) {
+  net_sendfile_close(L, (lnet_sendfile *)luaL_checkudata(L, 1, NET_TABLE_SENDFILE));
+  return 0;
+}
+
+// Lua: queued, inflight, items = client:sendq()
+int net_sendq( lua_State *L ) {
+  lnet_userdata *ud = net_get_udata(L);
+  if (!ud || ud->type != TYPE_TCP_CLIENT)
+    return luaL_error(L, "invalid user data");
+  lua_pushinteger(L, ud->client.sq_bytes);
+  lua_pushinteger(L, ud->tcp_pcb ? TCP_SND_BUF - tcp_sndbuf(ud->tcp_pcb) : 0);
+  lua_pushinteger(L, ud->client.sq_tail - ud->client.sq_head);
+  return 3;
+}
+
 // Lua: client:hold()
 int net_hold( lua_State *L ) {
   lnet_userdata *ud = net_get_udata(L);
@@ -580,7 +1029,7 @@ int net_unhold( lua_State *L ) {
   lnet_userdata *ud = net_get_udata(L);
   if (!ud || ud->type != TYPE_TCP_CLIENT)
     return luaL_error(L, "invalid user data");
-  if (ud->client.hold && ud->tcp_pcb) {
+  if (ud->client.hold && ud->tcp_pcb && !ud->rx.buffered) {
 	ud->client.hold = 0;
 	ud->tcp_pcb->flags |= TF_ACK_NOW;
     tcp_recved(ud->tcp_pcb, TCP_WND);
@@ -722,6 +1171,11 @@ int net_close( lua_State *L ) {
   if (ud->pcb) {
     switch (ud->type) {
       case TYPE_TCP_CLIENT:
+        if (ud->client.rx_chain) {
+          pbuf_free(ud->client.rx_chain);
+          ud->client.rx_chain = NULL;
+        }
+        net_sendq_free(L, ud);
         if (ERR_OK != tcp_close(ud->tcp_pcb)) {
           tcp_arg(ud->tcp_pcb, NULL);
           tcp_abort(ud->tcp_pcb);
@@ -775,6 +1229,11 @@ int net_delete( lua_State *L ) {
   }
   switch (ud->type) {
     case TYPE_TCP_CLIENT:
+      if (ud->client.rx_chain) {
+        pbuf_free(ud->client.rx_chain);
+        ud->client.rx_chain = NULL;
+      }
+      net_sendq_free(L, ud);
       luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_connect_ref);
       ud->client.cb_connect_ref = LUA_NOREF;
       luaL_unref(L, LUA_REGISTRYINDEX, ud->client.cb_disconnect_ref);
@@ -1013,6 +1472,98 @@ static int net_ifinfo( lua_State* L ) {
   return 1;
 }
 
+#pragma mark - Receive buffers
+
+static lnet_rxbuf *net_get_rxbuf( lua_State *L ) {
+  return (lnet_rxbuf *)luaL_checkudata(L, 1, NET_TABLE_RXBUF);
+}
+
+// Convert string.sub() style arguments at stack, stack+1 to an offset and length
+static void net_rxbuf_range( lua_State *L, lnet_rxbuf *b, int stack,
+                             uint16_t *offset, uint16_t *len ) {
+  lua_Integer i = luaL_optinteger(L, stack, 1);
+  lua_Integer j = luaL_optinteger(L, stack + 1, -1);
+  if (i < 0) i += b->len + 1;
+  if (j < 0) j += b->len + 1;
+  if (i < 1) i = 1;
+  if (j > b->len) j = b->len;
+  *offset = b->offset + i - 1;
+  *len = (i > j) ? 0 : j - i + 1;
+}
+
+// Lua: buf:sub(i[, j]) -- returns a new buffer viewing the same data
+static int net_rxbuf_sub( lua_State *L ) {
+  lnet_rxbuf *b = net_get_rxbuf(L);
+  uint16_t offset, len;
+  if (!b->p) return luaL_error(L, "buffer released");
+  net_rxbuf_range(L, b, 2, &offset, &len);
+  pbuf_ref(b->p);
+  net_rxbuf_new(L, b->p, offset, len);
+  return 1;
+}
+
+// Lua: buf:string([i[, j]]), tostring(buf) -- copy (part of) the buffer to a string
+static int net_rxbuf_string( lua_State *L ) {
+  lnet_rxbuf *b = net_get_rxbuf(L);
+  uint16_t offset, len;
+  luaL_Buffer sb;
+  net_rxbuf_range(L, b, 2, &offset, &len);
+  if (!b->p || len == 0) {
+    lua_pushliteral(L, "");
+    return 1;
+  }
+  luaL_buffinit(L, &sb);
+  while (len) {
+    size_t n = len > LUAL_BUFFERSIZE ? LUAL_BUFFERSIZE : len;
+    char *d = luaL_prepbuffer(&sb);
+    n = pbuf_copy_partial(b->p, d, n, offset);
+    luaL_addsize(&sb, n);
+    offset += n;
+    len -= n;
+  }
+  luaL_pushresult(&sb);
+  return 1;
+}
+
+// Lua: buf:byte(i) -- returns the byte at position i
+static int net_rxbuf_byte( lua_State *L ) {
+  lnet_rxbuf *b = net_get_rxbuf(L);
+  lua_Integer i = luaL_optinteger(L, 2, 1);
+  if (i < 0) i += b->len + 1;
+  if (!b->p || i < 1 || i > b->len) return 0;
+  lua_pushinteger(L, pbuf_get_at(b->p, b->offset + i - 1));
+  return 1;
+}
+
+// Lua: buf:find(s[, init]) -- plain search, returns start and end positions
+static int net_rxbuf_find( lua_State *L ) {
+  lnet_rxbuf *b = net_get_rxbuf(L);
+  size_t l;
+  const char *needle = luaL_checklstring(L, 2, &l);
+  lua_Integer init = luaL_optinteger(L, 3, 1);
+  if (init < 0) init += b->len + 1;
+  if (init < 1) init = 1;
+  if (!b->p || l == 0 || init + l - 1 > b->len) return 0;
+  u16_t pos = pbuf_memfind(b->p, needle, l, b->offset + init - 1);
+  if (pos == 0xFFFF || pos + l > b->offset + b->len) return 0;
+  lua_pushinteger(L, pos - b->offset + 1);
+  lua_pushinteger(L, pos - b->offset + l);
+  return 2;
+}
+
+// Lua: buf:len(), #buf
+static int net_rxbuf_len( lua_State *L ) {
+  lnet_rxbuf *b = net_get_rxbuf(L);
+  lua_pushinteger(L, b->len);
+  return 1;
+}
+
+// Lua: buf:release() -- free the data and reopen the TCP window
+static int net_rxbuf_free( lua_State *L ) {
+  net_rxbuf_release(L, net_get_rxbuf(L));
+  return 0;
+}
+
 #pragma mark - Tables
 
 // Module function map
@@ -1034,6 +1585,9 @@ LROT_BEGIN(net_tcpsocket, NULL, LROT_MASK_GC_INDEX)
   LROT_FUNCENTRY( close, net_close )
   LROT_FUNCENTRY( on, net_on )
   LROT_FUNCENTRY( send, net_send )
+  LROT_FUNCENTRY( queue, net_queue )
+  LROT_FUNCENTRY( sendfile, net_sendfile )
+  LROT_FUNCENTRY( sendq, net_sendq )
   LROT_FUNCENTRY( hold, net_hold )
   LROT_FUNCENTRY( unhold, net_unhold )
   LROT_FUNCENTRY( dns, net_dns )
@@ -1044,6 +1598,27 @@ LROT_END(net_tcpsocket, NULL, LROT_MASK_GC_INDEX)
 
 
 
+LROT_BEGIN(net_rxbuf, NULL, LROT_MASK_GC_INDEX)
+  LROT_FUNCENTRY( __gc, net_rxbuf_free )
+  LROT_TABENTRY(  __index, net_rxbuf )
+  LROT_FUNCENTRY( __len, net_rxbuf_len )
+  LROT_FUNCENTRY( __tostring, net_rxbuf_string )
+  LROT_FUNCENTRY( len, net_rxbuf_len )
+  LROT_FUNCENTRY( sub, net_rxbuf_sub )
+  LROT_FUNCENTRY( byte, net_rxbuf_byte )
+  LROT_FUNCENTRY( find, net_rxbuf_find )
+  LROT_FUNCENTRY( string, net_rxbuf_string )
+  LROT_FUNCENTRY( release, net_rxbuf_free )
+LROT_END(net_rxbuf, NULL, LROT_MASK_GC_INDEX)
+
+
+
+LROT_BEGIN(net_sendfile, NULL, LROT_MASK_GC)
+  LROT_FUNCENTRY( __gc, net_sendfile_free )
+LROT_END(net_sendfile, NULL, LROT_MASK_GC)
+
+
+
 LROT_BEGIN(net_udpsocket, NULL, LROT_MASK_GC_INDEX)
   LROT_FUNCENTRY( __gc, net_delete )
   LROT_TABENTRY(  __index, net_udpsocket )
@@ -1093,6 +1668,8 @@ int luaopen_net( lua_State *L ) {
   luaL_rometatable(L, NET_TABLE_TCP_SERVER, LROT_TABLEREF(net_tcpserver));
   luaL_rometatable(L, NET_TABLE_TCP_CLIENT, LROT_TABLEREF(net_tcpsocket));
   luaL_rometatable(L, NET_TABLE_UDP_SOCKET, LROT_TABLEREF(net_udpsocket));
+  luaL_rometatable(L, NET_TABLE_RXBUF, LROT_TABLEREF(net_rxbuf));
+  luaL_rometatable(L, NET_TABLE_SENDFILE, LROT_TABLEREF(net_sendfile));
 
   return 0;
 }
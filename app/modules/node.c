@@ -247,17 +247,18 @@ static void add_string_field( lua_State* L, const char *s, const char *name) {
 }
 
 static void get_lfs_config ( lua_State* L ){
-    int config[5];
+    int config[6];
     lua_getlfsconfig(L, config);
-    lua_createtable(L, 0, 4);
+    lua_createtable(L, 0, 5);
     add_int_field(L, config[0], "lfs_mapped");
     add_int_field(L, config[1], "lfs_base");
     add_int_field(L, config[2], "lfs_size");
     add_int_field(L, config[3], "lfs_used");
+    add_int_field(L, config[5], "lfs_bank");
 }
 
 static int node_info( lua_State* L ){
-  const char* options[] = {"lfs", "hw", "sw_version", "build_config", "legacy", NULL};
+  const char* options[] = {"lfs", "hw", "sw_version", "build_config", "legacy", "keycache", NULL};
   int option = luaL_checkoption (L, 1, options[4], options);
 
   switch (option) {
@@ -295,6 +296,33 @@ static int node_info( lua_State* L ){
       add_string_field(L, BUILDINFO_BUILD_TYPE, "number_type");
       return 1;
     }
+    case 5: { // keycache
+      unsigned stats[3], total[3] = {0, 0, 0};
+      int i, j, lines = lua_getkeycachestats(L, -1, NULL);
+      lua_createtable(L, 0, 8);
+      add_int_field(L, KEYCACHE_N, "lines");
+      add_int_field(L, KEYCACHE_M, "slots");
+      if (lines == 0)   /* stats not compiled in */
+        return 1;
+      lua_createtable(L, lines, 0);
+      lua_createtable(L, lines, 0);
+      lua_createtable(L, lines, 0);
+      for (i = 0; i < lines; i++) {
+        lua_getkeycachestats(L, i, stats);
+        for (j = 0; j < 3; j++) {
+          total[j] += stats[j];
+          lua_pushinteger(L, stats[j]);
+          lua_rawseti(L, j - 4, i + 1);
+        }
+      }
+      lua_setfield(L, -4, "line_evictions");
+      lua_setfield(L, -3, "line_misses");
+      lua_setfield(L, -2, "line_hits");
+      add_int_field(L, total[0], "hits");
+      add_int_field(L, total[1], "misses");
+      add_int_field(L, total[2], "evictions");
+      return 1;
+    }
     default: { // legacy
       platform_print_deprecation_note("node.info() without parameter", "in the next version");
       lua_pushinteger(L, NODE_VERSION_MAJOR);
@@ -503,8 +531,31 @@ static int node_task_post( lua_State* L )
   }
   luaL_checktype(L, n, LUA_TFUNCTION);
   lua_settop(L, n);
-  (void) luaL_posttask(L, priority);
-  return 0;
+  /* return false if the task had to be parked in the overflow spill list */
+  lua_pushboolean(L, luaL_posttask(L, priority) != PLATFORM_TASK_POST_WOULDBLOCK);
+  return 1;
+}
+
+// Lua: node.task.stats(priority [, reset]) -- return the task queue counters
+static int node_task_stats( lua_State* L )
+{
+  platform_task_stats_t stats;
+  unsigned priority = (unsigned) luaL_checkint(L, 1);
+  luaL_argcheck(L, priority <= TASK_PRIORITY_HIGH, 1, "invalid  priority");
+  platform_task_get_stats(priority, &stats, lua_toboolean(L, 2));
+
+  lua_createtable(L, 0, 8);
+#define SET_STAT(f) lua_pushinteger(L, stats.f); lua_setfield(L, -2, #f)
+  SET_STAT(posted);
+  SET_STAT(dispatched);
+  SET_STAT(dropped);
+  SET_STAT(spilled);
+  SET_STAT(depth);
+  SET_STAT(max_depth);
+  SET_STAT(qlen);
+  SET_STAT(spill_len);
+#undef SET_STAT
+  return 1;
 }
 
 // Lua: setcpufreq(mhz)
@@ -789,6 +840,20 @@ static int node_lfsreload (lua_State *L) {
   return 1;
 }
 
+// Lua: err = node.LFS.load(lfsimage)
+static int node_lfsload (lua_State *L) {
+  luaL_checkstring(L, 1);
+  lua_settop(L, 1);
+  luaL_lfsload(L);
+  return 1;
+}
+
+// Lua: ok = node.LFS.confirm()
+static int node_lfsconfirm (lua_State *L) {
+  lua_pushboolean(L, luaL_lfsconfirm(L));
+  return 1;
+}
+
 // Lua: n = node.flashreload(lfsimage)
 static int lua_lfsreload_deprecated (lua_State *L) {
   platform_print_deprecation_note("node.flashreload", "soon. Use node.LFS interface instead");
@@ -843,16 +908,21 @@ LROT_BEGIN(node_lfs, LROT_TABLEREF(node_lfs_meta), 0)
   LROT_FUNCENTRY( list, node_lfslist)
   LROT_FUNCENTRY( get, node_lfsindex)
   LROT_FUNCENTRY( reload, node_lfsreload )
+  LROT_FUNCENTRY( load, node_lfsload )
+  LROT_FUNCENTRY( confirm, node_lfsconfirm )
 LROT_END(node_lfs, LROT_TABLEREF(node_lfs_meta), 0)
 
 
-typedef enum pt_t { lfs_addr=0, lfs_size, spiffs_addr, spiffs_size, max_pt} pt_t;
+typedef enum pt_t { lfs_addr=0, lfs_size, spiffs_addr, spiffs_size,
+                   lfs1_addr, lfs1_size, max_pt} pt_t;
 
 LROT_BEGIN(pt_map, NULL, 0)
   LROT_NUMENTRY( lfs_addr, lfs_addr )
   LROT_NUMENTRY( lfs_size, lfs_size )
   LROT_NUMENTRY( spiffs_addr, spiffs_addr )
   LROT_NUMENTRY( spiffs_size, spiffs_size )
+  LROT_NUMENTRY( lfs1_addr, lfs1_addr )
+  LROT_NUMENTRY( lfs1_size, lfs1_size )
 LROT_END(pt_map, NULL, 0)
 
 
@@ -861,6 +931,7 @@ static int node_getpartitiontable (lua_State *L) {
   uint32_t param[max_pt] = {0};
   param[lfs_size]    = platform_flash_get_partition(NODEMCU_LFS0_PARTITION, param + lfs_addr);
   param[spiffs_size] = platform_flash_get_partition(NODEMCU_SPIFFS0_PARTITION, param + spiffs_addr);
+  param[lfs1_size]   = platform_flash_get_partition(NODEMCU_LFS1_PARTITION, param + lfs1_addr);
 
   lua_settop(L, 0);
   lua_createtable (L, 0, max_pt);                   /* at index 1 */
@@ -892,6 +963,7 @@ static void delete_partition(partition_item_t *p, int n) {
 #define SKIP (~0)
 #define IROM0_PARTITION  (SYSTEM_PARTITION_CUSTOMER_BEGIN + NODEMCU_IROM0TEXT_PARTITION)
 #define LFS_PARTITION    (SYSTEM_PARTITION_CUSTOMER_BEGIN + NODEMCU_LFS0_PARTITION)
+#define LFS1_PARTITION   (SYSTEM_PARTITION_CUSTOMER_BEGIN + NODEMCU_LFS1_PARTITION)
 #define SPIFFS_PARTITION (SYSTEM_PARTITION_CUSTOMER_BEGIN + NODEMCU_SPIFFS0_PARTITION)
 #define SYSTEM_PARAMETER_SIZE  0x3000
 
@@ -902,7 +974,7 @@ static int node_setpartitiontable (lua_State *L) {
   uint32_t i = platform_rcr_read(PLATFORM_RCR_PT, (void **) &rcr_pt);
   uint32_t last = 0;
   uint32_t n = i / sizeof(partition_item_t);
-  uint32_t param[max_pt] = {SKIP, SKIP, SKIP, SKIP};
+  uint32_t param[max_pt] = {SKIP, SKIP, SKIP, SKIP, SKIP, SKIP};
 
 /* stack 1=ptvals, 2=pt_map, 3=key, 4=ptval[key], 5=pt_map[key] */ 
   luaL_argcheck(L, lua_istable(L, 1), 1, "must be table");
@@ -942,6 +1014,22 @@ static int node_setpartitiontable (lua_State *L) {
         p->addr = param[lfs_addr];
       if (param[lfs_size] != SKIP) 
         p->size = param[lfs_size];
+      if (p[1].type != LFS1_PARTITION && param[lfs1_size] != SKIP) {
+        // if a second LFS partition is wanted then slot one in following LFS
+        insert_partition(p + 1, n-i-1, LFS1_PARTITION, p->addr + p->size);
+        n++;
+      } else if (p[1].type != SPIFFS_PARTITION && p[1].type != LFS1_PARTITION) {
+        // if the SPIFFS partition is not following LFS then slot a blank one in
+        insert_partition(p + 1, n-i-1, SPIFFS_PARTITION, 0);
+        n++;
+      }
+
+    } else if (p->type == LFS1_PARTITION) {
+      // update the second LFS options if set
+      if (param[lfs1_addr] != SKIP)
+        p->addr = param[lfs1_addr];
+      if (param[lfs1_size] != SKIP)
+        p->size = param[lfs1_size];
       if (p[1].type != SPIFFS_PARTITION) {
         // if the SPIFFS partition is not following LFS then slot a blank one in
         insert_partition(p + 1, n-i-1, SPIFFS_PARTITION, 0);
@@ -1006,6 +1094,7 @@ LROT_END(node_egc, NULL, 0)
 
 LROT_BEGIN(node_task, NULL, 0)
   LROT_FUNCENTRY( post, node_task_post )
+  LROT_FUNCENTRY( stats, node_task_stats )
   LROT_NUMENTRY( LOW_PRIORITY, TASK_PRIORITY_LOW )
   LROT_NUMENTRY( MEDIUM_PRIORITY, TASK_PRIORITY_MEDIUM )
   LROT_NUMENTRY( HIGH_PRIORITY, TASK_PRIORITY_HIGH )
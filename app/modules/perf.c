@@ -3,7 +3,9 @@
 // the PC at regular intervals and building a histogram
 //
 // perf.start(start, end, nbins[, pc offset on stack])
+// perf.profile([period_us[, depth[, max_stacks]]])
 // perf.stop()  -> total sample, samples outside range, table { addr -> count , .. }
+//              or total samples, samples outside Lua, table { folded stack -> count, .. }
 
 
 #include "ets_sys.h"
@@ -32,6 +34,31 @@ extern char _flash_used_end[];
 
 #define TIMER_OWNER ((os_param_t) 'p')
 
+/*
+** Lua profiler state.  The timer interrupt can't safely walk the Lua stack,
+** so it just flags that a sample is due and a count hook, which runs every
+** PROF_HOOK_COUNT VM instructions, records the call stack on the timer's
+** behalf.  If no hook has run since the last tick then Lua isn't running
+** (the VM is idle or in a long C call) and the sample is counted as outside.
+*/
+#define PROF_HOOK_COUNT     256
+#define PROF_FOLDED_LEN     256
+#define PROF_DEFAULT_PERIOD 1000
+#define PROF_DEFAULT_DEPTH  8
+#define PROF_DEFAULT_STACKS 128
+
+typedef struct {
+  int ref;                  // table of folded stack -> sample count
+  uint16_t depth;
+  uint16_t max_stacks;
+  uint16_t stacks;
+  uint32_t total_samples;
+  uint32_t outside_samples;
+} PROF;
+
+static PROF prof;
+static volatile bool prof_running, sample_due, hook_ran;
+
 static void ICACHE_RAM_ATTR hw_timer_cb(os_param_t p)
 {
   (void) p;
@@ -54,6 +81,120 @@ static void ICACHE_RAM_ATTR hw_timer_cb(os_param_t p)
   }
 }
 
+static void ICACHE_RAM_ATTR prof_timer_cb(os_param_t p)
+{
+  (void) p;
+
+  if (prof_running) {
+    if (sample_due || !hook_ran) {
+      prof.outside_samples++;
+      sample_due = false;
+    } else {
+      sample_due = true;
+    }
+    hook_ran = false;
+    prof.total_samples++;
+  }
+}
+
+static void prof_hook(lua_State *L, lua_Debug *ar)
+{
+  (void) ar;
+  char folded[PROF_FOLDED_LEN];
+  size_t len = 0;
+  lua_Debug fr;
+  int level, n;
+
+  hook_ran = true;
+  if (!sample_due) {
+    return;
+  }
+  sample_due = false;
+
+  // Fold the stack, outermost frame first, as "name@source:line;..."
+  for (n = 0; n < prof.depth && lua_getstack(L, n, &fr); n++) {
+  }
+  for (level = n - 1; level >= 0 && len < sizeof(folded) - 1; level--) {
+    lua_getstack(L, level, &fr);
+    lua_getinfo(L, "Sn", &fr);
+    len += snprintf(folded + len, sizeof(folded) - len, "%s%s@%s:%d",
+                    len ? ";" : "", fr.name ? fr.name : "?", fr.short_src, fr.linedefined);
+  }
+  if (len > sizeof(folded) - 1) {
+    len = sizeof(folded) - 1;
+  }
+
+  lua_rawgeti(L, LUA_REGISTRYINDEX, prof.ref);
+  lua_pushlstring(L, folded, len);
+  lua_pushvalue(L, -1);
+  lua_rawget(L, -3);
+  if (lua_isnil(L, -1)) {
+    if (prof.stacks >= prof.max_stacks) {
+      // Table is full, so lump any new stacks together
+      lua_pop(L, 2);
+      lua_pushliteral(L, "[other]");
+      lua_pushvalue(L, -1);
+      lua_rawget(L, -3);
+    } else {
+      prof.stacks++;
+    }
+  }
+  n = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  lua_pushinteger(L, n + 1);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+}
+
+static int perf_profile(lua_State *L)
+{
+  uint32_t period = luaL_optinteger(L, 1, PROF_DEFAULT_PERIOD);
+  int depth = luaL_optinteger(L, 2, PROF_DEFAULT_DEPTH);
+  int max_stacks = luaL_optinteger(L, 3, PROF_DEFAULT_STACKS);
+
+  luaL_argcheck(L, period >= 100, 1, "period too short");
+  luaL_argcheck(L, depth >= 1 && depth <= 32, 2, "out of range");
+  luaL_argcheck(L, max_stacks >= 1 && max_stacks <= 0xFFFF, 3, "out of range");
+  if (data || prof_running) {
+    luaL_error(L, "perf already running");
+  }
+
+  lua_newtable(L);
+  prof.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  prof.depth = depth;
+  prof.max_stacks = max_stacks;
+  prof.stacks = 0;
+  prof.total_samples = prof.outside_samples = 0;
+  sample_due = hook_ran = false;
+
+  if (!platform_hw_timer_init(TIMER_OWNER, FRC1_SOURCE, TRUE)) {
+    luaL_unref(L, LUA_REGISTRYINDEX, prof.ref);
+    luaL_error(L, "Unable to initialize timer");
+  }
+
+  lua_sethook(lua_getstate(), prof_hook, LUA_MASKCOUNT, PROF_HOOK_COUNT);
+  prof_running = true;
+  platform_hw_timer_set_func(TIMER_OWNER, prof_timer_cb, 0);
+  platform_hw_timer_arm_us(TIMER_OWNER, period);
+
+  return 0;
+}
+
+static int perf_stop_profile(lua_State *L)
+{
+  platform_hw_timer_close(TIMER_OWNER);
+  prof_running = false;
+  lua_sethook(lua_getstate(), NULL, 0, 0);
+
+  lua_pushunsigned(L, prof.total_samples);
+  lua_pushunsigned(L, prof.outside_samples);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, prof.ref);
+  luaL_unref(L, LUA_REGISTRYINDEX, prof.ref);
+  prof.ref = LUA_NOREF;
+
+  return 3;
+}
+
 static int perf_start(lua_State *L)
 {
   uint32_t start = luaL_optinteger(L, 1, 0x40000000);
@@ -63,6 +204,9 @@ static int perf_start(lua_State *L)
   if (end <= start) {
     luaL_error(L, "end must be larger than start");
   }
+  if (prof_running) {
+    luaL_error(L, "perf already running");
+  }
 
   uint32_t binsize = (end - start + bins - 1) / bins;
 
@@ -105,6 +249,9 @@ static int perf_start(lua_State *L)
 
 static int perf_stop(lua_State *L)
 {
+  if (prof_running) {
+    return perf_stop_profile(L);
+  }
   if (!data) {
     return 0;
   }
@@ -138,6 +285,7 @@ static int perf_stop(lua_State *L)
 LROT_BEGIN(perf, NULL, 0)
   LROT_FUNCENTRY( start, perf_start )
   LROT_FUNCENTRY( stop, perf_stop )
+  LROT_FUNCENTRY( profile, perf_profile )
 LROT_END(perf, NULL, 0)
 
 
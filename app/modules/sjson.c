@@ -15,6 +15,8 @@
 #define LUA_SJSONLIBNAME "sjson"
 
 #define DEFAULT_DEPTH   20
+#define MAX_PATH_LEN    128   // longest path tracked in streaming mode
+#define PATH_OVERFLOW   0xFFFF
 
 #define DBG_PRINTF(...)
 
@@ -35,6 +37,13 @@ typedef struct {
   size_t buffer_len;
   const char *buffer; // Points into buffer_ref
   int buffer_ref;
+  // Streaming mode only
+  int onvalue_ref;      // LUA_NOREF if building tables
+  int filter_ref;       // String of NUL terminated filters, or LUA_NOREF
+  const char *filter;   // Points into filter_ref
+  uint16_t *path_len;   // Length of the path to the container at each level
+  uint16_t key_len;     // Length of the path to the pending object key
+  char *path;
 } JSN_DATA;
 
 #define get_parent_object_ref() ((state->level == 1) ? data->result_ref : state[-1].lua_object_ref)
@@ -46,6 +55,8 @@ static const char* get_state_buffer(JSN_DATA *ctx, struct jsonsl_state_st *state
   return ctx->buffer + offset;
 }
 
+static void stream_push(JSN_DATA *data, struct jsonsl_state_st *state);
+
 // The elem data is a ref
 
 static int error_callback(jsonsl_t jsn,
@@ -84,6 +95,12 @@ create_new_element(jsonsl_t jsn,
 
   state->lua_object_ref = LUA_NOREF;
 
+  if (data->onvalue_ref != LUA_NOREF) {
+    stream_push(data, state);
+    data->min_needed = state->pos_begin;
+    return;
+  }
+
   switch(state->type) {
     case JSONSL_T_SPECIAL:
     case JSONSL_T_STRING:
@@ -228,6 +245,126 @@ static void push_string(JSN_DATA *data, struct jsonsl_state_st *state) {
   luaL_pushresult(&b);
 }
 
+/*
+** Streaming mode.  Rather than building tables, the path to each scalar
+** value is tracked as a '.' separated string of keys and (1-based) array
+** indices, and the value is passed to the onvalue callback if the path
+** matches one of the filters.  A filter matches a path if each of its levels
+** matches the corresponding level of the path, with '*' matching any level.
+** Values that don't match are never converted to Lua values.
+*/
+static int stream_path_match(JSN_DATA *data, size_t plen) {
+  const char *f = data->filter;
+  if (plen == PATH_OVERFLOW) {
+    return 0;
+  }
+  if (!f) {
+    return 1;
+  }
+  for (; *f; f += strlen(f) + 1) {
+    const char *p = data->path, *pend = data->path + plen, *fl = f;
+    for (;;) {
+      const char *fe = strchr(fl, '.');
+      size_t flen = fe ? (size_t) (fe - fl) : strlen(fl);
+      if (p > pend) {
+        break;            // path is shorter than filter
+      }
+      const char *pe = memchr(p, '.', pend - p);
+      if (!pe) {
+        pe = pend;
+      }
+      if (!(flen == 1 && *fl == '*') &&
+          !(flen == (size_t) (pe - p) && memcmp(fl, p, flen) == 0)) {
+        break;
+      }
+      if (!fe) {
+        return 1;
+      }
+      fl = fe + 1;
+      p = pe + 1;
+    }
+  }
+  return 0;
+}
+
+// Append a path segment at offset base, returning the new path length
+static uint16_t stream_path_add(JSN_DATA *data, uint16_t base, const char *seg, size_t len) {
+  if (base == PATH_OVERFLOW || base + len + 1 > MAX_PATH_LEN) {
+    return PATH_OVERFLOW;
+  }
+  if (base > 0) {
+    data->path[base++] = '.';
+  }
+  memcpy(data->path + base, seg, len);
+  return base + len;
+}
+
+// Return the length of the path to the value in state
+static uint16_t stream_value_path(JSN_DATA *data, struct jsonsl_state_st *state) {
+  if (state->level == 1) {
+    return 0;
+  }
+  if (state[-1].type == JSONSL_T_LIST) {
+    char index[12];
+    int len = sprintf(index, "%d", ++state[-1].used_count);
+    return stream_path_add(data, data->path_len[state->level - 1], index, len);
+  }
+  return data->key_len;
+}
+
+static void stream_push(JSN_DATA *data, struct jsonsl_state_st *state) {
+  if (state->type == JSONSL_T_LIST || state->type == JSONSL_T_OBJECT) {
+    data->path_len[state->level] = stream_value_path(data, state);
+    state->used_count = 0;
+  }
+}
+
+static void stream_pop(JSN_DATA *data, struct jsonsl_state_st *state) {
+  lua_State *L = data->L;
+  uint16_t plen;
+
+  switch (state->type) {
+    case JSONSL_T_HKEY:
+      // Keys are used as they appear in the JSON text, without unescaping
+      data->key_len = stream_path_add(data, data->path_len[state->level - 1],
+                                      get_state_buffer(data, state) + 1,
+                                      state->pos_cur - state->pos_begin - 1);
+      break;
+
+    case JSONSL_T_STRING:
+    case JSONSL_T_SPECIAL:
+      plen = stream_value_path(data, state);
+      if (!stream_path_match(data, plen)) {
+        break;
+      }
+      lua_rawgeti(L, LUA_REGISTRYINDEX, data->onvalue_ref);
+      lua_pushlstring(L, data->path, plen);
+      if (state->type == JSONSL_T_STRING) {
+        push_string(data, state);
+      } else if (state->special_flags & JSONSL_SPECIALf_TRUE) {
+        lua_pushboolean(L, 1);
+      } else if (state->special_flags & JSONSL_SPECIALf_FALSE) {
+        lua_pushboolean(L, 0);
+      } else if (state->special_flags & JSONSL_SPECIALf_NULL) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, data->null_ref);
+      } else if (state->special_flags & JSONSL_SPECIALf_NUMERIC) {
+        push_number(data, state);
+      } else {
+        lua_pop(L, 2);
+        break;
+      }
+      lua_call(L, 2, 0);
+      break;
+
+    case JSONSL_T_OBJECT:
+    case JSONSL_T_LIST:
+      if (state->level == 1) {
+        data->complete = 1;
+      }
+      break;
+  }
+}
+
 static void
 cleanup_closing_element(jsonsl_t jsn,
                         jsonsl_action_t action,
@@ -239,6 +376,11 @@ cleanup_closing_element(jsonsl_t jsn,
   DBG_PRINTF( "buf (%d - %d): '%.*s'\n", state->pos_begin, state->pos_cur, state->pos_cur - state->pos_begin, get_state_buffer(data, state));
   DBG_PRINTF( "at: '%s'\n", at);
 
+  if (data->onvalue_ref != LUA_NOREF) {
+    stream_pop(data, state);
+    return;
+  }
+
  switch (state->type) {
    case JSONSL_T_HKEY:
       push_string(data, state);
@@ -329,7 +471,16 @@ static int sjson_decoder_int(lua_State *L, int argno) {
     lua_pop(L, 1);
   }
 
-  JSN_DATA *data = (JSN_DATA *) lua_newuserdata(L, sizeof(JSN_DATA) + jsonsl_get_size(nlevels));
+  int streaming = 0;
+  if (lua_type(L, argno) == LUA_TTABLE) {
+    lua_getfield(L, argno, "onvalue");
+    streaming = lua_isfunction(L, -1);
+    lua_pop(L, 1);
+  }
+  size_t jsn_size = jsonsl_get_size(nlevels);
+  size_t stream_size = streaming ? (nlevels + 1) * sizeof(uint16_t) + MAX_PATH_LEN : 0;
+
+  JSN_DATA *data = (JSN_DATA *) lua_newuserdata(L, sizeof(JSN_DATA) + jsn_size + stream_size);
   //
   // Associate its metatable
   luaL_getmetatable(L, "sjson.decoder");
@@ -353,6 +504,12 @@ static int sjson_decoder_int(lua_State *L, int argno) {
   data->error = NULL;
   data->L = L;
   data->buffer_len = 0;
+  data->onvalue_ref = LUA_NOREF;
+  data->filter_ref = LUA_NOREF;
+  data->filter = NULL;
+  data->path_len = NULL;
+  data->path = NULL;
+  data->key_len = 0;
 
   data->min_needed = data->min_available = jsn->pos;
 
@@ -382,6 +539,42 @@ static int sjson_decoder_int(lua_State *L, int argno) {
       lua_pop(L, 1);      // Throw away the checkpath value
     }
     lua_pop(L, 1);      // Throw away the metatable
+
+    if (streaming) {
+      data->path_len = (uint16_t *) ((char *) (data + 1) + jsn_size);
+      data->path = (char *) (data->path_len + nlevels + 1);
+      data->path_len[0] = 0;
+
+      lua_getfield(L, argno, "onvalue");
+      data->onvalue_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+      // Pack the filters into a single string of NUL terminated filters
+      lua_getfield(L, argno, "filter");
+      if (!lua_isnil(L, -1)) {
+        luaL_Buffer b;
+        int t = lua_gettop(L);
+        luaL_buffinit(L, &b);
+        if (lua_type(L, t) == LUA_TTABLE) {
+          for (i = 1; lua_rawgeti(L, t, i), !lua_isnil(L, -1); i++) {
+            lua_tostring(L, -1);        // Allow numeric indices
+            luaL_argcheck(L, lua_type(L, -1) == LUA_TSTRING, argno, "filter must be a list of strings");
+            luaL_addvalue(&b);
+            luaL_addchar(&b, '\0');
+          }
+          lua_pop(L, 1);
+        } else {
+          luaL_checkstring(L, t);
+          lua_pushvalue(L, t);
+          luaL_addvalue(&b);
+          luaL_addchar(&b, '\0');
+        }
+        luaL_addchar(&b, '\0');
+        luaL_pushresult(&b);
+        data->filter = lua_tostring(L, -1);
+        data->filter_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+      }
+      lua_pop(L, 1);      // Throw away the filter option
+    }
   }
 
   jsonsl_enable_all_callbacks(data->jsn);
@@ -405,6 +598,12 @@ static int sjson_decoder_result_int(lua_State *L, JSN_DATA *data) {
     luaL_error(L, "decode not complete");
   }
 
+  if (data->path) {
+    // Streaming mode has no result other than success
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+
   lua_rawgeti(L, LUA_REGISTRYINDEX, data->result_ref);
   lua_rawgeti(L, -1, 1);
   lua_remove(L, -2);
@@ -438,6 +637,11 @@ static void sjson_free_working_data(lua_State *L, JSN_DATA *data) {
   data->pos_ref = LUA_NOREF;
   luaL_unref(L, LUA_REGISTRYINDEX, data->buffer_ref);
   data->buffer_ref = LUA_NOREF;
+  luaL_unref(L, LUA_REGISTRYINDEX, data->onvalue_ref);
+  data->onvalue_ref = LUA_NOREF;
+  luaL_unref(L, LUA_REGISTRYINDEX, data->filter_ref);
+  data->filter_ref = LUA_NOREF;
+  data->filter = NULL;
 }
 
 static int sjson_decoder_write_int(lua_State *L, int udata_pos, int string_pos) {
@@ -3,8 +3,12 @@
 #include "module.h"
 #include "lauxlib.h"
 #include "platform.h"
+#include "task/task.h"
+#include <stdlib.h>
+#include <string.h>
 
 #include "driver/spi.h"
+#include "pixbuf.h"
 
 #define SPI_HALFDUPLEX 0
 #define SPI_FULLDUPLEX 1
@@ -12,6 +16,36 @@
 static u8 spi_databits[NUM_SPI] = {0, 0};
 static u8 spi_duplex[NUM_SPI] = {SPI_HALFDUPLEX, SPI_HALFDUPLEX};
 
+// State of the background transfer started by spi.send_async(), if any
+static struct {
+  int cb_ref;           // completion callback
+  int data_ref;         // keeps the data being sent alive
+  uint8_t *copy;        // RAM copy of data held in flash (LFS)
+  uint8_t *in;          // received data in full-duplex mode
+  size_t len;
+  bool pending;         // set until spi_async_complete() has run
+  volatile bool unposted; // the ISR couldn't post spi_async_complete()
+} spi_async = {LUA_NOREF, LUA_NOREF};
+static platform_task_handle_t spi_async_task;
+
+// The driver is idle again before the completion task has released the
+// transfer's buffers, so the bus stays busy until that has run too.
+static bool spi_busy( int id )
+{
+  if( spi_mast_async_busy( id ) )
+    return true;
+  if( id != SPI_HSPI || !spi_async.pending )
+    return false;
+  // The task queue was full in the ISR, try again from task context
+  if( spi_async.unposted && platform_post_low( spi_async_task, 0 ) )
+    spi_async.unposted = false;
+  return true;
+}
+
+#define SPI_CHECK_IDLE( L, id ) \
+  if( spi_busy( id ) ) \
+    return luaL_error( L, "spi %d is busy", id )
+
 // Lua: = spi.setup( id, mode, cpol, cpha, databits, clock_div, [duplex_mode] )
 static int spi_setup( lua_State *L )
 {
@@ -24,6 +58,7 @@ static int spi_setup( lua_State *L )
   int duplex_mode = luaL_optinteger( L, 7, SPI_HALFDUPLEX );
 
   MOD_CHECK_ID( spi, id );
+  SPI_CHECK_IDLE( L, id );
 
   if (mode != PLATFORM_SPI_SLAVE && mode != PLATFORM_SPI_MASTER) {
     return luaL_error( L, "wrong arg type" );
@@ -79,6 +114,7 @@ static int spi_send_recv( lua_State *L )
   u8 recv = spi_duplex[id] == SPI_FULLDUPLEX ? 1 : 0;
 
   MOD_CHECK_ID( spi, id );
+  SPI_CHECK_IDLE( L, id );
   if( (tos = lua_gettop( L )) < 2 )
     return luaL_error( L, "wrong arg type" );
 
@@ -183,6 +219,7 @@ static int spi_recv( lua_State *L )
   luaL_Buffer b;
 
   MOD_CHECK_ID( spi, id );
+  SPI_CHECK_IDLE( L, id );
   if (size == 0) {
     return 0;
   }
@@ -204,6 +241,7 @@ static int spi_set_mosi( lua_State *L )
   int id = luaL_checkinteger( L, 1 );
 
   MOD_CHECK_ID( spi, id );
+  SPI_CHECK_IDLE( L, id );
 
   if (lua_type( L, 2 ) == LUA_TSTRING) {
     size_t len;
@@ -240,6 +278,7 @@ static int spi_get_miso( lua_State *L )
   int id = luaL_checkinteger( L, 1 );
 
   MOD_CHECK_ID( spi, id );
+  SPI_CHECK_IDLE( L, id );
 
   if (lua_gettop( L ) == 2) {
     uint8_t data[64];
@@ -277,6 +316,7 @@ static int spi_transaction( lua_State *L )
   int id = luaL_checkinteger( L, 1 );
 
   MOD_CHECK_ID( spi, id );
+  SPI_CHECK_IDLE( L, id );
 
   int cmd_bitlen = luaL_checkinteger( L, 2 );
   u16 cmd_data   = ( u16 )luaL_checkinteger( L, 3 );
@@ -307,6 +347,7 @@ static int spi_set_clock_div( lua_State *L )
   int id = luaL_checkinteger( L, 1 );
 
   MOD_CHECK_ID( spi, id );
+  SPI_CHECK_IDLE( L, id );
 
   u32 clk_div = luaL_checkinteger( L, 2 );
 
@@ -317,11 +358,108 @@ static int spi_set_clock_div( lua_State *L )
   return 1;
 }
 
+// Called from the ISR when the background transfer completes
+static void spi_async_done( void *arg )
+{
+  if( !platform_post_low( spi_async_task, 0 ) )
+    spi_async.unposted = true;
+}
+
+static void spi_async_complete( platform_task_param_t param, uint8_t prio )
+{
+  lua_State *L = lua_getstate();
+  int cb_ref = spi_async.cb_ref, nargs = 0;
+
+  luaL_unref( L, LUA_REGISTRYINDEX, spi_async.data_ref );
+  spi_async.data_ref = spi_async.cb_ref = LUA_NOREF;
+  free( spi_async.copy );
+  spi_async.copy = NULL;
+
+  if( cb_ref != LUA_NOREF )
+  {
+    lua_rawgeti( L, LUA_REGISTRYINDEX, cb_ref );
+    luaL_unref( L, LUA_REGISTRYINDEX, cb_ref );
+    if( spi_async.in )
+    {
+      lua_pushlstring( L, (const char *)spi_async.in, spi_async.len );
+      nargs = 1;
+    }
+  }
+  free( spi_async.in );
+  spi_async.in = NULL;
+  spi_async.pending = false;
+  if( cb_ref != LUA_NOREF )
+    luaL_pcallx( L, nargs, 0 );
+}
+
+// Lua: spi.send_async( id, data, [callback] )
+// data is a string or pixbuf of any length, which is sent in 64 byte chunks
+// in the background; in full-duplex mode callback receives the data read
+static int spi_send_async( lua_State *L )
+{
+  int id = luaL_checkinteger( L, 1 );
+  const uint8_t *data;
+  size_t len;
+
+  MOD_CHECK_ID( spi, id );
+  luaL_argcheck( L, id == SPI_HSPI, 1, "only HSPI supports async transfers" );
+  SPI_CHECK_IDLE( L, id );
+
+  if( lua_type( L, 2 ) == LUA_TSTRING )
+  {
+    data = (const uint8_t *)lua_tolstring( L, 2, &len );
+  }
+  else
+  {
+    pixbuf *buffer = pixbuf_from_lua_arg( L, 2 );
+    data = buffer->values;
+    len  = pixbuf_size( buffer );
+  }
+  luaL_argcheck( L, len > 0, 2, "no data" );
+  if( !lua_isnoneornil( L, 3 ) )
+    luaL_checktype( L, 3, LUA_TFUNCTION );
+
+  // The ISR can only read RAM, so data in flash (e.g. LFS strings) is copied
+  if( (uint32_t)data >= 0x40000000 )
+  {
+    if( !(spi_async.copy = malloc( len )) )
+      return luaL_error( L, "out of memory" );
+    memcpy( spi_async.copy, data, len );
+    data = spi_async.copy;
+  }
+  // malloc() returns word aligned memory; round up for the FIFO word copies
+  if( spi_duplex[id] == SPI_FULLDUPLEX && !(spi_async.in = malloc( (len + 3) & ~3 )) )
+  {
+    free( spi_async.copy );
+    spi_async.copy = NULL;
+    return luaL_error( L, "out of memory" );
+  }
+
+  spi_async.len = len;
+  lua_pushvalue( L, 2 );
+  spi_async.data_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+  if( !lua_isnoneornil( L, 3 ) )
+  {
+    lua_pushvalue( L, 3 );
+    spi_async.cb_ref = luaL_ref( L, LUA_REGISTRYINDEX );
+  }
+
+  spi_async.pending = true;
+  spi_mast_async_transfer( id, data, spi_async.in, len, spi_async_done, NULL );
+  return 0;
+}
+
+int luaopen_spi( lua_State *L )
+{
+  spi_async_task = platform_task_get_id( spi_async_complete );
+  return 0;
+}
 
 // Module function map
 LROT_BEGIN(spi, NULL, 0)
   LROT_FUNCENTRY( setup, spi_setup )
   LROT_FUNCENTRY( send, spi_send_recv )
+  LROT_FUNCENTRY( send_async, spi_send_async )
   LROT_FUNCENTRY( recv, spi_recv )
   LROT_FUNCENTRY( set_mosi, spi_set_mosi )
   LROT_FUNCENTRY( get_miso, spi_get_miso )
@@ -339,4 +477,4 @@ LROT_BEGIN(spi, NULL, 0)
 LROT_END(spi, NULL, 0)
 
 
-NODEMCU_MODULE(SPI, "spi", spi, NULL);
+NODEMCU_MODULE(SPI, "spi", spi, luaopen_spi);
@@ -11,6 +11,7 @@
 #include "lauxlib.h"
 #include "platform.h"
 #include <stdint.h>
+#include <string.h>
 #include "user_interface.h"
 #include "pm/swtimer.h"
 
@@ -29,8 +30,14 @@
 static const uint32 MAX_TIMEOUT=MAX_TIMEOUT_DEF;
 static const char* MAX_TIMEOUT_ERR_STR = "Range: 1-"STRINGIFY(MAX_TIMEOUT_DEF);
 
-typedef struct{
+typedef struct tmr{
+#ifdef TMR_WHEEL
+  struct tmr *next;   /* next timer in the same wheel slot or on the due list */
+  struct tmr **pprev; /* link pointing to this timer, NULL when not armed */
+  uint32_t expires;   /* wheel tick (mS) at which the timer is due */
+#else
   os_timer_t os;
+#endif
   sint32_t lua_ref;  /* Reference to registered callback function */
   sint32_t self_ref;  /* Reference to UD registered slot */
   uint32_t interval;
@@ -75,6 +82,238 @@ static void alarm_timer_common(void* arg){
   }
 }
 
+#ifdef TMR_WHEEL
+/*
+** All armed tmr objects are kept on a hierarchical timing wheel, which is
+** driven by a single SDK timer.  Level 0 has one slot per mS tick; each
+** higher level has slots WHEEL_SIZE times as coarse and its entries are
+** cascaded down a level as their slot comes round.  WHEEL_LEVELS levels of
+** WHEEL_BITS cover 2^25 mS, which exceeds MAX_TIMEOUT.  A bitmap of occupied
+** slots per level lets the wheel skip straight to the next tick with work, so
+** the SDK timer is only armed for the next expiry or cascade, and not every
+** tick.  Expired timers are moved onto the due list and dispatched as a batch.
+*/
+#define WHEEL_BITS     5
+#define WHEEL_SIZE     (1<<WHEEL_BITS)
+#define WHEEL_MASK     (WHEEL_SIZE-1)
+#define WHEEL_LEVELS   5
+#define WHEEL_MAX_WAIT 0x100000  // re-examine the wheel at least this often (mS)
+
+#ifndef TMR_WHEEL_TOLERANCE
+#define TMR_WHEEL_TOLERANCE 1
+#endif
+
+static struct {
+  tmr_t *slot[WHEEL_LEVELS][WHEEL_SIZE];
+  uint32_t bitmap[WHEEL_LEVELS];  /* occupied slots in each level */
+  tmr_t *due, **due_tail;         /* expired timers awaiting dispatch */
+  uint32_t tick;                  /* next tick to be processed */
+  uint32_t now_ms, last_us;       /* system_get_time() extended to mS */
+  uint32_t count;                 /* number of armed timers */
+  uint32_t tolerance;             /* coalescing window in mS */
+  uint32_t fired, batches, late, max_late;
+  os_timer_t os;
+} wheel;
+
+static uint32_t wheel_now(void) {
+  uint32_t ms = (system_get_time() - wheel.last_us) / 1000;
+  wheel.last_us += ms * 1000;
+  wheel.now_ms += ms;
+  return wheel.now_ms;
+}
+
+static void wheel_link(tmr_t **head, tmr_t *tmr) {
+  tmr->pprev = head;
+  tmr->next = *head;
+  if (tmr->next)
+    tmr->next->pprev = &tmr->next;
+  *head = tmr;
+}
+
+/* Put a timer into the slot matching its expiry relative to the wheel tick */
+static void wheel_place(tmr_t *tmr) {
+  uint32_t delta = tmr->expires - wheel.tick;
+  unsigned level = 0, idx;
+
+  if ((int32_t) delta < 0) {   /* already due: process on the next tick */
+    idx = wheel.tick & WHEEL_MASK;
+  } else {
+    while (level < WHEEL_LEVELS-1 && delta >= (1u << (WHEEL_BITS*(level+1))))
+      level++;
+    idx = (tmr->expires >> (WHEEL_BITS*level)) & WHEEL_MASK;
+  }
+  wheel_link(&wheel.slot[level][idx], tmr);
+  wheel.bitmap[level] |= BIT(idx);
+}
+
+static void wheel_del(tmr_t *tmr) {
+  tmr_t **first = &wheel.slot[0][0];
+  if (!tmr->pprev)
+    return;
+  *tmr->pprev = tmr->next;
+  if (tmr->next) {
+    tmr->next->pprev = tmr->pprev;
+  } else if (wheel.due_tail == &tmr->next) {
+    wheel.due_tail = tmr->pprev;
+  } else if (tmr->pprev >= first && tmr->pprev < first + WHEEL_LEVELS*WHEEL_SIZE) {
+    unsigned n = tmr->pprev - first;  /* the slot is now empty */
+    wheel.bitmap[n / WHEEL_SIZE] &= ~BIT(n % WHEEL_SIZE);
+  }
+  tmr->pprev = NULL;
+  if (--wheel.count == 0)
+    os_timer_disarm(&wheel.os);
+}
+
+/* Empty a slot, moving its timers onto the due list or down to lower levels */
+static void wheel_expire(unsigned level, unsigned idx) {
+  tmr_t *tmr = wheel.slot[level][idx];
+  wheel.slot[level][idx] = NULL;
+  wheel.bitmap[level] &= ~BIT(idx);
+  while (tmr) {
+    tmr_t *next = tmr->next;
+    if (level == 0) {
+      tmr->next = NULL;
+      tmr->pprev = wheel.due_tail;
+      *wheel.due_tail = tmr;
+      wheel.due_tail = &tmr->next;
+    } else {
+      wheel_place(tmr);
+    }
+    tmr = next;
+  }
+}
+
+static void wheel_cascade(unsigned level) {
+  unsigned idx = (wheel.tick >> (WHEEL_BITS*level)) & WHEEL_MASK;
+  if (idx == 0 && level < WHEEL_LEVELS-1)
+    wheel_cascade(level + 1);
+  wheel_expire(level, idx);
+}
+
+/* Return the index of the first occupied slot at or after 'from', cyclically */
+static unsigned wheel_next_slot(uint32_t bits, unsigned from) {
+  uint32_t rot = from ? (bits >> from) | (bits << (WHEEL_SIZE - from)) : bits;
+  return __builtin_ctz(rot);
+}
+
+/*
+** Return the next tick at which a slot of any level needs processing.  A slot
+** in level L is processed when the tick reaches a multiple of 2^(WHEEL_BITS*L)
+** with that slot's index, so if the tick is not on such a boundary the current
+** slot has already been done and the search starts from the next one.
+*/
+static uint32_t wheel_next(void) {
+  uint32_t best = WHEEL_MAX_WAIT;
+  unsigned level;
+
+  for (level = 0; level < WHEEL_LEVELS; level++) {
+    unsigned shift = WHEEL_BITS*level;
+    unsigned idx = (wheel.tick >> shift) & WHEEL_MASK;
+    uint32_t start = wheel.tick & ~((1u << shift) - 1), delta;
+    if (!wheel.bitmap[level])
+      continue;
+    if (start != wheel.tick) {
+      start += 1u << shift;
+      idx = (idx + 1) & WHEEL_MASK;
+    }
+    delta = (start - wheel.tick) + (wheel_next_slot(wheel.bitmap[level], idx) << shift);
+    if (delta < best)
+      best = delta;
+  }
+  return wheel.tick + best;
+}
+
+/* Process all ticks up to and including 'to', collecting expired timers */
+static void wheel_advance(uint32_t to) {
+  for (;;) {
+    uint32_t next = wheel_next();
+    if ((int32_t) (next - to) > 0) {
+      wheel.tick = to + 1;
+      return;
+    }
+    wheel.tick = next;
+    if ((next & WHEEL_MASK) == 0)
+      wheel_cascade(1);
+    wheel_expire(0, next & WHEEL_MASK);
+    wheel.tick++;
+  }
+}
+
+/*
+** Arm the SDK timer for the next tick with work.  This is rounded up to a
+** multiple of the tolerance so that expirations within the same window are
+** dispatched together.
+*/
+static void wheel_rearm(uint32_t now) {
+  uint32_t next = wheel.due ? now : wheel_next();
+  int32_t wait;
+
+  os_timer_disarm(&wheel.os);
+  if (!wheel.count)
+    return;
+  if (wheel.tolerance > 1)
+    next += (wheel.tolerance - next % wheel.tolerance) % wheel.tolerance;
+  wait = next - now;
+  os_timer_arm(&wheel.os, wait < 1 ? 1 : wait > WHEEL_MAX_WAIT ? WHEEL_MAX_WAIT : wait, 0);
+}
+
+static void wheel_tick(void *arg) {
+  uint32_t now = wheel_now();
+  tmr_t *tmr;
+
+  wheel_advance(now);
+  if (wheel.due)
+    wheel.batches++;
+  /* Callbacks can stop or start any timer, including ones still on the due list */
+  while ((tmr = wheel.due) != NULL) {
+    uint32_t late;
+    now = wheel_now();
+    late = now - tmr->expires;
+    wheel_del(tmr);
+    wheel.fired++;
+    if ((int32_t) late > 0) {
+      if (late > wheel.max_late)
+        wheel.max_late = late;
+      if (late >= wheel.tolerance)
+        wheel.late++;
+    }
+    if (tmr->mode == TIMER_MODE_AUTO) {
+      tmr->expires += tmr->interval;
+      if ((int32_t) (tmr->expires - now) <= 0)
+        tmr->expires = now + tmr->interval;  /* overran: resynchronise */
+      wheel_place(tmr);
+      wheel.count++;
+    }
+    alarm_timer_common(tmr);
+  }
+  wheel_rearm(wheel_now());
+}
+
+static void timer_arm(tmr_t *tmr) {
+  uint32_t now;
+  if (!wheel.count) {   /* the wheel is empty, so resynchronise it to now */
+    wheel.last_us = system_get_time();
+    wheel.tick = wheel.now_ms;
+  }
+  now = wheel_now();
+  wheel_advance(now);
+  tmr->expires = now + tmr->interval;
+  wheel_place(tmr);
+  wheel.count++;
+  wheel_rearm(now);
+}
+
+#define timer_disarm(tmr) wheel_del(tmr)
+
+#else
+
+static void timer_arm(tmr_t *tmr) {
+  os_timer_arm(&tmr->os, tmr->interval, tmr->mode==TIMER_MODE_AUTO);
+}
+
+#define timer_disarm(tmr) os_timer_disarm(&(tmr)->os)
+#endif
+
 // Lua: tmr.delay( us )
 static int tmr_delay( lua_State* L ){
   sint32_t us = luaL_checkinteger(L, 1);
@@ -117,11 +356,13 @@ static int tmr_register(lua_State* L) {
   //get the lua function reference
   lua_pushvalue(L, 4);
   if(!(tmr->mode & TIMER_IDLE_FLAG) && tmr->mode != TIMER_MODE_OFF)
-    os_timer_disarm(&tmr->os);
+    timer_disarm(tmr);
   luaL_reref(L, LUA_REGISTRYINDEX, &tmr->lua_ref);
   tmr->mode = mode|TIMER_IDLE_FLAG;
   tmr->interval = interval;
+#ifndef TMR_WHEEL
   os_timer_setfn(&tmr->os, alarm_timer_common, tmr);
+#endif
   return 0;
 }
 
@@ -141,9 +382,9 @@ static int tmr_start(lua_State* L){
   if(!(idle || restart)){
     lua_pushboolean(L, false);
   }else{
-    if (!idle) {os_timer_disarm(&tmr->os);}
+    if (!idle) {timer_disarm(tmr);}
     tmr->mode &= ~TIMER_IDLE_FLAG;
-    os_timer_arm(&tmr->os, tmr->interval, tmr->mode==TIMER_MODE_AUTO);
+    timer_arm(tmr);
     lua_pushboolean(L, true);
   }
   return 1;
@@ -165,7 +406,7 @@ static int tmr_stop(lua_State* L){
   luaL_unref2(L, LUA_REGISTRYINDEX, tmr->self_ref);
 
   if(!idle)
-    os_timer_disarm(&tmr->os);
+    timer_disarm(tmr);
   tmr->mode |= TIMER_IDLE_FLAG;
   lua_pushboolean(L, !idle);  /* return false if the timer is idle (or not registered) */
   return 1;
@@ -189,7 +430,7 @@ static int tmr_unregister(lua_State* L){
   luaL_unref2(L, LUA_REGISTRYINDEX, tmr->self_ref);
   luaL_unref2(L, LUA_REGISTRYINDEX, tmr->lua_ref);
   if(!(tmr->mode & TIMER_IDLE_FLAG) && tmr->mode != TIMER_MODE_OFF)
-    os_timer_disarm(&tmr->os);
+    timer_disarm(tmr);
   tmr->mode = TIMER_MODE_OFF;
   return 0;
 }
@@ -202,8 +443,8 @@ static int tmr_interval(lua_State* L){
   if(tmr->mode != TIMER_MODE_OFF){
     tmr->interval = interval;
     if(!(tmr->mode&TIMER_IDLE_FLAG)){
-      os_timer_disarm(&tmr->os);
-      os_timer_arm(&tmr->os, tmr->interval, tmr->mode==TIMER_MODE_AUTO);
+      timer_disarm(tmr);
+      timer_arm(tmr);
     }
   }
   return 0;
@@ -283,10 +524,38 @@ static int tmr_create( lua_State *L ) {
   tmr_t *ud = (tmr_t *)lua_newuserdata(L, sizeof(*ud));
   luaL_getmetatable(L, "tmr.timer");
   lua_setmetatable(L, -2);
-  *ud = (tmr_t) {{0}, LUA_NOREF, LUA_NOREF, 0, TIMER_MODE_OFF};
+  memset(ud, 0, sizeof(*ud));
+  ud->lua_ref = ud->self_ref = LUA_NOREF;
+  ud->mode = TIMER_MODE_OFF;
   return 1;
 }
 
+#ifdef TMR_WHEEL
+// Lua: tmr.wheel([tolerance]), returns the timing wheel statistics
+static int tmr_wheel( lua_State *L ) {
+  if (!lua_isnoneornil(L, 1)) {
+    lua_Integer tolerance = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, tolerance > 0 && tolerance <= 1000, 1, "Range: 1-1000");
+    wheel.tolerance = tolerance;
+    wheel_rearm(wheel_now());
+  }
+  lua_createtable(L, 0, 6);
+  lua_pushinteger(L, wheel.count);
+  lua_setfield(L, -2, "timers");
+  lua_pushinteger(L, wheel.fired);
+  lua_setfield(L, -2, "fired");
+  lua_pushinteger(L, wheel.batches);
+  lua_setfield(L, -2, "batches");
+  lua_pushinteger(L, wheel.late);
+  lua_setfield(L, -2, "late");
+  lua_pushinteger(L, wheel.max_late);
+  lua_setfield(L, -2, "max_late");
+  lua_pushinteger(L, wheel.tolerance);
+  lua_setfield(L, -2, "tolerance");
+  return 1;
+}
+#endif
+
 
 // Module function map
 
@@ -319,6 +588,9 @@ LROT_BEGIN(tmr, NULL, 0)
   LROT_FUNCENTRY( resume_all, tmr_resume_all )
 #endif
   LROT_FUNCENTRY( create, tmr_create )
+#ifdef TMR_WHEEL
+  LROT_FUNCENTRY( wheel, tmr_wheel )
+#endif
   LROT_NUMENTRY( ALARM_SINGLE, TIMER_MODE_SINGLE )
   LROT_NUMENTRY( ALARM_SEMI, TIMER_MODE_SEMI )
   LROT_NUMENTRY( ALARM_AUTO, TIMER_MODE_AUTO )
@@ -341,9 +613,16 @@ int luaopen_tmr( lua_State *L ){
   // there is bound to be some drift in the clock, so a calibration is due.
   SWTIMER_REG_CB(rtc_callback, SWTIMER_RESUME);
 
+#ifdef TMR_WHEEL
+  wheel.due_tail = &wheel.due;
+  wheel.tolerance = TMR_WHEEL_TOLERANCE;
+  os_timer_setfn(&wheel.os, wheel_tick, NULL);
+  SWTIMER_REG_CB(wheel_tick, SWTIMER_RESUME);
+#else
   // The function alarm_timer_common handles timers created by the developer via
   // tmr.create().  No reason not to resume the timers, so resume em'.
   SWTIMER_REG_CB(alarm_timer_common, SWTIMER_RESUME);
+#endif
 
   return 0;
 }
@@ -10,6 +10,7 @@
 #include "driver/input.h"
 
 static int uart_receive_rf = LUA_NOREF;
+static int uart_highwater_rf = LUA_NOREF;
 
 void uart_on_data_cb(const char *buf, size_t len){
   lua_State *L = lua_getstate();
@@ -18,6 +19,58 @@ void uart_on_data_cb(const char *buf, size_t len){
   luaL_pcallx(L, 1, 0);
 }
 
+static void uart_on_highwater_cb(size_t fill){
+  lua_State *L = lua_getstate();
+  lua_rawgeti(L, LUA_REGISTRYINDEX, uart_highwater_rf);
+  lua_pushinteger(L, fill);
+  luaL_pcallx(L, 1, 0);
+}
+
+// Lua: uart.on("frame", mode, param, function)
+static int uart_on_frame( lua_State* L )
+{
+  int mode = luaL_optinteger( L, 2, INPUT_FRAME_NONE );
+  int param = luaL_optinteger( L, 3, 0 );
+
+  if (!lua_isfunction(L, 4)) {
+    luaL_unref(L, LUA_REGISTRYINDEX, uart_receive_rf);
+    uart_receive_rf = LUA_NOREF;
+    input_setup_receive(NULL, 0, 0, 1);
+    return 0;
+  }
+  // check the args before the callback in use is dropped
+  if (mode == INPUT_FRAME_IDLE)
+    luaL_argcheck(L, param >= 1 && param <= 127, 3, "wrong arg range");
+  else if (mode == INPUT_FRAME_LENGTH)
+    luaL_argcheck(L, param >= 1 && param <= 2, 3, "wrong arg range");
+  else
+    return luaL_argerror(L, 2, "wrong arg range");
+
+  luaL_unref(L, LUA_REGISTRYINDEX, uart_receive_rf);
+  lua_pushvalue(L, 4);
+  uart_receive_rf = luaL_ref(L, LUA_REGISTRYINDEX);
+  input_setup_frame(uart_on_data_cb, mode, param);
+  return 0;
+}
+
+// Lua: uart.on("highwater", level, function)
+static int uart_on_highwater( lua_State* L )
+{
+  if (lua_isfunction(L, 3)) {
+    int level = luaL_checkinteger( L, 2 );
+    luaL_argcheck(L, level > 0, 2, "wrong arg range");
+    luaL_unref(L, LUA_REGISTRYINDEX, uart_highwater_rf);
+    lua_pushvalue(L, 3);
+    uart_highwater_rf = luaL_ref(L, LUA_REGISTRYINDEX);
+    input_setup_highwater(uart_on_highwater_cb, level);
+  } else {
+    luaL_unref(L, LUA_REGISTRYINDEX, uart_highwater_rf);
+    uart_highwater_rf = LUA_NOREF;
+    input_setup_highwater(NULL, 0);
+  }
+  return 0;
+}
+
 // Lua: uart.on("method", [number/char], function, [run_input])
 static int l_uart_on( lua_State* L )
 {
@@ -26,6 +79,10 @@ static int l_uart_on( lua_State* L )
   char end_char = 0;
   const char *method = lua_tostring( L, 1);
   bool run_input = true;
+  if (method && !strcmp(method, "frame"))
+    return uart_on_frame(L);
+  if (method && !strcmp(method, "highwater"))
+    return uart_on_highwater(L);
   luaL_argcheck(L, method && !strcmp(method, "data"), 1, "method not supported");
 
   if (lua_type( L, stack ) == LUA_TNUMBER) {
@@ -142,6 +199,45 @@ static int l_uart_write( lua_State* L )
   return 0;
 }
 
+// Lua: uart.rxbuffer(size[, framesize])
+static int l_uart_rxbuffer( lua_State* L )
+{
+  int size = luaL_checkinteger( L, 1 );
+  int framesize = luaL_optinteger( L, 2, 0 );
+  luaL_argcheck(L, size >= RX_BUFF_SIZE, 1, "wrong arg range");
+  luaL_argcheck(L, framesize >= 0, 2, "wrong arg range");
+
+  if (!uart0_rx_buffer(size) || !input_setup_framelen(framesize))
+    return luaL_error( L, "out of memory" );
+  return 0;
+}
+
+// Lua: stats = uart.rxstats([reset])
+static int l_uart_rxstats( lua_State* L )
+{
+  UartRxStats *stats = uart0_rx_stats();
+
+  lua_createtable(L, 0, 7);
+  lua_pushinteger(L, uart0_rx_count());
+  lua_setfield(L, -2, "pending");
+  lua_pushinteger(L, stats->overrun);
+  lua_setfield(L, -2, "overrun");
+  lua_pushinteger(L, stats->fifo_overflow);
+  lua_setfield(L, -2, "fifo_overflow");
+  lua_pushinteger(L, stats->frame_error);
+  lua_setfield(L, -2, "frame_error");
+  lua_pushinteger(L, stats->parity_error);
+  lua_setfield(L, -2, "parity_error");
+  lua_pushinteger(L, stats->oversize);
+  lua_setfield(L, -2, "oversize");
+  lua_pushinteger(L, stats->frame_overflow);
+  lua_setfield(L, -2, "frame_overflow");
+
+  if (lua_toboolean(L, 1))
+    memset(stats, 0, sizeof(*stats));
+  return 1;
+}
+
 #define DIR_RX 0
 #define DIR_TX 1
 
@@ -171,6 +267,8 @@ LROT_BEGIN(uart, NULL, 0)
   LROT_FUNCENTRY( on, l_uart_on )
   LROT_FUNCENTRY( alt, l_uart_alt )
   LROT_FUNCENTRY( fifodepth, l_uart_fifodepth )
+  LROT_FUNCENTRY( rxbuffer, l_uart_rxbuffer )
+  LROT_FUNCENTRY( rxstats, l_uart_rxstats )
 
   LROT_NUMENTRY( STOPBITS_1, PLATFORM_UART_STOPBITS_1 )
   LROT_NUMENTRY( STOPBITS_1_5, PLATFORM_UART_STOPBITS_1_5 )
@@ -181,6 +279,8 @@ LROT_BEGIN(uart, NULL, 0)
 
   LROT_NUMENTRY( DIR_RX, DIR_RX )
   LROT_NUMENTRY( DIR_TX, DIR_TX )
+  LROT_NUMENTRY( FRAME_IDLE, INPUT_FRAME_IDLE )
+  LROT_NUMENTRY( FRAME_LENGTH, INPUT_FRAME_LENGTH )
 LROT_END(uart, NULL, 0)
 
 
@@ -3,7 +3,7 @@
 // Example usage:
 // ws = websocket.createClient()
 // ws:on("connection", function() ws:send('hi') end)
-// ws:on("receive", function(_, data, opcode) print(data) end)
+// ws:on("receive", function(_, data, opcode, last) print(data) end)
 // ws:on("close", function(_, reasonCode) print('ws closed', reasonCode) end)
 // ws:connect('ws://echo.websocket.org')
 
@@ -45,7 +45,7 @@ static void websocketclient_onConnectionCallback(ws_info *ws) {
   }
 }
 
-static void websocketclient_onReceiveCallback(ws_info *ws, int len, char *message, int opCode) {
+static void websocketclient_onReceiveCallback(ws_info *ws, int len, char *message, int opCode, int isLast) {
   NODE_DBG("websocketclient_onReceiveCallback\n");
 
   lua_State *L = lua_getstate();
@@ -61,7 +61,8 @@ static void websocketclient_onReceiveCallback(ws_info *ws, int len, char *messag
     lua_rawgeti(L, LUA_REGISTRYINDEX, data->self_ref);  // pass itself, #1 callback argument
     lua_pushlstring(L, message, len); // #2 callback argument
     lua_pushinteger(L, opCode); // #3 callback argument
-    luaL_pcallx(L, 3, 0);
+    lua_pushboolean(L, isLast); // #4 callback argument
+    luaL_pcallx(L, 4, 0);
   }
 }
 
@@ -103,6 +104,8 @@ static int websocket_createClient(lua_State *L) {
   ws_info *ws = (ws_info *) lua_newuserdata(L, sizeof(ws_info));
   ws->connectionState = 0;
   ws->extraHeaders = NULL;
+  ws->chunkSize = 0;
+  ws->maxMessageSize = 0;
   ws->onConnection = &websocketclient_onConnectionCallback;
   ws->onReceive = &websocketclient_onReceiveCallback;
   ws->onFailure = &websocketclient_onCloseCallback;
@@ -233,6 +236,22 @@ static int websocketclient_config(lua_State *L) {
   }
   lua_pop(L, 1); // pop headers
 
+  lua_getfield(L, 2, "chunksize");
+  if (!lua_isnil(L, -1)) {
+    int chunkSize = luaL_checkinteger(L, -1);
+    luaL_argcheck(L, chunkSize >= 0, 2, "invalid chunksize");
+    ws->chunkSize = chunkSize;
+  }
+  lua_pop(L, 1); // pop chunksize
+
+  lua_getfield(L, 2, "maxsize");
+  if (!lua_isnil(L, -1)) {
+    int maxSize = luaL_checkinteger(L, -1);
+    luaL_argcheck(L, maxSize >= 0, 2, "invalid maxsize");
+    ws->maxMessageSize = maxSize;
+  }
+  lua_pop(L, 1); // pop maxsize
+
   return 0;
 }
 
@@ -0,0 +1,209 @@
+// Module for streaming Deflate / Zlib / Gzip compression and decompression
+
+#include "module.h"
+#include "lauxlib.h"
+#include <stdint.h>
+#include <string.h>
+#include "../uzlib/uzlib.h"
+
+#define ZLIB_INFLATE_WINDOW 16384  // the window used by luac.cross for LFS images
+#define ZLIB_DEFLATE_WINDOW 2048
+
+typedef struct {
+  void *stream;     // UZLIB_STREAM or UZLIB_DSTREAM, NULL once closed
+  int cb_ref;       // output callback, or LUA_NOREF to return the output
+  int busy;         // in uzlib, so the callback mustn't use the stream
+} zlib_ud_t;
+
+typedef struct {
+  lua_State *L;
+  luaL_Buffer b;
+  int cb_ref;
+  int failed;       // the callback raised an error, left on the stack
+} zlib_out_t;
+
+// The callback is called in the middle of uzlib, so an error in it must not
+// unwind through uzlib; it is raised once uzlib has returned instead
+static void zlib_out(void *arg, const uint8_t *data, uint32_t len) {
+  zlib_out_t *o = (zlib_out_t *) arg;
+  if (o->cb_ref == LUA_NOREF) {
+    luaL_addlstring(&o->b, (const char *) data, len);
+  } else if (!o->failed) {
+    lua_rawgeti(o->L, LUA_REGISTRYINDEX, o->cb_ref);
+    lua_pushlstring(o->L, (const char *) data, len);
+    o->failed = lua_pcall(o->L, 1, 0, 0) != 0;
+  }
+}
+
+static void zlib_out_begin(lua_State *L, zlib_out_t *o, zlib_ud_t *ud) {
+  o->L = L;
+  o->cb_ref = ud->cb_ref;
+  o->failed = 0;
+  if (o->cb_ref == LUA_NOREF)
+    luaL_buffinit(L, &o->b);
+  ud->busy = 1;
+}
+
+// Pushes the output collected, or nil if it was passed to the callback
+static void zlib_out_end(zlib_out_t *o) {
+  if (o->failed)
+    lua_error(o->L);
+  if (o->cb_ref == LUA_NOREF)
+    luaL_pushresult(&o->b);
+  else
+    lua_pushnil(o->L);
+}
+
+static int zlib_error(lua_State *L, int res) {
+  switch (res) {
+    case UZLIB_DICT_ERROR:   return luaL_error(L, "window too small");
+    case UZLIB_CHKSUM_ERROR: return luaL_error(L, "checksum mismatch");
+    case UZLIB_MEMORY_ERROR: return luaL_error(L, "out of memory");
+    default:                 return luaL_error(L, "corrupt stream");
+  }
+}
+
+// Lua: zlib.inflate([window[, format[, callback]]]) and likewise zlib.deflate
+static int zlib_create(lua_State *L, const char *mt, int inflate) {
+  uint32_t window = luaL_optinteger(L, 1, inflate ? ZLIB_INFLATE_WINDOW : ZLIB_DEFLATE_WINDOW);
+  int format = luaL_optinteger(L, 2, UZLIB_FORMAT_AUTO);
+
+  luaL_argcheck(L, window >= UZLIB_WINDOW_MIN && window <= UZLIB_WINDOW_MAX &&
+                   (window & (window - 1)) == 0, 1, "invalid window");
+  luaL_argcheck(L, format >= UZLIB_FORMAT_AUTO && format <= UZLIB_FORMAT_GZIP, 2, "invalid format");
+  if (!lua_isnoneornil(L, 3))
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+
+  zlib_ud_t *ud = (zlib_ud_t *) lua_newuserdata(L, sizeof(*ud));
+  ud->stream = NULL;
+  ud->cb_ref = LUA_NOREF;
+  ud->busy = 0;
+  luaL_getmetatable(L, mt);
+  lua_setmetatable(L, -2);
+
+  ud->stream = inflate ? (void *) uzlib_inflate_init(window, format) :
+                         (void *) uzlib_deflate_init(window, format);
+  if (!ud->stream)
+    return luaL_error(L, "out of memory");
+  if (!lua_isnoneornil(L, 3)) {
+    lua_pushvalue(L, 3);
+    ud->cb_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  }
+  return 1;
+}
+
+static int zlib_inflate(lua_State *L) {
+  return zlib_create(L, "zlib.inflate", 1);
+}
+
+static int zlib_deflate(lua_State *L) {
+  return zlib_create(L, "zlib.deflate", 0);
+}
+
+static zlib_ud_t *zlib_check(lua_State *L, const char *mt) {
+  zlib_ud_t *ud = (zlib_ud_t *) luaL_checkudata(L, 1, mt);
+  if (!ud->stream)
+    luaL_error(L, "stream closed");
+  if (ud->busy)
+    luaL_error(L, "stream busy");
+  return ud;
+}
+
+// Lua: out, done = inflate:write(data)
+static int zlib_inflate_write(lua_State *L) {
+  zlib_ud_t *ud = zlib_check(L, "zlib.inflate");
+  size_t len;
+  const char *data = luaL_checklstring(L, 2, &len);
+  zlib_out_t o;
+  int res;
+
+  zlib_out_begin(L, &o, ud);
+  res = uzlib_inflate_write(ud->stream, (const uint8_t *) data, len, zlib_out, &o);
+  ud->busy = 0;
+  if (res != UZLIB_OK && res != UZLIB_DONE)
+    return zlib_error(L, res);
+  zlib_out_end(&o);
+  lua_pushboolean(L, res == UZLIB_DONE);
+  return 2;
+}
+
+// Lua: out = deflate:write(data) and out = deflate:finish([data])
+static int zlib_deflate_common(lua_State *L, int finish) {
+  zlib_ud_t *ud = zlib_check(L, "zlib.deflate");
+  size_t len = 0;
+  const char *data = finish ? luaL_optlstring(L, 2, "", &len) : luaL_checklstring(L, 2, &len);
+  zlib_out_t o;
+  int res;
+
+  zlib_out_begin(L, &o, ud);
+  res = uzlib_deflate_write(ud->stream, (const uint8_t *) data, len, finish, zlib_out, &o);
+  ud->busy = 0;
+  if (res == UZLIB_DONE && !finish)
+    return luaL_error(L, "stream finished");
+  zlib_out_end(&o);
+  return 1;
+}
+
+static int zlib_deflate_write(lua_State *L) {
+  return zlib_deflate_common(L, 0);
+}
+
+static int zlib_deflate_finish(lua_State *L) {
+  return zlib_deflate_common(L, 1);
+}
+
+// Lua: stream:close(), also the __gc
+static int zlib_close_common(lua_State *L, int inflate) {
+  zlib_ud_t *ud = (zlib_ud_t *) luaL_checkudata(L, 1, inflate ? "zlib.inflate" : "zlib.deflate");
+  if (ud->busy)
+    return luaL_error(L, "stream busy");
+  if (inflate)
+    uzlib_inflate_end(ud->stream);
+  else
+    uzlib_deflate_end(ud->stream);
+  ud->stream = NULL;
+  luaL_unref(L, LUA_REGISTRYINDEX, ud->cb_ref);
+  ud->cb_ref = LUA_NOREF;
+  return 0;
+}
+
+static int zlib_inflate_close(lua_State *L) {
+  return zlib_close_common(L, 1);
+}
+
+static int zlib_deflate_close(lua_State *L) {
+  return zlib_close_common(L, 0);
+}
+
+
+LROT_BEGIN(zlib_inflate, NULL, LROT_MASK_GC_INDEX)
+  LROT_FUNCENTRY( __gc, zlib_inflate_close )
+  LROT_TABENTRY(  __index, zlib_inflate )
+  LROT_FUNCENTRY( write, zlib_inflate_write )
+  LROT_FUNCENTRY( close, zlib_inflate_close )
+LROT_END(zlib_inflate, NULL, LROT_MASK_GC_INDEX)
+
+LROT_BEGIN(zlib_deflate, NULL, LROT_MASK_GC_INDEX)
+  LROT_FUNCENTRY( __gc, zlib_deflate_close )
+  LROT_TABENTRY(  __index, zlib_deflate )
+  LROT_FUNCENTRY( write, zlib_deflate_write )
+  LROT_FUNCENTRY( finish, zlib_deflate_finish )
+  LROT_FUNCENTRY( close, zlib_deflate_close )
+LROT_END(zlib_deflate, NULL, LROT_MASK_GC_INDEX)
+
+LROT_BEGIN(zlib, NULL, 0)
+  LROT_FUNCENTRY( inflate, zlib_inflate )
+  LROT_FUNCENTRY( deflate, zlib_deflate )
+  LROT_NUMENTRY( AUTO, UZLIB_FORMAT_AUTO )
+  LROT_NUMENTRY( RAW, UZLIB_FORMAT_RAW )
+  LROT_NUMENTRY( ZLIB, UZLIB_FORMAT_ZLIB )
+  LROT_NUMENTRY( GZIP, UZLIB_FORMAT_GZIP )
+LROT_END(zlib, NULL, 0)
+
+int luaopen_zlib(lua_State *L) {
+  luaL_rometatable(L, "zlib.inflate", LROT_TABLEREF(zlib_inflate));
+  luaL_rometatable(L, "zlib.deflate", LROT_TABLEREF(zlib_deflate));
+  return 0;
+}
+
+NODEMCU_MODULE(ZLIB, "zlib", zlib, luaopen_zlib);
@@ -117,6 +117,7 @@ static inline uint8_t mqtt_get_dup(uint8_t* buffer) { return (buffer[0] & 0x08)
 static inline uint8_t mqtt_get_qos(uint8_t* buffer) { return (buffer[0] & 0x06) >> 1; }
 static inline uint8_t mqtt_get_retain(uint8_t* buffer) { return (buffer[0] & 0x01); }
 static inline uint8_t mqtt_get_connect_ret_code(uint8_t* buffer) { return (buffer[3]); }
+static inline void mqtt_set_dup(uint8_t* buffer) { buffer[0] |= 0x08; }
 
 void mqtt_msg_init(mqtt_message_buffer_t* msgb, uint8_t* buffer, uint16_t buffer_length);
 int32_t mqtt_get_total_length(uint8_t* buffer, uint16_t buffer_length);
@@ -83,3 +83,42 @@ int msg_size(msg_queue_t **head){
   }
   return i;
 }
+
+uint32_t msg_bytes(msg_queue_t **head){
+  uint32_t bytes = 0;
+  if(!head){
+    return 0;
+  }
+  msg_queue_t *node;
+  for(node = *head; node; node = node->next){
+    bytes += node->msg.length;
+  }
+  return bytes;
+}
+
+void msg_append(msg_queue_t **head, msg_queue_t *node){
+  if(!head || !node){
+    return;
+  }
+  node->next = NULL;
+  while(*head){
+    head = &(*head)->next;
+  }
+  *head = node;
+}
+
+// Remove and return the first node with the given id and type, if any.
+msg_queue_t * msg_unlink(msg_queue_t **head, uint16_t msg_id, int msg_type){
+  if(!head){
+    return NULL;
+  }
+  for(; *head; head = &(*head)->next){
+    msg_queue_t *node = *head;
+    if(node->msg_id == msg_id && node->msg_type == msg_type){
+      *head = node->next;
+      node->next = NULL;
+      return node;
+    }
+  }
+  return NULL;
+}
@@ -15,6 +15,7 @@ typedef struct msg_queue_t {
   int publish_qos;
 
   bool sent;
+  bool spooled;   // replayed from the offline spool
 } msg_queue_t;
 
 msg_queue_t * msg_enqueue(msg_queue_t **head, mqtt_message_t *msg, uint16_t msg_id, int msg_type, int publish_qos);
@@ -22,6 +23,9 @@ void msg_destroy(msg_queue_t *node);
 msg_queue_t * msg_dequeue(msg_queue_t **head);
 msg_queue_t * msg_peek(msg_queue_t **head);
 int msg_size(msg_queue_t **head);
+uint32_t msg_bytes(msg_queue_t **head);
+void msg_append(msg_queue_t **head, msg_queue_t *node);
+msg_queue_t * msg_unlink(msg_queue_t **head, uint16_t msg_id, int msg_type);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,173 @@
+#include <string.h>
+#include <stdlib.h>
+#include "topic_trie.h"
+#include "user_config.h"
+
+#define is_level(n,c) ((n)->len == 1 && (n)->level[0] == (c))
+
+/* Return the end of the level starting at s; this is either a '/' or end */
+static const char *level_end(const char *s, const char *end) {
+  const char *sep = memchr(s, '/', end - s);
+  return sep ? sep : end;
+}
+
+/*
+ * A filter is valid if it is non-empty, '+' and '#' only occupy a whole
+ * level and '#' is the last level.
+ */
+bool topic_filter_valid(const char *filter, size_t len) {
+  const char *s = filter, *end = filter + len;
+  if (len == 0)
+    return false;
+  for (;;) {
+    const char *e = level_end(s, end);
+    size_t l = e - s;
+    if (l > 1 && (memchr(s, '+', l) || memchr(s, '#', l)))
+      return false;
+    if (l == 1 && *s == '#' && e != end)
+      return false;
+    if (e == end)
+      return true;
+    s = e + 1;
+  }
+}
+
+/*
+ * Add filter to the trie, creating any missing levels, and set its handler
+ * ref.  Any handler previously registered for the same filter is returned in
+ * old_ref so that the caller can release it.  Returns 0 on success, or -1 if
+ * the filter is invalid or memory is exhausted.
+ */
+int topic_trie_insert(topic_node_t **root, const char *filter, size_t len, int ref, int *old_ref) {
+  const char *s = filter, *end = filter + len;
+  topic_node_t **link = root, *n = NULL;
+
+  if (!topic_filter_valid(filter, len))
+    return -1;
+
+  for (;;) {
+    const char *e = level_end(s, end);
+    size_t l = e - s;
+    for (n = *link; n; n = n->next) {
+      if (n->len == l && memcmp(n->level, s, l) == 0)
+        break;
+    }
+    if (!n) {
+      n = (topic_node_t *)malloc(sizeof(topic_node_t) + l);
+      if (!n) {
+        NODE_DBG("not enough memory\n");
+        return -1;
+      }
+      n->child = NULL;
+      n->ref = TOPIC_NOREF;
+      n->len = l;
+      memcpy(n->level, s, l);
+      n->next = *link;
+      *link = n;
+    }
+    if (e == end)
+      break;
+    link = &n->child;
+    s = e + 1;
+  }
+  if (old_ref)
+    *old_ref = n->ref;
+  n->ref = ref;
+  return 0;
+}
+
+static int trie_remove(topic_node_t **link, const char *s, const char *end) {
+  const char *e = level_end(s, end);
+  size_t l = e - s;
+  topic_node_t *n;
+  int ref;
+
+  for (; (n = *link) != NULL; link = &n->next) {
+    if (n->len == l && memcmp(n->level, s, l) == 0)
+      break;
+  }
+  if (!n)
+    return TOPIC_NOREF;
+  if (e == end) {
+    ref = n->ref;
+    n->ref = TOPIC_NOREF;
+  } else {
+    ref = trie_remove(&n->child, e + 1, end);
+  }
+  /* Prune any level that no longer leads to a handler */
+  if (n->ref == TOPIC_NOREF && !n->child) {
+    *link = n->next;
+    free(n);
+  }
+  return ref;
+}
+
+/*
+ * Remove the handler for an exact filter, returning its ref or TOPIC_NOREF if
+ * there was none.
+ */
+int topic_trie_remove(topic_node_t **root, const char *filter, size_t len) {
+  return trie_remove(root, filter, filter + len);
+}
+
+static int trie_match(topic_node_t *n, const char *s, const char *end,
+                      bool wild, topic_visit_fn fn, void *arg) {
+  const char *e = level_end(s, end);
+  size_t l = e - s;
+  int count = 0;
+
+  for (; n; n = n->next) {
+    if (is_level(n, '#')) {
+      if (wild && n->ref != TOPIC_NOREF) {
+        fn(n->ref, arg);
+        count++;
+      }
+      continue;
+    }
+    if (!(wild && is_level(n, '+')) &&
+        !(n->len == l && memcmp(n->level, s, l) == 0))
+      continue;
+    if (e == end) {
+      topic_node_t *c;
+      if (n->ref != TOPIC_NOREF) {
+        fn(n->ref, arg);
+        count++;
+      }
+      /* "a/#" also matches the parent level "a" */
+      for (c = n->child; c; c = c->next) {
+        if (is_level(c, '#') && c->ref != TOPIC_NOREF) {
+          fn(c->ref, arg);
+          count++;
+        }
+      }
+    } else if (n->child) {
+      count += trie_match(n->child, e + 1, end, true, fn, arg);
+    }
+  }
+  return count;
+}
+
+/*
+ * Call fn for the handler of every filter that matches topic, returning the
+ * number of matches.  As per the MQTT spec, topics starting with '$' are not
+ * matched by a wildcard in the first level.
+ */
+int topic_trie_match(topic_node_t *root, const char *topic, size_t len, topic_visit_fn fn, void *arg) {
+  if (!root || len == 0)
+    return 0;
+  return trie_match(root, topic, topic + len, topic[0] != '$', fn, arg);
+}
+
+/* Free the whole trie, calling fn (if given) for each handler ref */
+void topic_trie_free(topic_node_t **root, topic_visit_fn fn, void *arg) {
+  topic_node_t *n = *root;
+  while (n) {
+    topic_node_t *next = n->next;
+    topic_trie_free(&n->child, fn, arg);
+    if (fn && n->ref != TOPIC_NOREF)
+      fn(n->ref, arg);
+    free(n);
+    n = next;
+  }
+  *root = NULL;
+}
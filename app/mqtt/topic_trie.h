@@ -0,0 +1,38 @@
+#ifndef _TOPIC_TRIE_H
+#define _TOPIC_TRIE_H 1
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A trie of MQTT topic filters, one node per topic level, used to route
+ * incoming PUBLISH messages to per-subscription handlers.  Each node can hold
+ * an integer handler reference; TOPIC_NOREF has the same value as LUA_NOREF
+ * so that registry references can be stored directly.
+ */
+#define TOPIC_NOREF (-2)
+
+typedef struct topic_node_t {
+  struct topic_node_t *next;      /* next sibling at this level */
+  struct topic_node_t *child;     /* first node of the next level */
+  int ref;                        /* handler or TOPIC_NOREF */
+  uint16_t len;                   /* length of level */
+  char level[1];                  /* level name (not NUL terminated) */
+} topic_node_t;
+
+typedef void (*topic_visit_fn)(int ref, void *arg);
+
+bool topic_filter_valid(const char *filter, size_t len);
+int topic_trie_insert(topic_node_t **root, const char *filter, size_t len, int ref, int *old_ref);
+int topic_trie_remove(topic_node_t **root, const char *filter, size_t len);
+int topic_trie_match(topic_node_t *root, const char *topic, size_t len, topic_visit_fn fn, void *arg);
+void topic_trie_free(topic_node_t **root, topic_visit_fn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -13,12 +13,14 @@
 #include "driver/spi.h"
 #include "driver/uart.h"
 #include "driver/sigma_delta.h"
+#include "cpu_esp8266_irq.h"
 
 #define INTERRUPT_TYPE_IS_LEVEL(x)   ((x) >= GPIO_PIN_INTR_LOLEVEL)
 
+static int task_init_handler(void);
+
 #ifdef GPIO_INTERRUPT_ENABLE
 static platform_task_handle_t gpio_task_handle;
-static int task_init_handler(void);
 
 #ifdef GPIO_INTERRUPT_HOOK_ENABLE
 struct gpio_hook_entry {
@@ -248,7 +250,8 @@ static void ICACHE_RAM_ATTR platform_gpio_intr_dispatcher (void *dummy){
 
         if (diff == 0 || diff & 0x8000) {
           uint32_t level = 0x1 & GPIO_INPUT_GET(GPIO_ID_PIN(j));
-	  if (!platform_post_high (gpio_task_handle, (now << 8) + (i<<1) + level)) {
+	  if (platform_post_high (gpio_task_handle, (now << 8) + (i<<1) + level) ==
+              PLATFORM_TASK_POST_FAIL) {
             // If we fail to post, then try on the next interrupt
             pin_counter[i].seen |= 0x8000;
           }
@@ -1094,29 +1097,150 @@ void* platform_print_deprecation_note( const char *msg, const char *time_frame)
 #define TH_UNMASK  (~TH_MASK)
 #define TH_SHIFT   2
 #define TH_ALLOCATION_BRICK 4   // must be a power of 2
-#define TASK_DEFAULT_QUEUE_LEN 8
 #define TASK_PRIORITY_MASK    3
 #define TASK_PRIORITY_COUNT   3
 
+#ifndef TASK_QUEUE_LEN_LOW
+# define TASK_QUEUE_LEN_LOW    8
+#endif
+#ifndef TASK_QUEUE_LEN_MEDIUM
+# define TASK_QUEUE_LEN_MEDIUM 8
+#endif
+#ifndef TASK_QUEUE_LEN_HIGH
+# define TASK_QUEUE_LEN_HIGH   8
+#endif
+#ifndef TASK_SPILL_LEN
+# define TASK_SPILL_LEN        8    // must be a power of 2
+#endif
+#ifndef TASK_SPILL_MAX
+# define TASK_SPILL_MAX        64   // must be a power of 2
+#endif
+
+/*
+ * Each priority has a fixed length SDK queue and an overflow spill ring.  Once
+ * the SDK queue is full, posts are parked in the spill ring and fed back into
+ * the SDK queue one at a time as each task is dispatched, so ordering within a
+ * priority is preserved.  The spill ring can't be resized in an ISR, so it is
+ * doubled (up to TASK_SPILL_MAX) from task context when it starts to fill up.
+ */
+struct taskQ {
+  os_event_t *Q;
+  os_event_t *spill;
+  uint16_t spill_head;
+  uint16_t spill_count;
+  uint16_t qdepth;
+  platform_task_stats_t stats;
+};
+
 /*
  * Private struct to hold the 3 event task queues and the dispatch callbacks
  */
 static struct taskQblock {
-  os_event_t *task_Q[TASK_PRIORITY_COUNT];
+  struct taskQ q[TASK_PRIORITY_COUNT];
   platform_task_callback_t *task_func;
   int task_count;
   } TQB = {0};
 
+static const uint16_t task_qlen[TASK_PRIORITY_COUNT] = {
+  TASK_QUEUE_LEN_LOW, TASK_QUEUE_LEN_MEDIUM, TASK_QUEUE_LEN_HIGH
+};
+
+/*
+ * Post a task.  This can be called from ISRs so it must be in IRAM and all
+ * updates to the queue state are done with interrupts deferred.
+ */
+int ICACHE_RAM_ATTR platform_post (uint8 prio, platform_task_handle_t handle, platform_task_param_t par) {
+  struct taskQ *q = TQB.q + prio;
+  uint32_t ps, depth;
+  int res;
+
+  if (prio >= TASK_PRIORITY_COUNT)
+    return PLATFORM_TASK_POST_FAIL;
+
+  ps = esp8266_defer_irqs();
+  if (q->spill_count == 0 && system_os_post(prio, handle | prio, par)) {
+    q->qdepth++;
+    res = PLATFORM_TASK_POST_OK;
+  } else if (q->spill_count < q->stats.spill_len) {
+    os_event_t *e = q->spill +
+                    ((q->spill_head + q->spill_count++) & (q->stats.spill_len - 1));
+    e->sig = handle | prio;
+    e->par = par;
+    q->stats.spilled++;
+    res = PLATFORM_TASK_POST_WOULDBLOCK;
+  } else {
+    q->stats.dropped++;
+    esp8266_restore_irqs(ps);
+    return PLATFORM_TASK_POST_FAIL;
+  }
+  q->stats.posted++;
+  depth = q->qdepth + q->spill_count;
+  if (depth > q->stats.max_depth)
+    q->stats.max_depth = depth;
+  esp8266_restore_irqs(ps);
+  return res;
+}
+
+/*
+ * Double the spill ring capacity.  Called from task context only.
+ */
+static void task_spill_grow (struct taskQ *q) {
+  uint16_t i, n = q->stats.spill_len << 1;
+  os_event_t *old, *s = (os_event_t *) malloc(sizeof(os_event_t)*n);
+  uint32_t ps;
+
+  if (!s) {
+    NODE_DBG ( "Malloc failure in task_spill_grow" );
+    return;
+  }
+  ps = esp8266_defer_irqs();
+  for (i = 0; i < q->spill_count; i++)
+    s[i] = q->spill[(q->spill_head + i) & (q->stats.spill_len - 1)];
+  old = q->spill;
+  q->spill = s;
+  q->spill_head = 0;
+  q->stats.spill_len = n;
+  esp8266_restore_irqs(ps);
+  free(old);
+}
+
 static void platform_task_dispatch (os_event_t *e) {
   platform_task_handle_t handle = e->sig;
+  platform_task_param_t  par    = e->par;
+  uint8_t priority = handle & TASK_PRIORITY_MASK;
+
+  if (priority < TASK_PRIORITY_COUNT) {
+    struct taskQ *q = TQB.q + priority;
+    uint32_t ps = esp8266_defer_irqs();
+    if (q->qdepth)
+      q->qdepth--;
+    q->stats.dispatched++;
+   /*
+    * ets_run() has already released this event's slot, so promote the oldest
+    * spilled event (if any) into the SDK queue.
+    */
+    if (q->spill_count) {
+      os_event_t *s = q->spill + q->spill_head;
+      if (system_os_post(priority, s->sig, s->par)) {
+        q->spill_head = (q->spill_head + 1) & (q->stats.spill_len - 1);
+        q->spill_count--;
+        q->qdepth++;
+      }
+    }
+    esp8266_restore_irqs(ps);
+
+    if (q->spill_count > (q->stats.spill_len >> 1) + (q->stats.spill_len >> 2) &&
+        q->stats.spill_len < TASK_SPILL_MAX)
+      task_spill_grow(q);
+  }
+
   if ( (handle & TH_MASK) == TH_MONIKER) {
     uint16_t entry    = (handle & TH_UNMASK) >> TH_SHIFT;
-    uint8_t  priority = handle & TASK_PRIORITY_MASK;
     if ( priority <= PLATFORM_TASK_PRIORITY_HIGH &&
          TQB.task_func &&
          entry < TQB.task_count ){
       /* call the registered task handler with the specified parameter and priority */
-      TQB.task_func[entry](e->par, priority);
+      TQB.task_func[entry](par, priority);
       return;
     }
   }
@@ -1128,17 +1252,44 @@ static void platform_task_dispatch (os_event_t *e) {
  * Initialise the task handle callback for a given priority.
  */
 static int task_init_handler (void) {
-  int p, qlen = TASK_DEFAULT_QUEUE_LEN;
+  int p;
   for (p = 0; p < TASK_PRIORITY_COUNT; p++){
-    TQB.task_Q[p] = (os_event_t *) malloc( sizeof(os_event_t)*qlen );
-    if (TQB.task_Q[p]) {
-      os_memset(TQB.task_Q[p], 0, sizeof(os_event_t)*qlen);
-      system_os_task(platform_task_dispatch, p, TQB.task_Q[p], TASK_DEFAULT_QUEUE_LEN);
+    struct taskQ *q = TQB.q + p;
+    q->Q     = (os_event_t *) calloc(task_qlen[p], sizeof(os_event_t));
+    q->spill = (os_event_t *) calloc(TASK_SPILL_LEN, sizeof(os_event_t));
+    if (q->Q && q->spill) {
+      q->stats.qlen = task_qlen[p];
+      q->stats.spill_len = TASK_SPILL_LEN;
+      system_os_task(platform_task_dispatch, p, q->Q, task_qlen[p]);
     } else {
       NODE_DBG ( "Malloc failure in platform_task_init_handler" );
       return PLATFORM_ERR;
     }
   }
+  return PLATFORM_OK;
+}
+
+/*
+ * Return a snapshot of the task counters for a given priority, optionally
+ * resetting the posted, dispatched, dropped and spilled counts and the
+ * high-water mark.
+ */
+int platform_task_get_stats (uint8 prio, platform_task_stats_t *stats, bool reset) {
+  struct taskQ *q = TQB.q + prio;
+  uint32_t ps;
+
+  if (prio >= TASK_PRIORITY_COUNT)
+    return PLATFORM_ERR;
+  ps = esp8266_defer_irqs();
+  *stats = q->stats;
+  stats->depth = q->qdepth + q->spill_count;
+  if (reset) {
+    q->stats.posted = q->stats.dispatched = 0;
+    q->stats.dropped = q->stats.spilled = 0;
+    q->stats.max_depth = stats->depth;
+  }
+  esp8266_restore_irqs(ps);
+  return PLATFORM_OK;
 }
 
 
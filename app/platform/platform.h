@@ -382,9 +382,31 @@ uint32_t platform_rcr_write (uint8_t rec_id, const void *rec, uint8_t size);
 typedef void (*platform_task_callback_t)(platform_task_param_t param, uint8 prio);
 platform_task_handle_t platform_task_get_id(platform_task_callback_t t);
 
-static inline bool platform_post(uint8 prio, platform_task_handle_t handle, platform_task_param_t par) {
-  return system_os_post(prio, handle | prio, par);
-}
+/*
+* platform_post() returns one of the following codes.  Note that any non-zero
+* return means that the task has been accepted and will be dispatched, so
+* existing callers can continue to treat the result as a boolean.  A WOULDBLOCK
+* return means that the SDK queue for this priority is full and the task has
+* been parked in the overflow spill list; the caller should back off if it can.
+*/
+#define PLATFORM_TASK_POST_FAIL        0
+#define PLATFORM_TASK_POST_OK          1
+#define PLATFORM_TASK_POST_WOULDBLOCK  2
+
+int platform_post(uint8 prio, platform_task_handle_t handle, platform_task_param_t par);
+
+typedef struct {
+  uint32_t posted;      // tasks accepted (including spilled)
+  uint32_t dispatched;  // tasks delivered to their handler
+  uint32_t dropped;     // tasks rejected because both the queue and spill were full
+  uint32_t spilled;     // tasks that had to be parked in the spill list
+  uint16_t depth;       // current number of undispatched tasks
+  uint16_t max_depth;   // high-water mark of depth
+  uint16_t qlen;        // SDK queue length
+  uint16_t spill_len;   // current spill list capacity
+} platform_task_stats_t;
+
+int platform_task_get_stats(uint8 prio, platform_task_stats_t *stats, bool reset);
 #define platform_freeheap() system_get_free_heap_size()
 
 // Get current value of CCOUNt register
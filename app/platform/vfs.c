@@ -284,6 +284,51 @@ int32_t vfs_fscfg( const char *name, uint32_t *phys_addr, uint32_t *phys_size)
   return VFS_RES_ERR;
 }
 
+int32_t vfs_fscache( const char *name, int32_t *pages, int32_t *write_back )
+{
+  vfs_fs_fns *fs_fns;
+  char *outname;
+
+  if (!name) name = "";  // current drive
+
+  const char *normname = normalize_path( name );
+
+#ifdef BUILD_SPIFFS
+  if (fs_fns = myspiffs_realm( normname, &outname, FALSE )) {
+    return fs_fns->fscache( pages, write_back );
+  }
+#endif
+
+#ifdef BUILD_FATFS
+  // not supported
+#endif
+
+  // Error
+  return VFS_RES_ERR;
+}
+
+int32_t vfs_fsstats( const char *name, struct vfs_fsstats *st )
+{
+  vfs_fs_fns *fs_fns;
+  char *outname;
+
+  if (!name) name = "";  // current drive
+
+  const char *normname = normalize_path( name );
+
+#ifdef BUILD_SPIFFS
+  if (fs_fns = myspiffs_realm( normname, &outname, FALSE )) {
+    return fs_fns->fsstats( st );
+  }
+#endif
+
+#ifdef BUILD_FATFS
+  // not supported
+#endif
+
+  return VFS_RES_ERR;
+}
+
 int32_t vfs_format( void )
 {
   vfs_fs_fns *fs_fns;
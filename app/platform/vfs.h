@@ -181,6 +181,21 @@ int32_t  vfs_chdir( const char *path );
 //   Returns: VFS_RES_OK, or VFS_RES_ERR in case of error
 int32_t vfs_fscfg( const char *name, uint32_t *phys_addr, uint32_t *phys_size);
 
+// vfs_fscache - query and change the cache settings of file system
+//   name: logical drive identifier
+//   pages: number of cache pages, < 0 to leave unchanged; receives the current setting
+//          changing it remounts the file system, so this fails while files are open
+//   write_back: 1 to cache writes, 0 to write through, < 0 to leave unchanged;
+//               receives the current setting
+//   Returns: VFS_RES_OK, or VFS_RES_ERR in case of error
+int32_t vfs_fscache( const char *name, int32_t *pages, int32_t *write_back );
+
+// vfs_fsstats - get file system statistics
+//   name: logical drive identifier
+//   st: receives the counters
+//   Returns: VFS_RES_OK, or VFS_RES_ERR in case of error
+int32_t vfs_fsstats( const char *name, struct vfs_fsstats *st );
+
 // vfs_errno - get file system specific errno
 //   name: logical drive identifier
 //   Returns: errno
@@ -54,6 +54,14 @@ struct vfs_stat {
   uint8_t is_arch;
 };
 
+// file system statistics
+struct vfs_fsstats {
+  uint32_t cache_hits;
+  uint32_t cache_misses;
+  uint32_t gc_runs;
+  uint32_t erases;
+};
+
 // file descriptor functions
 struct vfs_file_fns {
   int32_t (*close)( const struct vfs_file *fd );
@@ -105,6 +113,8 @@ struct vfs_fs_fns {
   int32_t  (*mkdir)( const char *name );
   int32_t  (*fsinfo)( uint32_t *total, uint32_t *used );
   int32_t  (*fscfg)( uint32_t *phys_addr, uint32_t *phys_size );
+  int32_t  (*fscache)( int32_t *pages, int32_t *write_back );
+  int32_t  (*fsstats)( struct vfs_fsstats *st );
   int32_t  (*format)( void );
   int32_t  (*chdrive)( const char * );
   int32_t  (*chdir)( const char * );
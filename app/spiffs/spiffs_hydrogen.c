@@ -914,6 +914,11 @@ s32_t SPIFFS_rename(spiffs *fs, const char *old_path, const char *new_path) {
     spiffs_fd_temporal_cache_rehash(fs, old_path, new_path);
   }
 #endif
+#if SPIFFS_NAME_CACHE
+  if (res == SPIFFS_OK) {
+    spiffs_name_cache_rehash(fs, old_path, new_path);
+  }
+#endif
 
   spiffs_fd_return(fs, fd->file_nbr);
 
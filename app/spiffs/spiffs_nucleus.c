@@ -746,6 +746,123 @@ s32_t spiffs_populate_ix_map(spiffs *fs, spiffs_fd *fd, u32_t vec_entry_start, u
 #endif
 
 
+#if SPIFFS_TEMPORAL_FD_CACHE || SPIFFS_NAME_CACHE
+// djb2 hash
+static u32_t spiffs_hash(spiffs *fs, const u8_t *name) {
+  (void)fs;
+  u32_t hash = 5381;
+  u8_t c;
+  int i = 0;
+  while ((c = name[i++]) && i < SPIFFS_OBJ_NAME_LEN) {
+    hash = (hash * 33) ^ c;
+  }
+  return hash;
+}
+#endif
+
+#if SPIFFS_NAME_CACHE
+// A name can be in any of SPIFFS_NAME_CACHE_WAYS entries starting at its home
+// slot. The low bits of the djb2 hash barely depend on the name, so the high
+// bits are mixed in to pick the home slot.
+#define SPIFFS_NAME_CACHE_WAYS  4
+#define SPIFFS_NAME_CACHE_HOME(hash) ((((hash) * 2654435769u) >> 16) % SPIFFS_NAME_CACHE)
+
+static spiffs_name_cache_entry *spiffs_name_cache_get(
+    spiffs *fs,
+    u32_t hash) {
+  u32_t i, slot = SPIFFS_NAME_CACHE_HOME(hash);
+  for (i = 0; i < SPIFFS_NAME_CACHE_WAYS && i < SPIFFS_NAME_CACHE; i++) {
+    spiffs_name_cache_entry *e = &fs->name_cache[(slot + i) % SPIFFS_NAME_CACHE];
+    if (e->obj_id != SPIFFS_OBJ_ID_DELETED && e->name_hash == hash) {
+      return e;
+    }
+  }
+  return 0;
+}
+
+static void spiffs_name_cache_put(
+    spiffs *fs,
+    const u8_t *name,
+    spiffs_obj_id obj_id,
+    spiffs_page_ix pix) {
+  u32_t i, hash = spiffs_hash(fs, name), slot = SPIFFS_NAME_CACHE_HOME(hash);
+  spiffs_name_cache_entry *e = spiffs_name_cache_get(fs, hash);
+  for (i = 0; !e && i < SPIFFS_NAME_CACHE_WAYS && i < SPIFFS_NAME_CACHE; i++) {
+    if (fs->name_cache[(slot + i) % SPIFFS_NAME_CACHE].obj_id == SPIFFS_OBJ_ID_DELETED) {
+      e = &fs->name_cache[(slot + i) % SPIFFS_NAME_CACHE];
+    }
+  }
+  if (!e) {
+    // all taken, evict one picked by other bits of the hash
+    e = &fs->name_cache[(slot + (hash >> 24) % SPIFFS_NAME_CACHE_WAYS) % SPIFFS_NAME_CACHE];
+  }
+  e->name_hash = hash;
+  e->obj_id = obj_id & ~SPIFFS_OBJ_ID_IX_FLAG;
+  e->pix = pix;
+}
+
+// Looks up name in the name cache, checking the cached page against the
+// medium as a hash collision or a missed update would otherwise go unnoticed
+static s32_t spiffs_name_cache_find(
+    spiffs *fs,
+    const u8_t *name,
+    spiffs_page_ix *pix) {
+  s32_t res;
+  spiffs_page_object_ix_header objix_hdr;
+  spiffs_name_cache_entry *e = spiffs_name_cache_get(fs, spiffs_hash(fs, name));
+
+  if (!e) {
+    return SPIFFS_ERR_NOT_FOUND;
+  }
+  res = _spiffs_rd(fs, SPIFFS_OP_T_OBJ_LU2 | SPIFFS_OP_C_READ,
+      0, SPIFFS_PAGE_TO_PADDR(fs, e->pix), sizeof(spiffs_page_object_ix_header), (u8_t *)&objix_hdr);
+  SPIFFS_CHECK_RES(res);
+  if (objix_hdr.p_hdr.obj_id != (e->obj_id | SPIFFS_OBJ_ID_IX_FLAG) ||
+      objix_hdr.p_hdr.span_ix != 0 ||
+      (objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) !=
+          (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE) ||
+      strcmp((const char *)name, (char *)objix_hdr.name) != 0) {
+    e->obj_id = SPIFFS_OBJ_ID_DELETED;
+    return SPIFFS_ERR_NOT_FOUND;
+  }
+  if (pix) {
+    *pix = e->pix;
+  }
+  return SPIFFS_OK;
+}
+
+// Follows the object index header of obj_id as it moves or is removed
+static void spiffs_name_cache_update(
+    spiffs *fs,
+    spiffs_obj_id obj_id,
+    spiffs_page_ix pix,
+    u8_t remove) {
+  u32_t i;
+  for (i = 0; i < SPIFFS_NAME_CACHE; i++) {
+    spiffs_name_cache_entry *e = &fs->name_cache[i];
+    if (e->obj_id == obj_id) {
+      if (remove) {
+        e->obj_id = SPIFFS_OBJ_ID_DELETED;
+      } else {
+        e->pix = pix;
+      }
+    }
+  }
+}
+
+void spiffs_name_cache_rehash(
+    spiffs *fs,
+    const char *old_path,
+    const char *new_path) {
+  spiffs_name_cache_entry *e = spiffs_name_cache_get(fs, spiffs_hash(fs, (const u8_t *)old_path));
+  if (e) {
+    spiffs_obj_id obj_id = e->obj_id;
+    e->obj_id = SPIFFS_OBJ_ID_DELETED;
+    spiffs_name_cache_put(fs, (const u8_t *)new_path, obj_id, e->pix);
+  }
+}
+#endif // SPIFFS_NAME_CACHE
+
 #if !SPIFFS_READ_ONLY
 // Allocates a free defined page with given obj_id
 // Occupies object lookup entry and page
@@ -972,6 +1089,9 @@ s32_t spiffs_object_create(
   SPIFFS_CHECK_RES(res);
   spiffs_cb_object_event(fs, (spiffs_page_object_ix *)&oix_hdr,
       SPIFFS_EV_IX_NEW, obj_id, 0, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry), SPIFFS_UNDEFINED_LEN);
+#if SPIFFS_NAME_CACHE
+  spiffs_name_cache_put(fs, name, obj_id, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry));
+#endif
 
   if (objix_hdr_pix) {
     *objix_hdr_pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry);
@@ -1065,6 +1185,11 @@ void spiffs_cb_object_event(
   spiffs_fd *fds = (spiffs_fd *)fs->fd_space;
   SPIFFS_DBG("       CALLBACK  %s obj_id:"_SPIPRIid" spix:"_SPIPRIsp" npix:"_SPIPRIpg" nsz:"_SPIPRIi"\n", (const char *[]){"UPD", "NEW", "DEL", "MOV", "HUP","???"}[MIN(ev,5)],
       obj_id_raw, spix, new_pix, new_size);
+#if SPIFFS_NAME_CACHE
+  if (spix == 0 && ev != SPIFFS_EV_IX_NEW) {
+    spiffs_name_cache_update(fs, obj_id, new_pix, ev == SPIFFS_EV_IX_DEL);
+  }
+#endif
   for (i = 0; i < fs->fd_count; i++) {
     spiffs_fd *cur_fd = &fds[i];
     if ((cur_fd->obj_id & ~SPIFFS_OBJ_ID_IX_FLAG) != obj_id) continue; // fd not related to updated file
@@ -1675,7 +1800,6 @@ static s32_t spiffs_object_find_object_index_header_by_name_v(
     int ix_entry,
     const void *user_const_p,
     void *user_var_p) {
-  (void)user_var_p;
   s32_t res;
   spiffs_page_object_ix_header objix_hdr;
   spiffs_page_ix pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, ix_entry);
@@ -1690,6 +1814,9 @@ static s32_t spiffs_object_find_object_index_header_by_name_v(
       (objix_hdr.p_hdr.flags & (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_FINAL | SPIFFS_PH_FLAG_IXDELE)) ==
           (SPIFFS_PH_FLAG_DELET | SPIFFS_PH_FLAG_IXDELE)) {
     if (strcmp((const char*)user_const_p, (char*)objix_hdr.name) == 0) {
+      if (user_var_p) {
+        *(spiffs_obj_id *)user_var_p = obj_id;
+      }
       return SPIFFS_OK;
     }
   }
@@ -1704,8 +1831,16 @@ s32_t spiffs_object_find_object_index_header_by_name(
     spiffs_page_ix *pix) {
   s32_t res;
   spiffs_block_ix bix;
+  spiffs_obj_id obj_id;
   int entry;
 
+#if SPIFFS_NAME_CACHE
+  res = spiffs_name_cache_find(fs, name, pix);
+  if (res != SPIFFS_ERR_NOT_FOUND) {
+    return res;
+  }
+#endif
+
   res = spiffs_obj_lu_find_entry_visitor(fs,
       fs->cursor_block_ix,
       fs->cursor_obj_lu_entry,
@@ -1713,7 +1848,7 @@ s32_t spiffs_object_find_object_index_header_by_name(
       0,
       spiffs_object_find_object_index_header_by_name_v,
       name,
-      0,
+      &obj_id,
       &bix,
       &entry);
 
@@ -1725,6 +1860,9 @@ s32_t spiffs_object_find_object_index_header_by_name(
   if (pix) {
     *pix = SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry);
   }
+#if SPIFFS_NAME_CACHE
+  spiffs_name_cache_put(fs, name, obj_id, SPIFFS_OBJ_LOOKUP_ENTRY_TO_PIX(fs, bix, entry));
+#endif
 
   fs->cursor_block_ix = bix;
   fs->cursor_obj_lu_entry = entry;
@@ -2235,19 +2373,6 @@ s32_t spiffs_obj_lu_find_free_obj_id(spiffs *fs, spiffs_obj_id *obj_id, const u8
 }
 #endif // !SPIFFS_READ_ONLY
 
-#if SPIFFS_TEMPORAL_FD_CACHE
-// djb2 hash
-static u32_t spiffs_hash(spiffs *fs, const u8_t *name) {
-  (void)fs;
-  u32_t hash = 5381;
-  u8_t c;
-  int i = 0;
-  while ((c = name[i++]) && i < SPIFFS_OBJ_NAME_LEN) {
-    hash = (hash * 33) ^ c;
-  }
-  return hash;
-}
-#endif
 
 s32_t spiffs_fd_find_new(spiffs *fs, spiffs_fd **fd, const char *name) {
 #if SPIFFS_TEMPORAL_FD_CACHE
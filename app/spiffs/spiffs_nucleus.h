@@ -790,6 +790,13 @@ void spiffs_fd_temporal_cache_rehash(
     const char *new_path);
 #endif
 
+#if SPIFFS_NAME_CACHE
+void spiffs_name_cache_rehash(
+    spiffs *fs,
+    const char *old_path,
+    const char *new_path);
+#endif
+
 #if SPIFFS_CACHE
 void spiffs_cache_init(
     spiffs *fs);
@@ -59,6 +59,7 @@ extern const char _irom0_text_start[], _irom0_text_end[], _flash_used_end[];
 #define NODEMCU_PARTITION_EAGLEROM  PLATFORM_PARTITION(NODEMCU_EAGLEROM_PARTITION)
 #define NODEMCU_PARTITION_IROM0TEXT PLATFORM_PARTITION(NODEMCU_IROM0TEXT_PARTITION)
 #define NODEMCU_PARTITION_LFS       PLATFORM_PARTITION(NODEMCU_LFS0_PARTITION)
+#define NODEMCU_PARTITION_LFS1      PLATFORM_PARTITION(NODEMCU_LFS1_PARTITION)
 #define NODEMCU_PARTITION_SPIFFS    PLATFORM_PARTITION(NODEMCU_SPIFFS0_PARTITION)
 
 #define RF_CAL_SIZE            0x1000
@@ -67,7 +68,7 @@ extern const char _irom0_text_start[], _irom0_text_end[], _flash_used_end[];
 
 #define MAX_PARTITIONS 20
 #define WORDSIZE       sizeof(uint32_t)
-#define PTABLE_SIZE    7   /** THIS MUST BE MATCHED TO NO OF PT ENTRIES BELOW **/
+#define PTABLE_SIZE    8   /** THIS MUST BE MATCHED TO NO OF PT ENTRIES BELOW **/
 
 struct defaultpt {
   platform_rcr_t hdr;
@@ -88,6 +89,7 @@ static const struct defaultpt rompt IROM_PTABLE_ATTR USED_ATTR  = {
     { SYSTEM_PARTITION_PHY_DATA,          0x0F000,     PHY_DATA_SIZE},
     { NODEMCU_PARTITION_IROM0TEXT,        0x10000,     0x0000},
     { NODEMCU_PARTITION_LFS,              0x0,         LUA_FLASH_STORE},
+    { NODEMCU_PARTITION_LFS1,             0x0,         LUA_FLASH_STORE1},
     { NODEMCU_PARTITION_SPIFFS,           0x0,         SPIFFS_MAX_FILESYSTEM_SIZE},
     { SYSTEM_PARTITION_SYSTEM_PARAMETER,  0x0,         SYSTEM_PARAMETER_SIZE},
     {0,(uint32_t) &_irom0_text_end,0}
@@ -243,8 +245,9 @@ static uint32_t first_time_setup(partition_item_t *pt, uint32_t n, uint32_t flas
             break;
 
           case NODEMCU_PARTITION_LFS:
-            // Properly align the LFS partition size and make it consecutive to
-            // the previous partition.
+          case NODEMCU_PARTITION_LFS1:
+            // Properly align the LFS partition sizes and make them consecutive
+            // to the previous partition.
             p->size = PT_ALIGN(p->size);
             if (p->addr == 0)
                 p->addr = last;
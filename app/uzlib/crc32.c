@@ -36,6 +36,11 @@
  * Copyright (C) 1995-1998 Jean-loup Gailly and Mark Adler
  */
 #include <stdint.h>
+#include "uzlib.h"
+
+/* Shared by the inflate and deflate routines, which can both be linked */
+jmp_buf unwindAddr;
+int dbg_break(void) {return 1;}
 
 static const unsigned int tinf_crc32tab[16] = {
    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190,
@@ -60,3 +65,23 @@ uint32_t uzlib_crc32(const void *data, unsigned int length, uint32_t crc)
    // return value suitable for passing in next time, for final value invert it
    return crc/* ^ 0xffffffff*/;
 }
+
+/* adler is previous value for incremental computation, 1 initially */
+uint32_t uzlib_adler32(const void *data, unsigned int length, uint32_t adler)
+{
+   const unsigned char *buf = (const unsigned char *)data;
+   uint32_t s1 = adler & 0xffff, s2 = adler >> 16;
+
+   while (length) {
+      /* 5552 is the largest n such that the sums cannot overflow */
+      unsigned int n = length < 5552 ? length : 5552;
+      length -= n;
+      while (n--) {
+         s1 += *buf++;
+         s2 += s1;
+      }
+      s1 %= 65521;
+      s2 %= 65521;
+   }
+   return (s2 << 16) | s1;
+}
@@ -0,0 +1,420 @@
+/************************************************************************
+ * NodeMCU uzlib benchmark against the zlib reference implementation
+ *
+ * Each corpus file (typically LFS images, JSON and HTML assets) is
+ * compressed and decompressed with uzlib, both as a whole record as used
+ * for LFS images and through the stream API, and with zlib at a range of
+ * levels using the same dictionary window.  Every round trip is checked,
+ * and the compression ratio, throughput and peak heap allocation of each
+ * direction are reported.
+ *
+ * The uzlib objects are built with uz_malloc() etc. redirected to the
+ * counting allocator below, and zlib is given the same allocator, so the
+ * peak figures cover the library's working storage but not the caller's
+ * input and output buffers.  The match search tuning in uzlib_deflate.c
+ * can be overridden at build time to compare heuristics, e.g.
+ *
+ *   make bench BENCH_DEFINES="-DUZLIB_CHAIN_LIMIT=30 -DUZLIB_HASH_RATIO=1"
+ */
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "uzlib.h"
+
+#define DEFAULT_WINDOW 16384   /* the LFS image dictionary size */
+#define DEFAULT_CHUNK  1460    /* one TCP segment */
+#define DEFAULT_SECS   0.25    /* minimum timing period per measurement */
+
+typedef uint8_t  uchar;
+typedef uint32_t uint;
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+#ifdef UZLIB_CHAIN_LIMIT
+#define CHAIN_LIMIT STR(UZLIB_CHAIN_LIMIT)
+#else
+#define CHAIN_LIMIT "default"
+#endif
+#ifdef UZLIB_HASH_RATIO
+#define HASH_RATIO STR(UZLIB_HASH_RATIO)
+#else
+#define HASH_RATIO "default"
+#endif
+
+/*
+ * Counting allocator.  Each block is prefixed with its size so that the
+ * current and peak totals can be maintained across realloc and free.
+ */
+typedef union { size_t size; double d; void *p; } allocHdr;
+static size_t heapNow, heapPeak;
+
+static void heapCount(long delta) {
+  heapNow += delta;
+  if (heapNow > heapPeak)
+    heapPeak = heapNow;
+}
+
+void *bench_malloc(size_t n) {
+  allocHdr *h = malloc(sizeof(*h) + n);
+  if (!h)
+    return NULL;
+  h->size = n;
+  heapCount(n);
+  return h + 1;
+}
+
+void *bench_realloc(void *p, size_t n) {
+  allocHdr *h;
+  size_t old;
+  if (!p)
+    return bench_malloc(n);
+  h = (allocHdr *) p - 1;
+  old = h->size;
+  if (!(h = realloc(h, sizeof(*h) + n)))
+    return NULL;
+  h->size = n;
+  heapCount((long) n - (long) old);
+  return h + 1;
+}
+
+void bench_free(void *p) {
+  if (p) {
+    allocHdr *h = (allocHdr *) p - 1;
+    heapCount(-(long) h->size);
+    free(h);
+  }
+}
+
+static voidpf zalloc(voidpf opaque, uInt items, uInt size) {
+  return bench_malloc((size_t) items * size);
+}
+
+static void zfree(voidpf opaque, voidpf p) {
+  bench_free(p);
+}
+
+/*
+ * A growable caller-owned output buffer.  This deliberately uses the
+ * system allocator so that it is not included in the peak figures.
+ */
+typedef struct {
+  uchar *buf;
+  size_t len, size;
+} outBuf;
+
+static void outReset(outBuf *o, size_t size) {
+  if (size > o->size) {
+    o->buf = realloc(o->buf, size);
+    o->size = size;
+  }
+  o->len = 0;
+}
+
+static void outWrite(void *arg, const uint8_t *data, uint32_t len) {
+  outBuf *o = (outBuf *) arg;
+  if (o->len + len > o->size) {
+    o->size = 2*(o->len + len);
+    o->buf = realloc(o->buf, o->size);
+  }
+  memcpy(o->buf + o->len, data, len);
+  o->len += len;
+}
+
+/*
+ * Callbacks for the whole record uzlib_inflate(), which reads the input
+ * and recalls history directly from the caller's buffers.
+ */
+static const uchar *recIn;
+static uint recInLen, recInPos;
+static outBuf *recOut;
+
+static uint8_t rec_get_byte(void) {
+  if (recInPos >= recInLen)
+    UZLIB_THROW(UZLIB_DATA_ERROR);
+  return recIn[recInPos++];
+}
+
+static void rec_put_byte(uint8_t v) {
+  if (recOut->len >= recOut->size)
+    UZLIB_THROW(UZLIB_DATA_ERROR);
+  recOut->buf[recOut->len++] = v;
+}
+
+static uint8_t rec_recall_byte(uint offset) {
+  if (offset > recOut->len)
+    UZLIB_THROW(UZLIB_DICT_ERROR);
+  return recOut->buf[recOut->len - offset];
+}
+
+/*
+ * Codecs under test.  Each compresses or decompresses in into out,
+ * returning 0 on success.
+ */
+typedef struct {
+  const char *name;
+  int level, strategy;     /* zlib only */
+  int (*compress)(const uchar *in, size_t len, outBuf *out, int level, int strategy);
+  int (*decompress)(const uchar *in, size_t len, outBuf *out);
+} codec;
+
+static uint window = DEFAULT_WINDOW, chunk = DEFAULT_CHUNK;
+
+static int uzRecCompress(const uchar *in, size_t len, outBuf *out, int level, int strategy) {
+  uchar *buf;
+  uint bufLen;
+  if (uzlib_compress(&buf, &bufLen, in, len) != UZLIB_OK)
+    return 1;
+  outReset(out, 0);
+  outWrite(out, buf, bufLen);
+  uz_free(buf);
+  return 0;
+}
+
+static int uzRecDecompress(const uchar *in, size_t len, outBuf *out) {
+  uint crc;
+  void *state;
+  /* the uncompressed length is the last word of the gzip trailer */
+  uint outLen = in[len-4] | in[len-3]<<8 | in[len-2]<<16 | (uint) in[len-1]<<24;
+  outReset(out, outLen);
+  recIn = in, recInLen = len, recInPos = 0;
+  recOut = out;
+  if (uzlib_inflate(rec_get_byte, rec_put_byte, rec_recall_byte,
+                    len, &crc, &state) != UZLIB_DONE)
+    return 1;
+  return crc != ~uzlib_crc32(out->buf, out->len, ~0);
+}
+
+static int uzStreamCompress(const uchar *in, size_t len, outBuf *out, int level, int strategy) {
+  UZLIB_DSTREAM *s = uzlib_deflate_init(window, UZLIB_FORMAT_GZIP);
+  size_t i, n;
+  int res = UZLIB_OK;
+  if (!s)
+    return 1;
+  outReset(out, 0);
+  for (i = 0; res == UZLIB_OK && i < len; i += n) {
+    n = len - i < chunk ? len - i : chunk;
+    res = uzlib_deflate_write(s, in + i, n, i + n == len, outWrite, out);
+  }
+  if (len == 0)
+    res = uzlib_deflate_write(s, in, 0, 1, outWrite, out);
+  uzlib_deflate_end(s);
+  return res != UZLIB_DONE;
+}
+
+static int uzStreamDecompress(const uchar *in, size_t len, outBuf *out) {
+  UZLIB_STREAM *s = uzlib_inflate_init(window, UZLIB_FORMAT_AUTO);
+  size_t i, n;
+  int res = UZLIB_OK;
+  if (!s)
+    return 1;
+  outReset(out, 0);
+  for (i = 0; res == UZLIB_OK && i < len; i += n) {
+    n = len - i < chunk ? len - i : chunk;
+    res = uzlib_inflate_write(s, in + i, n, outWrite, out);
+  }
+  uzlib_inflate_end(s);
+  return res != UZLIB_DONE;
+}
+
+static int windowBits(void) {
+  int bits = 9;
+  while ((1u << bits) < window)
+    bits++;
+  return bits;
+}
+
+static int zCompress(const uchar *in, size_t len, outBuf *out, int level, int strategy) {
+  z_stream z;
+  int res;
+  memset(&z, 0, sizeof(z));
+  z.zalloc = zalloc, z.zfree = zfree;
+  if (deflateInit2(&z, level, Z_DEFLATED, 16 + windowBits(), 8, strategy) != Z_OK)
+    return 1;
+  outReset(out, deflateBound(&z, len));
+  z.next_in = (uchar *) in, z.avail_in = len;
+  z.next_out = out->buf, z.avail_out = out->size;
+  res = deflate(&z, Z_FINISH);
+  out->len = z.total_out;
+  deflateEnd(&z);
+  return res != Z_STREAM_END;
+}
+
+static int zDecompress(const uchar *in, size_t len, outBuf *out) {
+  z_stream z;
+  uchar buf[4096];
+  int res = Z_OK;
+  memset(&z, 0, sizeof(z));
+  z.zalloc = zalloc, z.zfree = zfree;
+  if (inflateInit2(&z, 16 + windowBits()) != Z_OK)
+    return 1;
+  outReset(out, 0);
+  z.next_in = (uchar *) in, z.avail_in = len;
+  while (res == Z_OK) {
+    z.next_out = buf, z.avail_out = sizeof(buf);
+    res = inflate(&z, Z_NO_FLUSH);
+    outWrite(out, buf, sizeof(buf) - z.avail_out);
+  }
+  inflateEnd(&z);
+  return res != Z_STREAM_END;
+}
+
+static const codec codecs[] = {
+  {"uzlib-record", 0, 0, uzRecCompress, uzRecDecompress},
+  {"uzlib-stream", 0, 0, uzStreamCompress, uzStreamDecompress},
+  {"zlib-1",  1, Z_DEFAULT_STRATEGY, zCompress, zDecompress},
+  {"zlib-6",  6, Z_DEFAULT_STRATEGY, zCompress, zDecompress},
+  {"zlib-9",  9, Z_DEFAULT_STRATEGY, zCompress, zDecompress},
+  /* static Huffman coding only, as used by the uzlib compressor */
+  {"zlib-6F", 6, Z_FIXED, zCompress, zDecompress},
+};
+#define NCODECS (sizeof(codecs)/sizeof(*codecs))
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+  size_t inTotal, outTotal;
+  double cTime, dTime;     /* seconds per pass, summed over files */
+  size_t cPeak, dPeak;     /* largest peak over all files */
+  int failed;
+} result;
+
+/* Returns the average time of a single call, repeated for at least secs */
+#define TIME_LOOP(secs, ok, call) do {                                 \
+    double t0 = now(), t;                                              \
+    long n = 0;                                                        \
+    do { ok = ok && (call) == 0; n++; } while ((t = now() - t0) < secs && ok); \
+    elapsed = t / n;                                                   \
+  } while (0)
+
+static void benchFile(const codec *c, result *r, const uchar *in, size_t len, double secs,
+                      outBuf *comp, outBuf *decomp) {
+  double elapsed;
+  int ok = 1;
+
+  heapNow = heapPeak = 0;
+  ok = c->compress(in, len, comp, c->level, c->strategy) == 0;
+  if (heapPeak > r->cPeak)
+    r->cPeak = heapPeak;
+
+  heapNow = heapPeak = 0;
+  ok = ok && c->decompress(comp->buf, comp->len, decomp) == 0 &&
+       decomp->len == len && memcmp(decomp->buf, in, len) == 0;
+  if (heapPeak > r->dPeak)
+    r->dPeak = heapPeak;
+
+  if (!ok) {
+    r->failed++;
+    return;
+  }
+  r->inTotal  += len;
+  r->outTotal += comp->len;
+  TIME_LOOP(secs, ok, c->compress(in, len, comp, c->level, c->strategy));
+  r->cTime += elapsed;
+  TIME_LOOP(secs, ok, c->decompress(comp->buf, comp->len, decomp));
+  r->dTime += elapsed;
+}
+
+static void report(const char *name, const result *r) {
+  if (r->failed) {
+    printf("%-14s  ROUND TRIP FAILED on %d file(s)\n", name, r->failed);
+    return;
+  }
+  printf("%-14s %10zu %10zu %6.1f%% %9.2f %9.2f %9zu %9zu\n", name,
+         r->inTotal, r->outTotal, r->inTotal ? 100.0 * r->outTotal / r->inTotal : 0.0,
+         r->cTime > 0 ? r->inTotal / r->cTime / 1e6 : 0.0,
+         r->dTime > 0 ? r->inTotal / r->dTime / 1e6 : 0.0,
+         r->cPeak, r->dPeak);
+}
+
+static uchar *readFile(const char *name, size_t *len) {
+  FILE *f = fopen(name, "rb");
+  uchar *buf = NULL;
+  long n;
+  if (f && fseek(f, 0, SEEK_END) == 0 && (n = ftell(f)) >= 0 &&
+      fseek(f, 0, SEEK_SET) == 0 && (buf = malloc(n ? n : 1)) != NULL &&
+      fread(buf, 1, n, f) == (size_t) n) {
+    *len = n;
+  } else {
+    free(buf);
+    buf = NULL;
+  }
+  if (f)
+    fclose(f);
+  return buf;
+}
+
+static void usage(void) {
+  fprintf(stderr, "Usage: uz_bench [-v] [-w window] [-c chunk] [-t secs] file...\n");
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  result total[NCODECS];
+  outBuf comp = {0}, decomp = {0};
+  double secs = DEFAULT_SECS;
+  int opt, verbose = 0, i, j;
+
+  while ((opt = getopt(argc, argv, "vw:c:t:")) != -1) {
+    switch (opt) {
+      case 'v': verbose = 1; break;
+      case 'w': window = atoi(optarg); break;
+      case 'c': chunk = atoi(optarg); break;
+      case 't': secs = atof(optarg); break;
+      default:  usage();
+    }
+  }
+  if (optind >= argc || chunk == 0 || window < UZLIB_WINDOW_MIN ||
+      window > UZLIB_WINDOW_MAX || (window & (window - 1)))
+    usage();
+
+  printf("window %u, chunk %u, chain limit %s, hash ratio %s\n\n", window, chunk,
+         CHAIN_LIMIT, HASH_RATIO);
+  printf("%-14s %10s %10s %7s %9s %9s %9s %9s\n", "codec", "in", "out", "ratio",
+         "comp MB/s", "dec MB/s", "comp heap", "dec heap");
+  memset(total, 0, sizeof(total));
+
+  for (i = optind; i < argc; i++) {
+    size_t len;
+    uchar *in = readFile(argv[i], &len);
+    if (!in) {
+      fprintf(stderr, "Cannot read %s\n", argv[i]);
+      return 1;
+    }
+    if (verbose)
+      printf("%s\n", argv[i]);
+    for (j = 0; j < NCODECS; j++) {
+      result r;
+      memset(&r, 0, sizeof(r));
+      benchFile(codecs + j, &r, in, len, secs, &comp, &decomp);
+      if (verbose)
+        report(codecs[j].name, &r);
+      total[j].inTotal  += r.inTotal;
+      total[j].outTotal += r.outTotal;
+      total[j].cTime    += r.cTime;
+      total[j].dTime    += r.dTime;
+      total[j].failed   += r.failed;
+      if (r.cPeak > total[j].cPeak) total[j].cPeak = r.cPeak;
+      if (r.dPeak > total[j].dPeak) total[j].dPeak = r.dPeak;
+    }
+    free(in);
+  }
+
+  if (verbose)
+    printf("total\n");
+  for (j = 0; j < NCODECS; j++)
+    report(codecs[j].name, total + j);
+
+  free(comp.buf);
+  free(decomp.buf);
+  for (j = 0; j < NCODECS; j++)
+    if (total[j].failed)
+      return 1;
+  return 0;
+}
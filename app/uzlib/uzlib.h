@@ -15,8 +15,16 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+/* These may be overridden, e.g. to instrument allocation in host tests */
+#ifdef uz_malloc
+void *uz_malloc(size_t n);
+void *uz_realloc(void *p, size_t n);
+void uz_free(void *p);
+#else
 #define uz_malloc malloc
+#define uz_realloc realloc
 #define uz_free free
+#endif
 
 #if defined(__XTENSA__)
 
@@ -70,8 +78,47 @@ int uzlib_inflate (uint8_t (*)(void), void (*)(uint8_t),
 int uzlib_compress (uint8_t **dest, uint32_t *destLen,
                     const uint8_t *src, uint32_t srcLen);
 
+/*
+ * Stream API.  Input is supplied in arbitrary sized chunks and output is
+ * passed to the out() callback in chunks of at most the window size, so
+ * payloads of any length can be processed in a fixed amount of RAM.  The
+ * window is the LZ77 dictionary size, a power of 2 between 512 and 32768
+ * bytes.  An inflate window must be at least as large as the largest match
+ * distance used by the compressor.
+ */
+
+/* stream formats; AUTO accepts either a Zlib or a Gzip header */
+#define UZLIB_FORMAT_AUTO  0
+#define UZLIB_FORMAT_RAW   1
+#define UZLIB_FORMAT_ZLIB  2
+#define UZLIB_FORMAT_GZIP  3
+
+#define UZLIB_WINDOW_MIN   512
+#define UZLIB_WINDOW_MAX   32768
+
+typedef struct uzlib_stream UZLIB_STREAM;
+typedef struct uzlib_dstream UZLIB_DSTREAM;
+typedef void (*uzlib_out_fn)(void *arg, const uint8_t *data, uint32_t len);
+
+/* Returns NULL if out of memory */
+UZLIB_STREAM *uzlib_inflate_init (uint32_t window, int format);
+/* Returns UZLIB_OK if more input is needed, UZLIB_DONE at the end of */
+/* the compressed stream (any further input is ignored), or an error  */
+int uzlib_inflate_write (UZLIB_STREAM *s, const uint8_t *in, uint32_t len,
+                         uzlib_out_fn out, void *arg);
+void uzlib_inflate_end (UZLIB_STREAM *s);
+
+/* Returns NULL if out of memory; AUTO is treated as GZIP */
+UZLIB_DSTREAM *uzlib_deflate_init (uint32_t window, int format);
+/* Compress the input; when finish is set, the stream is completed */
+int uzlib_deflate_write (UZLIB_DSTREAM *s, const uint8_t *in, uint32_t len,
+                         int finish, uzlib_out_fn out, void *arg);
+void uzlib_deflate_end (UZLIB_DSTREAM *s);
+
 /* Checksum API */
 /* crc is previous value for incremental computation, 0xffffffff initially */
 uint32_t uzlib_crc32(const void *data, uint32_t length, uint32_t crc);
+/* adler is previous value for incremental computation, 1 initially */
+uint32_t uzlib_adler32(const void *data, uint32_t length, uint32_t adler);
 
 #endif /* UZLIB_INFLATE_H */
@@ -94,8 +94,6 @@ Copyright statement B for genlz77 functions:
 #include <assert.h>
 #include "uzlib.h"
 
-jmp_buf unwindAddr;
-
 /* Minimum and maximum length of matches to look for, inclusive */
 #define MIN_MATCH      3
 #define MAX_MATCH      258
@@ -106,6 +104,17 @@ jmp_buf unwindAddr;
 #if MIN_MATCH < 3
 #error "Encoding requires a minium match of 3 bytes"
 #endif
+/*
+ * Match search tuning: the most hash chain links followed per match, and
+ * log2 of the number of chain slots per hash slot.  These can be set with
+ * -D to evaluate alternatives on the host; see host/uz_bench.c
+ */
+#ifndef UZLIB_CHAIN_LIMIT
+#define UZLIB_CHAIN_LIMIT 60
+#endif
+#ifndef UZLIB_HASH_RATIO
+#define UZLIB_HASH_RATIO  2
+#endif
 
 #define SIZE(a) (sizeof(a)/sizeof(*a)) /* no of elements in array */
 #ifdef __XTENSA__
@@ -130,7 +139,6 @@ int debugCounts[20];
 #define DBG_ADD_COUNT(n,m)
 #endif
 
-int dbg_break(void) {return 1;}
 
 typedef struct {
   ushort code, extraBits, min, max;
@@ -253,7 +261,7 @@ void resizeBuffer(void) {
   /* out of space then extropolate size using current compression */
   double newEstimate = (((double) oBuf->len)*oBuf->inLen) / oBuf->inNdx;
   oBuf->size = 128 + (uint) newEstimate;
-  if (!(nb = realloc(oBuf->buffer, oBuf->size)))
+  if (!(nb = uz_realloc(oBuf->buffer, oBuf->size)))
     UZLIB_THROW(UZLIB_MEMORY_ERROR);
   oBuf->buffer = nb;
 }
@@ -463,7 +471,7 @@ void uzlibCompressBlock(const uchar *src, uint srcLen) {
     hashTable[hash] = iOffset;
     hashChain[iOffset & (MAX_OFFSET-1)] = nextOffset;
 
-    for (l = 0; nextOffset != NULL_OFFSET && l<60; l++) {
+    for (l = 0; nextOffset != NULL_OFFSET && l<UZLIB_CHAIN_LIMIT; l++) {
       DBG_COUNT(11);
 
       /* handle the case where base has bumped */
@@ -536,9 +544,9 @@ int uzlib_compress (uchar **dest, uint *destLen, const uchar *src, uint srcLen)
 
   /* The hash table has 4K slots for a 16K chain and scaling down */
   /* accordingly, for an average chain length of 4 links or thereabouts */
-  for (i = 256, j = 8 - 2; i < chainLen; i <<= 1)
+  for (i = 256, j = 8 - UZLIB_HASH_RATIO; i < chainLen; i <<= 1)
     j++;
-  hashSlots = i >> 2;
+  hashSlots = i >> UZLIB_HASH_RATIO;
 
   if ((status = UZLIB_SETJMP(unwindAddr)) == 0) {
     initTables(chainLen, hashSlots);
@@ -571,7 +579,7 @@ int uzlib_compress (uchar **dest, uint *destLen, const uchar *src, uint srcLen)
   for (i=0; i<20;i++) DBG_PRINT("count %u = %u\n",i,debugCounts[i]);
 
   if (status == UZLIB_OK) {
-    uchar *trimBuf = realloc(oBuf->buffer, oBuf->len);
+    uchar *trimBuf = uz_realloc(oBuf->buffer, oBuf->len);
     *dest = trimBuf ? trimBuf : oBuf->buffer;
     *destLen = oBuf->len;
   } else {
@@ -584,3 +592,261 @@ int uzlib_compress (uchar **dest, uint *destLen, const uchar *src, uint srcLen)
 
   return status;
 }
+
+/*
+ * Stream compression.  Unlike uzlib_compress() above, which needs the
+ * whole input in RAM, this keeps a circular buffer of twice the window
+ * size: up to a window's worth of history to search for matches and a
+ * lookahead which is filled from each chunk of input.  The hash table and
+ * chains are indexed by 16-bit positions modulo 64K, and every candidate
+ * is checked against the buffer contents, so stale entries only cost a
+ * compare and the tables never need rebasing.  The whole stream is coded
+ * as a single static Huffman block, as above, so output can be passed to
+ * the caller in arbitrary sized chunks.
+ */
+#define STREAM_OBUF_SIZE   128
+
+struct uzlib_dstream {
+  int    format, finished;
+  uint   window;                 /* maximum match distance */
+  uint   mask;                   /* buffer size - 1 */
+  uint   pos, end;               /* next byte to code, end of input */
+  uint   lastLen, lastOffset;    /* pending lazy match */
+  uint   checksum, bits, nBits;
+  uint   hashShift, hashMask;
+  ushort *hashTable;             /* last position with each hash */
+  ushort *hashChain;             /* distance to previous with same hash */
+  uint   oLen;
+  uchar  oBuf[STREAM_OBUF_SIZE];
+  uchar  buf[1];                 /* circular buffer, mask+1 bytes */
+};
+
+static void stream_out (UZLIB_DSTREAM *s, uzlib_out_fn out, void *arg) {
+  if (s->oLen && out)
+    out(arg, s->oBuf, s->oLen);
+  s->oLen = 0;
+}
+
+static void stream_bits (UZLIB_DSTREAM *s, uint bits, int nBits,
+                         uzlib_out_fn out, void *arg) {
+  s->bits  |= bits << s->nBits;
+  s->nBits += nBits;
+  while (s->nBits >= 8) {
+    if (s->oLen == STREAM_OBUF_SIZE)
+      stream_out(s, out, arg);
+    s->oBuf[s->oLen++] = s->bits & 0xFF;
+    s->bits >>= 8;
+    s->nBits -= 8;
+  }
+}
+
+/* Huffman codes are sent MSB first, so reverse them in the bitstream */
+static void stream_code (UZLIB_DSTREAM *s, uint code, int nBits,
+                         uzlib_out_fn out, void *arg) {
+  uint rev = 0;
+  int i;
+  for (i = 0; i < nBits; i++, code >>= 1)
+    rev = (rev << 1) | (code & 1);
+  stream_bits(s, rev, nBits, out, arg);
+}
+
+static void stream_literal (UZLIB_DSTREAM *s, uint c,
+                            uzlib_out_fn out, void *arg) {
+  if (c <= 143)
+    stream_code(s, 0x30 + c, 8, out, arg);
+  else if (c <= 255)
+    stream_code(s, 0x190 - 144 + c, 9, out, arg);
+  else if (c <= 279)
+    stream_code(s, c - 256, 7, out, arg);
+  else
+    stream_code(s, 0xc0 - 280 + c, 8, out, arg);
+}
+
+/* Returns the index of the top bit set in v (v > 0) */
+static int top_bit (uint v) {
+  return 31 - __builtin_clz(v);
+}
+
+/*
+ * The length and distance codes of RFC 1951 sec 3.2.5 are computed rather
+ * than looked up: above the first few, each pair of distance codes (or
+ * four length codes) shares a number of extra bits which rises by one.
+ */
+static void stream_copy (UZLIB_DSTREAM *s, uint distance, uint len,
+                         uzlib_out_fn out, void *arg) {
+  uint n = len - MIN_MATCH, d = distance - 1;
+  int e;
+
+  if (len == MAX_MATCH) {
+    stream_literal(s, 285, out, arg);
+  } else if (n < 8) {
+    stream_literal(s, 257 + n, out, arg);
+  } else {
+    e = top_bit(n) - 2;
+    stream_literal(s, 257 + 4*(e + 1) + ((n >> e) & 3), out, arg);
+    stream_bits(s, n & ((1 << e) - 1), e, out, arg);
+  }
+
+  if (d < 4) {
+    stream_code(s, d, 5, out, arg);
+  } else {
+    e = top_bit(d) - 1;
+    stream_code(s, 2*(e + 1) + ((d >> e) & 1), 5, out, arg);
+    stream_bits(s, d & ((1 << e) - 1), e, out, arg);
+  }
+}
+
+/* Code the buffered input, keeping MAX_MATCH lookahead unless finishing */
+static void stream_compress (UZLIB_DSTREAM *s, int finish,
+                             uzlib_out_fn out, void *arg) {
+  const uchar *buf = s->buf;
+  uint mask = s->mask;
+
+  while (s->end - s->pos > (finish ? MIN_MATCH - 1 : MAX_MATCH)) {
+    uint i = s->pos, maxLen = s->end - i;
+    uint matchLen = MIN_MATCH - 1, matchOffset = 0;
+    uint v    = (buf[i & mask] << 16) | (buf[(i+1) & mask] << 8) | buf[(i+2) & mask];
+    uint hash = ((v >> s->hashShift) - v) & s->hashMask;
+    uint dist = (i - s->hashTable[hash]) & 0xFFFF;
+    int l;
+
+    if (maxLen > MAX_MATCH)
+      maxLen = MAX_MATCH;
+    s->hashTable[hash] = i;
+    s->hashChain[i & (s->window - 1)] = dist <= s->window ? dist : 0;
+
+    /* see uzlibCompressBlock() for the lazy match procedure */
+    for (l = 0; dist && dist <= s->window && dist <= i && l < UZLIB_CHAIN_LIMIT; l++) {
+      uint j = i - dist, k, step;
+      for (k = 0; k < maxLen && buf[(i+k) & mask] == buf[(j+k) & mask]; k++)
+        {}
+      if (k > matchLen) {
+        matchOffset = dist;
+        matchLen = k;
+      }
+      step = s->hashChain[j & (s->window - 1)];
+      if (!step)
+        break;
+      dist += step;
+    }
+
+    if (s->lastOffset) {
+      if (matchOffset == 0 || s->lastLen >= matchLen) {
+        stream_copy(s, s->lastOffset, s->lastLen, out, arg);
+        s->pos += s->lastLen - 1;
+        s->lastOffset = s->lastLen = 0;
+        continue;
+      }
+      stream_literal(s, buf[(i-1) & mask], out, arg);
+      s->lastOffset = matchOffset;
+      s->lastLen = matchLen;
+    } else if (matchOffset) {
+      s->lastOffset = matchOffset;
+      s->lastLen = matchLen;
+    } else {
+      stream_literal(s, buf[i & mask], out, arg);
+    }
+    s->pos++;
+  }
+
+  if (finish) {
+    if (s->lastOffset) {                /* flush cached match if any */
+      stream_copy(s, s->lastOffset, s->lastLen, out, arg);
+      s->pos += s->lastLen - 1;
+      s->lastOffset = s->lastLen = 0;
+    }
+    while (s->pos < s->end)            /* and the last few bytes */
+      stream_literal(s, buf[s->pos++ & mask], out, arg);
+  }
+}
+
+UZLIB_DSTREAM *uzlib_deflate_init (uint window, int format) {
+  UZLIB_DSTREAM *s;
+  uint hashSlots = window >> UZLIB_HASH_RATIO, i;
+
+  if (window < UZLIB_WINDOW_MIN || window > UZLIB_WINDOW_MAX ||
+      (window & (window - 1)))
+    return NULL;
+  /* single malloc for the stream, its buffer, the hash table and chains */
+  s = uz_malloc(sizeof(*s) + 2*window - 1 + (hashSlots + window)*sizeof(ushort));
+  if (!s)
+    return NULL;
+  memset(s, 0, sizeof(*s));
+  s->format    = format == UZLIB_FORMAT_AUTO ? UZLIB_FORMAT_GZIP : format;
+  s->window    = window;
+  s->mask      = 2*window - 1;
+  s->hashTable = (ushort *)(((uintptr_t) (s->buf + 2*window) + 1) & ~1);
+  s->hashChain = s->hashTable + hashSlots;
+  s->hashMask  = hashSlots - 1;
+  for (i = 0; (1u << i) < hashSlots; i++)
+    {}
+  s->hashShift = 24 - i;
+  memset(s->hashTable, 0, (hashSlots + window)*sizeof(ushort));
+
+  if (s->format == UZLIB_FORMAT_GZIP) {
+    static const uchar gzip_hdr[] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+    memcpy(s->oBuf, gzip_hdr, sizeof(gzip_hdr));
+    s->oLen = sizeof(gzip_hdr);
+    s->checksum = ~0;
+  } else if (s->format == UZLIB_FORMAT_ZLIB) {
+    uint cmf = ((top_bit(window) - 8) << 4) | 8;
+    s->oBuf[0] = cmf;
+    s->oBuf[1] = 31 - (cmf << 8) % 31;
+    s->oLen = 2;
+    s->checksum = 1;
+  }
+  stream_bits(s, 1, 1, NULL, NULL);     /* Final block */
+  stream_bits(s, 1, 2, NULL, NULL);     /* Static huffman block */
+  return s;
+}
+
+int uzlib_deflate_write (UZLIB_DSTREAM *s, const uchar *in, uint len,
+                         int finish, uzlib_out_fn out, void *arg) {
+  if (s->finished)
+    return UZLIB_DONE;
+
+  if (s->format == UZLIB_FORMAT_GZIP)
+    s->checksum = uzlib_crc32(in, len, s->checksum);
+  else if (s->format == UZLIB_FORMAT_ZLIB)
+    s->checksum = uzlib_adler32(in, len, s->checksum);
+
+  while (len) {
+    /* the buffer must keep window bytes of history before pos */
+    uint i = s->end & s->mask;
+    uint n = s->pos + s->window - s->end;
+    if (n > len)
+      n = len;
+    if (n > s->mask + 1 - i)
+      n = s->mask + 1 - i;
+    memcpy(s->buf + i, in, n);
+    s->end += n;
+    in += n;
+    len -= n;
+    stream_compress(s, 0, out, arg);
+  }
+
+  if (finish) {
+    uint sum = s->checksum;
+    int i;
+    stream_compress(s, 1, out, arg);
+    stream_literal(s, 256, out, arg);    /* close block */
+    stream_bits(s, 0, (8 - s->nBits) & 7, out, arg);  /* byte align */
+    if (s->format == UZLIB_FORMAT_GZIP) {
+      sum = ~sum;
+      for (i = 0; i < 4; i++)
+        stream_bits(s, (sum >> 8*i) & 0xFF, 8, out, arg);
+      for (i = 0; i < 4; i++)
+        stream_bits(s, (s->end >> 8*i) & 0xFF, 8, out, arg);
+    } else if (s->format == UZLIB_FORMAT_ZLIB) {
+      for (i = 3; i >= 0; i--)
+        stream_bits(s, (sum >> 8*i) & 0xFF, 8, out, arg);
+    }
+    s->finished = 1;
+  }
+  stream_out(s, out, arg);
+  return finish ? UZLIB_DONE : UZLIB_OK;
+}
+
+void uzlib_deflate_end (UZLIB_DSTREAM *s) {
+  FREE(s);
+}
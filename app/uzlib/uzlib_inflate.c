@@ -58,9 +58,6 @@ int debugCounts[20];
 
 #define SIZE(arr) (sizeof(arr) / sizeof(*(arr)))
 
-jmp_buf unwindAddr;
-int dbg_break(void) {return 1;}
-
 typedef uint8_t  uchar;
 typedef uint16_t ushort;
 typedef uint32_t uint;
@@ -436,10 +433,21 @@ static int inflate_uncompressed_block (UZLIB_DATA *d) {
  * -- main parse functions -- *
  * -------------------------- */
 
-static int parse_gzip_header(UZLIB_DATA *d) {
+static void init_tables(UZLIB_DATA *d) {
+  /* create RAM copy of clcidx byte array */
+  memcpy(d->clcidx, CLCIDX_INIT, sizeof(d->clcidx));
+
+  /* build extra bits and base tables */
+  build_bits_base(d->lengthBits, d->lengthBase, 4, 3);
+  build_bits_base(d->distBits, d->distBase, 2, 1);
+  d->lengthBits[28] = 0;              /* fix a special case */
+  d->lengthBase[28] = 258;
+}
+
+static int parse_gzip_header(UZLIB_DATA *d, uchar id1) {
 
   /* check id bytes */
-  if (d->get_byte() != 0x1f || d->get_byte() != 0x8b)
+  if (id1 != 0x1f || d->get_byte() != 0x8b)
     return UZLIB_DATA_ERROR;
 
   if (d->get_byte() != 8) /* check method is deflate */
@@ -577,16 +585,9 @@ int uzlib_inflate (
     return res;
   }
 
-  /* create RAM copy of clcidx byte array */
-  memcpy(d->clcidx, CLCIDX_INIT, sizeof(d->clcidx));
-
-  /* build extra bits and base tables */
-  build_bits_base(d->lengthBits, d->lengthBase, 4, 3);
-  build_bits_base(d->distBits, d->distBase, 2, 1);
-  d->lengthBits[28] = 0;              /* fix a special case */
-  d->lengthBase[28] = 258;
+  init_tables(d);
 
-  if ((res = parse_gzip_header(d))== UZLIB_OK)
+  if ((res = parse_gzip_header(d, d->get_byte()))== UZLIB_OK)
     while ((res = uncompress_stream(d)) == UZLIB_OK)
       {}
 
@@ -597,3 +598,303 @@ int uzlib_inflate (
 
   UZLIB_THROW(res);
 }
+
+/* ------------------------------ *
+ * -- stream inflate functions -- *
+ * ------------------------------ */
+
+/*
+ * The decoder above pulls its input a byte at a time, so to accept input
+ * in chunks as it arrives, the decoder state is checkpointed before each
+ * step, where a step is a header, trailer, block header, or the symbol
+ * producing the next output byte.  If the input runs out mid-step then the
+ * get_byte CB longjmps out, the state is rolled back to the checkpoint and
+ * the bytes consumed since then are held back to be replayed on the next
+ * write.  As each step produces at most one byte and only does so after all
+ * of its input has been read, no output is ever repeated.
+ *
+ * Output is written to a circular window, which also serves as the
+ * dictionary, and is passed to the caller whenever the window is full.
+ */
+
+#define UZLIB_NEED_INPUT  2      /* internal status: step ran out of input */
+#define HOLD_MAX          1024   /* largest step, e.g. the dynamic trees   */
+
+enum { PHASE_HEADER, PHASE_GZIP_FIELDS, PHASE_DATA, PHASE_TRAILER, PHASE_END };
+
+typedef struct {
+  uint tag, bitcount, lzOffs, curLen;
+  int  bType, bFinal;
+  uint holdPos, inPos;
+} CHECKPOINT;
+
+struct uzlib_stream {
+  UZLIB_DATA d;
+  CHECKPOINT cp;
+  int  format, phase, status;
+  uint checksum, trailerSum, trailerLen;
+  uint gzFlags, gzSkip;          /* optional gzip header fields still to skip */
+  const uchar *in;               /* current input chunk */
+  uint inLen, inPos;
+  uchar *hold;                   /* input held back from the last chunk */
+  uint holdLen, holdPos, holdSize;
+  uint outPos, flushPos;         /* total output, and how much passed on */
+  uint winMask;
+  uchar win[1];                  /* window, winMask+1 bytes */
+};
+
+static UZLIB_STREAM *active;
+
+static uchar stream_get_byte (void) {
+  UZLIB_STREAM *s = active;
+  if (s->holdPos < s->holdLen)
+    return s->hold[s->holdPos++];
+  if (s->inPos < s->inLen)
+    return s->in[s->inPos++];
+  UZLIB_THROW(UZLIB_NEED_INPUT);
+}
+
+static void stream_put_byte (uchar b) {
+  active->win[active->outPos++ & active->winMask] = b;
+}
+
+static uchar stream_recall_byte (uint offset) {
+  UZLIB_STREAM *s = active;
+  if (offset > s->winMask + 1 || offset > s->outPos)
+    UZLIB_THROW(UZLIB_DICT_ERROR);
+  return s->win[(s->outPos - offset) & s->winMask];
+}
+
+static void stream_checkpoint (UZLIB_STREAM *s) {
+  UZLIB_DATA *d = &s->d;
+  s->cp = (CHECKPOINT) {d->tag, d->bitcount, d->lzOffs, d->curLen,
+                        d->bType, d->bFinal, s->holdPos, s->inPos};
+}
+
+/* Roll back to the checkpoint and hold back the unprocessed input */
+static int stream_rollback (UZLIB_STREAM *s) {
+  UZLIB_DATA *d = &s->d;
+  uint held = s->holdLen - s->cp.holdPos, need = held + s->inLen - s->cp.inPos;
+
+  d->tag     = s->cp.tag;
+  d->bitcount= s->cp.bitcount;
+  d->lzOffs  = s->cp.lzOffs;
+  d->curLen  = s->cp.curLen;
+  d->bType   = s->cp.bType;
+  d->bFinal  = s->cp.bFinal;
+
+  if (need > HOLD_MAX)
+    return UZLIB_DATA_ERROR;
+  if (need > s->holdSize) {
+    uchar *hold = uz_realloc(s->hold, need);
+    if (!hold)
+      return UZLIB_MEMORY_ERROR;
+    s->hold = hold;
+    s->holdSize = need;
+  }
+  memmove(s->hold, s->hold + s->cp.holdPos, held);
+  memcpy(s->hold + held, s->in + s->cp.inPos, s->inLen - s->cp.inPos);
+  s->holdLen = need;
+  s->holdPos = 0;
+  s->inPos = s->inLen;
+  return UZLIB_OK;
+}
+
+static uint get_be_uint32 (UZLIB_DATA *d) {
+  uint v = (uint) d->get_byte() << 24;
+  v |= (uint) d->get_byte() << 16;
+  v |= (uint) d->get_byte() << 8;
+  return v | d->get_byte();
+}
+
+static int stream_header (UZLIB_STREAM *s) {
+  UZLIB_DATA *d = &s->d;
+  uchar cmf = d->get_byte();
+
+  if (s->format == UZLIB_FORMAT_GZIP ||
+      (s->format == UZLIB_FORMAT_AUTO && cmf == 0x1f)) {
+    /* only the fixed 10 byte header; the optional fields are skipped */
+    /* by stream_gzip_field() so that they needn't be held whole      */
+    if (cmf != 0x1f || d->get_byte() != 0x8b || d->get_byte() != 8)
+      return UZLIB_DATA_ERROR;
+    uchar flg = d->get_byte();
+    if (flg & 0xe0)
+      return UZLIB_DATA_ERROR;
+    skip_bytes(d, 6);
+    s->format = UZLIB_FORMAT_GZIP;
+    s->checksum = ~0;
+    s->gzFlags = flg;
+    s->phase = PHASE_GZIP_FIELDS;
+    return UZLIB_OK;
+  }
+
+  uchar flg = d->get_byte();
+  /* check method is deflate, the header check and that there is no dict */
+  if ((cmf & 0x0f) != 8 || ((cmf << 8) | flg) % 31 || (flg & 0x20))
+    return UZLIB_DATA_ERROR;
+  s->format = UZLIB_FORMAT_ZLIB;
+  s->checksum = 1;
+  s->phase = PHASE_DATA;
+  return UZLIB_OK;
+}
+
+/* Skip the next piece of the optional gzip header fields, a byte at a time */
+/* for the extra data, name and comment, as these can be of any length     */
+static int stream_gzip_field (UZLIB_STREAM *s) {
+  UZLIB_DATA *d = &s->d;
+
+  if (s->gzSkip) {
+    d->get_byte();
+    s->gzSkip--;
+  } else if (s->gzFlags & UZLIB_FEXTRA) {
+    s->gzSkip = get_uint16(d);
+    s->gzFlags &= ~UZLIB_FEXTRA;
+  } else if (s->gzFlags & UZLIB_FNAME) {
+    if (d->get_byte() == 0)
+      s->gzFlags &= ~UZLIB_FNAME;
+  } else if (s->gzFlags & UZLIB_FCOMMENT) {
+    if (d->get_byte() == 0)
+      s->gzFlags &= ~UZLIB_FCOMMENT;
+  } else {
+    if (s->gzFlags & UZLIB_FHCRC)
+      skip_bytes(d, 2);
+    s->phase = PHASE_DATA;
+  }
+  return UZLIB_OK;
+}
+
+/* Process the next step of the stream */
+static int stream_step (UZLIB_STREAM *s) {
+  UZLIB_DATA *d = &s->d;
+  int res;
+
+  switch (s->phase) {
+  case PHASE_HEADER:
+    return stream_header(s);
+
+  case PHASE_GZIP_FIELDS:
+    return stream_gzip_field(s);
+
+  case PHASE_DATA:
+    if (d->bType == -1) {
+      /* start a new block */
+      d->bFinal = getbit(d);
+      d->bType = read_bits(d, 2, 0);
+      if (d->bType == 1)
+        build_fixed_trees(&d->ltree, &d->dtree);
+      else if (d->bType == 2)
+        return decode_trees(d, &d->ltree, &d->dtree);
+      else if (d->bType == 3)
+        return UZLIB_DATA_ERROR;
+      return UZLIB_OK;
+    }
+    res = d->bType == 0 ? inflate_uncompressed_block(d) :
+                          inflate_block_data(d, &d->ltree, &d->dtree);
+    if (res == UZLIB_DONE) {
+      if (d->bFinal)
+        s->phase = s->format == UZLIB_FORMAT_RAW ? PHASE_END : PHASE_TRAILER;
+      d->bType = -1;
+      return s->phase == PHASE_END ? UZLIB_DONE : UZLIB_OK;
+    }
+    return res;
+
+  case PHASE_TRAILER:
+    /* the trailer starts on a byte boundary so discard any bits left */
+    if (s->format == UZLIB_FORMAT_GZIP) {
+      s->trailerSum = get_le_uint32(d);
+      s->trailerLen = get_le_uint32(d);
+    } else {
+      s->trailerSum = get_be_uint32(d);
+    }
+    s->phase = PHASE_END;
+    return UZLIB_DONE;
+  }
+  return UZLIB_DONE;
+}
+
+/* Pass any output not yet passed on to the caller */
+static void stream_flush (UZLIB_STREAM *s, uzlib_out_fn out, void *arg) {
+  while (s->flushPos != s->outPos) {
+    uint i = s->flushPos & s->winMask;
+    uint n = s->outPos - s->flushPos;
+    if (n > s->winMask + 1 - i)
+      n = s->winMask + 1 - i;
+    if (s->format == UZLIB_FORMAT_GZIP)
+      s->checksum = uzlib_crc32(s->win + i, n, s->checksum);
+    else if (s->format == UZLIB_FORMAT_ZLIB)
+      s->checksum = uzlib_adler32(s->win + i, n, s->checksum);
+    s->flushPos += n;
+    if (out)
+      out(arg, s->win + i, n);
+  }
+}
+
+UZLIB_STREAM *uzlib_inflate_init (uint window, int format) {
+  UZLIB_STREAM *s;
+
+  if (window < UZLIB_WINDOW_MIN || window > UZLIB_WINDOW_MAX ||
+      (window & (window - 1)))
+    return NULL;
+  s = (UZLIB_STREAM *) uz_malloc(sizeof(*s) + window - 1);
+  if (!s)
+    return NULL;
+  memset(s, 0, sizeof(*s));
+  init_tables(&s->d);
+  s->d.bType       = -1;
+  s->d.get_byte    = stream_get_byte;
+  s->d.put_byte    = stream_put_byte;
+  s->d.recall_byte = stream_recall_byte;
+  s->format  = format;
+  s->phase   = format == UZLIB_FORMAT_RAW ? PHASE_DATA : PHASE_HEADER;
+  s->winMask = window - 1;
+  s->status  = UZLIB_OK;
+  return s;
+}
+
+int uzlib_inflate_write (UZLIB_STREAM *s, const uchar *in, uint len,
+                         uzlib_out_fn out, void *arg) {
+  s->in    = in;
+  s->inLen = len;
+  s->inPos = 0;
+
+  while (s->status == UZLIB_OK) {
+    int res;
+    /* Note that out() can call back into this library, so it is */
+    /* only ever called outside of the scope of this setjmp      */
+    if ((res = UZLIB_SETJMP(unwindAddr)) == 0) {
+      active = s;
+      while (s->outPos - s->flushPos <= s->winMask) {
+        stream_checkpoint(s);
+        if ((res = stream_step(s)) != UZLIB_OK)
+          break;
+        if (s->holdPos == s->holdLen)
+          s->holdPos = s->holdLen = 0;
+      }
+    }
+    if (res == UZLIB_NEED_INPUT) {
+      res = stream_rollback(s);
+      stream_flush(s, out, arg);
+      if (res == UZLIB_OK)
+        return UZLIB_OK;
+    } else {
+      stream_flush(s, out, arg);
+    }
+    if (res == UZLIB_DONE) {
+      if (s->format == UZLIB_FORMAT_GZIP &&
+          (~s->checksum != s->trailerSum || s->outPos != s->trailerLen))
+        res = UZLIB_CHKSUM_ERROR;
+      else if (s->format == UZLIB_FORMAT_ZLIB && s->checksum != s->trailerSum)
+        res = UZLIB_CHKSUM_ERROR;
+    }
+    if (res != UZLIB_OK)
+      s->status = res;
+  }
+  return s->status;
+}
+
+void uzlib_inflate_end (UZLIB_STREAM *s) {
+  if (s) {
+    uz_free(s->hold);
+    uz_free(s);
+  }
+}
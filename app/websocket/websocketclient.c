@@ -285,246 +285,207 @@ static void ws_sendPingTimeout(void *arg) {
   ws->unhealthyPoints += 1;
 }
 
-static void ws_receiveCallback(void *arg, char *buf, unsigned short len) {
-  NODE_DBG("ws_receiveCallback %d \n", len);
-  struct espconn *conn = (struct espconn *) arg;
-  ws_info *ws = (ws_info *) conn->reverse;
-
-  ws->unhealthyPoints = 0; // received data, connection is healthy
-  os_timer_disarm(&ws->timeoutTimer); // reset ping check
-  os_timer_arm(&ws->timeoutTimer, WS_PING_INTERVAL_MS, true);
+static void ws_abort(struct espconn *conn, ws_info *ws, int failureCode) {
+  ws->knownFailureCode = failureCode;
+  if (ws->isSecure)
+    espconn_secure_disconnect(conn);
+  else
+    espconn_disconnect(conn);
+}
 
+// Size of a frame header, once its first two bytes are known
+static int ws_headerLength(const unsigned char *h) {
+  int len = 2;
+  if ((h[1] & 0x7f) == 126) {
+    len += 2;
+  } else if ((h[1] & 0x7f) == 127) {
+    len += 8;
+  }
+  if (h[1] & 0x80) {
+    len += 4; // mask
+  }
+  return len;
+}
 
-  char *b = buf;
-  if (ws->frameBuffer != NULL) { // Append previous frameBuffer with new content
-    NODE_DBG("Appending new frameBuffer to old one \n");
+// Passes a piece of a data message on, in pieces of at most chunkSize bytes if set
+static void ws_deliver(ws_info *ws, char *data, int len, int opCode, int isLast) {
+  int chunk = ws->chunkSize > 0 && len > ws->chunkSize ? ws->chunkSize : len;
 
-    ws->frameBuffer = realloc(ws->frameBuffer, ws->frameBufferLen + len);
-    if (ws->frameBuffer == NULL) {
-      NODE_DBG("Failed to allocate new framebuffer, disconnecting...\n");
+  while (ws->onReceive && ws->connectionState == 3) {
+    ws->onReceive(ws, chunk, data, opCode, isLast && chunk == len);
+    data += chunk;
+    len -= chunk;
+    if (len == 0) {
+      break;
+    }
+    chunk = len > ws->chunkSize ? ws->chunkSize : len;
+  }
+}
 
-      ws->knownFailureCode = -8;
-      if (ws->isSecure)
-        espconn_secure_disconnect(conn);
-      else
-        espconn_disconnect(conn);
-      return;
+// The frame header is complete; returns false if the connection is being closed
+static bool ws_frameStart(struct espconn *conn, ws_info *ws, unsigned short available) {
+  const unsigned char *h = ws->rxHeader;
+  int offset = 2;
+  uint32_t payloadLength = h[1] & 0x7f;
+
+  if (payloadLength == 126) {
+    payloadLength = (h[2] << 8) | h[3];
+    offset = 4;
+  } else if (payloadLength == 127) {
+    if (h[2] | h[3] | h[4] | h[5]) {
+      NODE_DBG("Frame larger than 4GB, disconnecting...\n");
+      ws_abort(conn, ws, -8);
+      return false;
     }
-    memcpy(ws->frameBuffer + ws->frameBufferLen, b, len);
-
-    ws->frameBufferLen += len;
-
-    len = ws->frameBufferLen;
-    b = ws->frameBuffer;
-    NODE_DBG("New frameBufferLen: %d\n", len);
-  }
-
-  while (b != NULL) { // several frames can be present, b pointer will be moved to the next frame
-    NODE_DBG("b[0] = %d \n", b[0]);
-    NODE_DBG("b[1] = %d \n", b[1]);
-    NODE_DBG("b[2] = %d \n", b[2]);
-    NODE_DBG("b[3] = %d \n", b[3]);
-    NODE_DBG("b[4] = %d \n", b[4]);
-    NODE_DBG("b[5] = %d \n", b[5]);
-    NODE_DBG("b[6] = %d \n", b[6]);
-    NODE_DBG("b[7] = %d \n", b[7]);
-
-    int isFin = b[0] & 0x80 ? 1 : 0;
-    int opCode = b[0] & 0x0f;
-    int hasMask = b[1] & 0x80 ? 1 : 0;
-    uint64_t payloadLength = b[1] & 0x7f;
-    int bufOffset = 2;
-    if (payloadLength == 126) {
-      payloadLength = (b[2] << 8) + b[3];
-      bufOffset = 4;
-    } else if (payloadLength == 127) { // this will clearly not hold in heap, abort??
-      payloadLength = (b[2] << 24) + (b[3] << 16) + (b[4] << 8) + b[5];
-      bufOffset = 6;
+    payloadLength = ((uint32_t) h[6] << 24) | (h[7] << 16) | (h[8] << 8) | h[9];
+    offset = 10;
+  }
+
+  ws->rxFin = h[0] & 0x80 ? 1 : 0;
+  ws->rxOpCode = h[0] & 0x0f;
+  ws->rxMasked = h[1] & 0x80 ? 1 : 0;
+  if (ws->rxMasked) {
+    memcpy(ws->rxMask, h + offset, 4);
+  }
+  ws->rxMaskPos = 0;
+  ws->rxFrameLength = payloadLength;
+  ws->rxPayloadLeft = payloadLength;
+  ws->rxDirect = 0;
+  NODE_DBG("frame fin %d opCode %d length %d\n", ws->rxFin, ws->rxOpCode, payloadLength);
+
+  if (ws->rxOpCode & 0x08) { // control frame, may come in between the frames of a message
+    if (!ws->rxFin || payloadLength > sizeof(ws->rxControl)) {
+      NODE_DBG("Invalid control frame, disconnecting...\n");
+      ws_abort(conn, ws, -15);
+      return false;
     }
+    ws->rxControlLen = 0;
+    return true;
+  }
 
-    if (hasMask) {
-      int maskOffset = bufOffset;
-      bufOffset += 4;
+  if ((ws->rxOpCode == WS_OPCODE_CONTINUATION) != (ws->payloadOriginalOpCode != 0)) {
+    NODE_DBG("Continuation frame out of sequence, disconnecting...\n");
+    ws_abort(conn, ws, -15);
+    return false;
+  }
+  if (ws->rxOpCode != WS_OPCODE_CONTINUATION) {
+    ws->payloadOriginalOpCode = ws->rxOpCode;
+  }
 
-      int i;
-      for (i = 0; i < payloadLength; i++) {
-        b[bufOffset + i] ^= b[maskOffset + i % 4]; // apply mask to decode payload
-      }
+  if (ws->chunkSize > 0 || (ws->rxOpCode != WS_OPCODE_CONTINUATION && ws->rxFin && payloadLength <= available)) {
+    // streamed, or a whole message within the received data: no copy needed
+    ws->rxDirect = 1;
+  } else if (payloadLength > 0) {
+    // the peer chooses the length, so check it before growing the buffer
+    uint32_t limit = ws->maxMessageSize > 0 ? (uint32_t) ws->maxMessageSize : system_get_free_heap_size();
+    if (payloadLength > limit || ws->payloadBufferLen > limit - payloadLength) {
+      NODE_DBG("Message larger than %u bytes, disconnecting...\n", limit);
+      ws_abort(conn, ws, -9);
+      return false;
     }
-
-    if (payloadLength > len - bufOffset) {
-      NODE_DBG("INCOMPLETE Frame \n");
-      if (ws->frameBuffer == NULL) {
-        NODE_DBG("Allocing new frameBuffer \n");
-        ws->frameBuffer = calloc(1,len);
-        if (ws->frameBuffer == NULL) {
-          NODE_DBG("Failed to allocate framebuffer, disconnecting... \n");
-
-          ws->knownFailureCode = -9;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->frameBuffer, b, len);
-        ws->frameBufferLen = len;
-      }
-      break; // since the buffer were already concat'ed, wait for the next receive
+    // make room for the whole frame at once rather than for every segment
+    char *buffer = realloc(ws->payloadBuffer, ws->payloadBufferLen + payloadLength);
+    if (buffer == NULL) {
+      NODE_DBG("Failed to allocate payloadBuffer, disconnecting...\n");
+      ws_abort(conn, ws, -10);
+      return false;
     }
+    ws->payloadBuffer = buffer;
+  }
+  return true;
+}
 
-    if (!isFin) {
-      NODE_DBG("PARTIAL frame! Should concat payload and later restore opcode\n");
-      if(ws->payloadBuffer == NULL) {
-        NODE_DBG("Allocing new payloadBuffer \n");
-        ws->payloadBuffer = calloc(1,payloadLength);
-        if (ws->payloadBuffer == NULL) {
-          NODE_DBG("Failed to allocate payloadBuffer, disconnecting...\n");
-
-          ws->knownFailureCode = -10;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->payloadBuffer, b + bufOffset, payloadLength);
-        ws->frameBufferLen = payloadLength;
-        ws->payloadOriginalOpCode = opCode;
-      } else {
-        NODE_DBG("Appending new payloadBuffer to old one \n");
-        ws->payloadBuffer = realloc(ws->payloadBuffer, ws->payloadBufferLen + payloadLength);
-        if (ws->payloadBuffer == NULL) {
-          NODE_DBG("Failed to allocate new framebuffer, disconnecting...\n");
-
-          ws->knownFailureCode = -11;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->payloadBuffer + ws->payloadBufferLen, b + bufOffset, payloadLength);
-
-        ws->payloadBufferLen += payloadLength;
-      }
-    } else {
-      char *payload;
-      if (opCode == WS_OPCODE_CONTINUATION) {
-        NODE_DBG("restoring original opcode\n");
-        if (ws->payloadBuffer == NULL) {
-          NODE_DBG("Got FIN continuation frame but didn't receive any beforehand, disconnecting...\n");
-
-          ws->knownFailureCode = -15;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        // concat buffer with payload
-        payload = calloc(1,ws->payloadBufferLen + payloadLength);
-
-        if (payload == NULL) {
-          NODE_DBG("Failed to allocate new framebuffer, disconnecting...\n");
-
-          ws->knownFailureCode = -12;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(payload, ws->payloadBuffer, ws->payloadBufferLen);
-        memcpy(payload + ws->payloadBufferLen, b + bufOffset, payloadLength);
-
-        os_free(ws->payloadBuffer); // free previous buffer
-        ws->payloadBuffer = NULL;
-
-        payloadLength += ws->payloadBufferLen;
-        ws->payloadBufferLen = 0;
-
-        opCode = ws->payloadOriginalOpCode;
-        ws->payloadOriginalOpCode = 0;
-      } else {
-        int extensionDataOffset = 0;
+static void ws_framePayload(ws_info *ws, char *data, int len) {
+  int i;
 
-        if (opCode == WS_OPCODE_CLOSE && payloadLength > 0) {
-          unsigned int reasonCode = b[bufOffset] << 8 + b[bufOffset + 1];
-          NODE_DBG("Closing due to: %d\n", reasonCode); // Must not be shown to client as per spec
-          extensionDataOffset += 2;
-        }
+  if (ws->rxMasked) {
+    for (i = 0; i < len; i++) {
+      data[i] ^= ws->rxMask[ws->rxMaskPos++ & 3]; // apply mask to decode payload
+    }
+  }
+  ws->rxPayloadLeft -= len;
 
-        payload = calloc(1,payloadLength - extensionDataOffset + 1);
-        if (payload == NULL) {
-          NODE_DBG("Failed to allocate payload, disconnecting...\n");
+  if (ws->rxOpCode & 0x08) {
+    memcpy(ws->rxControl + ws->rxControlLen, data, len);
+    ws->rxControlLen += len;
+  } else if (ws->rxDirect) {
+    ws_deliver(ws, data, len, ws->payloadOriginalOpCode, ws->rxFin && ws->rxPayloadLeft == 0);
+  } else {
+    memcpy(ws->payloadBuffer + ws->payloadBufferLen, data, len);
+    ws->payloadBufferLen += len;
+  }
+}
 
-          ws->knownFailureCode = -13;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
+static void ws_frameEnd(struct espconn *conn, ws_info *ws) {
+  int opCode = ws->payloadOriginalOpCode;
 
-        memcpy(payload, b + bufOffset + extensionDataOffset, payloadLength - extensionDataOffset);
-        payload[payloadLength - extensionDataOffset] = '\0';
+  ws->rxHeaderLen = 0;
+  switch (ws->rxOpCode) {
+    case WS_OPCODE_CLOSE:
+      if (ws->rxControlLen >= 2) {
+        NODE_DBG("Closing due to: %d\n", (ws->rxControl[0] << 8) | (unsigned char) ws->rxControl[1]); // Must not be shown to client as per spec
       }
+      espconn_regist_sentcb(conn, ws_closeSentCallback);
+      ws_sendFrame(conn, WS_OPCODE_CLOSE, ws->rxControl, (unsigned short) ws->rxControlLen);
+      ws->connectionState = 4;
+      return;
+    case WS_OPCODE_PING:
+      ws_sendFrame(conn, WS_OPCODE_PONG, ws->rxControl, (unsigned short) ws->rxControlLen);
+      return;
+    case WS_OPCODE_PONG:
+      // ping alarm was already reset...
+      return;
+  }
 
-      NODE_DBG("isFin %d \n", isFin);
-      NODE_DBG("opCode %d \n", opCode);
-      NODE_DBG("hasMask %d \n", hasMask);
-      NODE_DBG("payloadLength %d \n", payloadLength);
-      NODE_DBG("len %d \n", len);
-      NODE_DBG("bufOffset %d \n", bufOffset);
-
-      if (opCode == WS_OPCODE_CLOSE) {
-        NODE_DBG("Closing message: %s\n", payload); // Must not be shown to client as per spec
-
-        espconn_regist_sentcb(conn, ws_closeSentCallback);
-        ws_sendFrame(conn, WS_OPCODE_CLOSE, (const char *) (b + bufOffset), (unsigned short) payloadLength);
-        ws->connectionState = 4;
-      } else if (opCode == WS_OPCODE_PING) {
-        ws_sendFrame(conn, WS_OPCODE_PONG, (const char *) (b + bufOffset), (unsigned short) payloadLength);
-      } else if (opCode == WS_OPCODE_PONG) {
-        // ping alarm was already reset...
-      } else {
-        if (ws->onReceive) ws->onReceive(ws, payloadLength, payload, opCode);
-      }
+  if (!ws->rxFin) {
+    return; // more of the message to come
+  }
+  ws->payloadOriginalOpCode = 0;
+  if (!ws->rxDirect) {
+    char *payload = ws->payloadBuffer;
+    int payloadLength = ws->payloadBufferLen;
+
+    ws->payloadBuffer = NULL;
+    ws->payloadBufferLen = 0;
+    ws_deliver(ws, payload ? payload : "", payloadLength, opCode, 1);
+    if (payload != NULL) {
       os_free(payload);
     }
+  } else if (ws->rxFrameLength == 0) {
+    ws_deliver(ws, "", 0, opCode, 1); // the end of the message carried no data
+  }
+}
 
-    bufOffset += payloadLength;
-    NODE_DBG("bufOffset %d \n", bufOffset);
-    if (bufOffset == len) { // (bufOffset > len) won't happen here because it's being checked earlier
-      b = NULL;
-      if (ws->frameBuffer != NULL) { // the last frame inside buffer was processed
-        os_free(ws->frameBuffer);
-        ws->frameBuffer = NULL;
-        ws->frameBufferLen = 0;
-      }
-    } else {
-      len -= bufOffset;
-      b += bufOffset; // move b to next frame
-      if (ws->frameBuffer != NULL) {
-        NODE_DBG("Reallocing frameBuffer to remove consumed frame\n");
-
-        ws->frameBuffer = realloc(ws->frameBuffer, ws->frameBufferLen + len);
-        if (ws->frameBuffer == NULL) {
-          NODE_DBG("Failed to allocate new frame buffer, disconnecting...\n");
-
-          ws->knownFailureCode = -14;
-          if (ws->isSecure)
-            espconn_secure_disconnect(conn);
-          else
-            espconn_disconnect(conn);
-          return;
-        }
-        memcpy(ws->frameBuffer + ws->frameBufferLen, b, len);
+// Frames are decoded as the data arrives, keeping the state of a frame split
+// over several segments in ws_info.  The payload is unmasked in place, and
+// passed on straight from the segment unless a message has to be assembled.
+static void ws_receiveCallback(void *arg, char *buf, unsigned short len) {
+  NODE_DBG("ws_receiveCallback %d \n", len);
+  struct espconn *conn = (struct espconn *) arg;
+  ws_info *ws = (ws_info *) conn->reverse;
+
+  ws->unhealthyPoints = 0; // received data, connection is healthy
+  os_timer_disarm(&ws->timeoutTimer); // reset ping check
+  os_timer_arm(&ws->timeoutTimer, WS_PING_INTERVAL_MS, true);
 
-        ws->frameBufferLen += len;
-        b = ws->frameBuffer;
+  while (len > 0 && ws->connectionState == 3) {
+    if (ws->rxHeaderLen < 2 || ws->rxHeaderLen < ws_headerLength(ws->rxHeader)) {
+      ws->rxHeader[ws->rxHeaderLen++] = *buf++;
+      len--;
+      if (ws->rxHeaderLen < 2 || ws->rxHeaderLen < ws_headerLength(ws->rxHeader)) {
+        continue;
       }
+      if (!ws_frameStart(conn, ws, len)) {
+        return;
+      }
+    } else {
+      unsigned short n = ws->rxPayloadLeft < len ? ws->rxPayloadLeft : len;
+      ws_framePayload(ws, buf, n);
+      buf += n;
+      len -= n;
+    }
+    if (ws->rxPayloadLeft == 0) {
+      ws_frameEnd(conn, ws);
     }
   }
 }
@@ -637,12 +598,9 @@ static void disconnect_callback(void *arg) {
     os_free(ws->expectedSecKey);
   }
 
-  if (ws->frameBuffer != NULL) {
-    os_free(ws->frameBuffer);
-  }
-
   if (ws->payloadBuffer != NULL) {
     os_free(ws->payloadBuffer);
+    ws->payloadBuffer = NULL;
   }
 
   if (conn->proto.tcp != NULL) {
@@ -803,8 +761,8 @@ void ws_connect(ws_info *ws, const char *url) {
   ws->path = strdup(path);
   ws->expectedSecKey = NULL;
   ws->knownFailureCode = 0;
-  ws->frameBuffer = NULL;
-  ws->frameBufferLen = 0;
+  ws->rxHeaderLen = 0;
+  ws->rxPayloadLeft = 0;
   ws->payloadBuffer = NULL;
   ws->payloadBufferLen = 0;
   ws->payloadOriginalOpCode = 0;
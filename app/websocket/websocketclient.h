@@ -40,7 +40,7 @@
 struct ws_info;
 
 typedef void (*ws_onConnectionCallback)(struct ws_info *wsInfo);
-typedef void (*ws_onReceiveCallback)(struct ws_info *wsInfo, int len, char *message, int opCode);
+typedef void (*ws_onReceiveCallback)(struct ws_info *wsInfo, int len, char *message, int opCode, int isLast);
 typedef void (*ws_onFailureCallback)(struct ws_info *wsInfo, int errorCode);
 
 typedef struct {
@@ -62,13 +62,30 @@ typedef struct ws_info {
   void *reservedData;
   int knownFailureCode;
 
-  char *frameBuffer;
-  int frameBufferLen;
-
+  // state of the frame being received
+  unsigned char rxHeader[14]; // up to 2 + 8 bytes of length + 4 bytes of mask
+  int rxHeaderLen;
+  int rxFin;
+  int rxOpCode;
+  int rxMasked;
+  unsigned char rxMask[4];
+  int rxMaskPos;
+  uint32_t rxFrameLength;
+  uint32_t rxPayloadLeft;
+  int rxDirect; // payload passed on without being copied
+  char rxControl[125]; // payload of a control frame
+  int rxControlLen;
+
+  // message assembled from several segments or frames
   char *payloadBuffer;
   int payloadBufferLen;
   int payloadOriginalOpCode;
 
+  // if > 0, messages are passed to onReceive in pieces of at most this size as they arrive
+  int chunkSize;
+  // if > 0, the largest message collected in full, otherwise the free heap
+  int maxMessageSize;
+
   os_timer_t  timeoutTimer;
   int unhealthyPoints;
 
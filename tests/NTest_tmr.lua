@@ -90,6 +90,93 @@ N.testco('AUTO alarm coroutine', function(getCB, waitCB)
   ok(true, "coroutine end")
 end)
 
+-- The following also exercise the timing wheel if the firmware has TMR_WHEEL.
+-- Its ticks are whole mS, so a timer may fire up to 1 mS early.
+
+N.testasync('timers fire in order of expiry', function(next)
+  local fired = {}
+  local delays = {50, 10, 40, 20, 30}
+  for _, d in ipairs(delays) do
+    tmr.create():alarm(d, tmr.ALARM_SINGLE, function()
+      fired[#fired + 1] = d
+      if #fired == #delays then
+        ok(eq(fired, {10, 20, 30, 40, 50}), "fired in order")
+        next()
+      end
+    end)
+  end
+end)
+
+N.testasync('re-arm from the callback', function(next)
+  local t = tmr.create()
+  local count = 0
+  local function cb(timer)
+    count = count + 1
+    if count < 3 then
+      timer:alarm(10 * count, tmr.ALARM_SINGLE, cb)
+      return
+    end
+    ok(eq(t, timer), "same tmr instance")
+    nok(timer:state(), "released after the last SINGLE alarm")
+    next()
+  end
+  t:alarm(10, tmr.ALARM_SINGLE, cb)
+end)
+
+N.testasync('unregister while pending', function(next)
+  local t1, t2 = tmr.create(), tmr.create()
+  local fired = false
+  t1:alarm(20, tmr.ALARM_SINGLE, function() fired = true end)
+  t1:unregister()
+  nok(t1:state(), "unregistered timer has no state")
+  t2:alarm(50, tmr.ALARM_SINGLE, function()
+    nok(fired, "unregistered timer did not fire")
+    next()
+  end)
+end)
+
+N.testasync('unregister a timer due in the same batch', function(next)
+  local ta, tb = tmr.create(), tmr.create()
+  local count = 0
+  ta:alarm(30, tmr.ALARM_SINGLE, function() count = count + 1; tb:unregister() end)
+  tb:alarm(30, tmr.ALARM_SINGLE, function() count = count + 1; ta:unregister() end)
+  tmr.create():alarm(100, tmr.ALARM_SINGLE, function()
+    ok(eq(count, 1), "only one of the two fired")
+    next()
+  end)
+end)
+
+N.testasync('AUTO interval accuracy', function(next)
+  local interval, runs = 20, 10
+  local last, count = tmr.now(), 0
+  local start = last
+  tmr.create():alarm(interval, tmr.ALARM_AUTO, function(t)
+    local now = tmr.now()
+    local gap = (now - last) % 0x80000000  -- tmr.now() wraps at 2^31 uS
+    last, count = now, count + 1
+    ok(gap >= (interval - 1) * 1000, "interval " .. count .. " not early: " .. gap .. " uS")
+    if count == runs then
+      t:unregister()
+      local total = (now - start) % 0x80000000
+      ok(total >= (interval * runs - 1) * 1000, "no drift ahead: " .. total .. " uS")
+      next()
+    end
+  end)
+end)
+
+if tmr.wheel then
+  N.testasync('wheel statistics', function(next)
+    local tol = tmr.wheel().tolerance
+    local before = tmr.wheel(1).fired
+    ok(eq(tmr.wheel().tolerance, 1), "tolerance set")
+    tmr.create():alarm(10, tmr.ALARM_SINGLE, function()
+      ok(tmr.wheel().fired > before, "expiry counted")
+      tmr.wheel(tol)
+      next()
+    end)
+  end)
+end
+
 N.test('softwd set positive and negative values', function()
   tmr.softwd(22)
   tmr.softwd(0)
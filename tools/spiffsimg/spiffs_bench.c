@@ -0,0 +1,167 @@
+/*
+ * Host benchmark for SPIFFS file lookups by name.
+ *
+ * Builds a file system laid out as on the device (256 byte pages, 8 KiB
+ * blocks, a four page cache) in RAM, fills it with an increasing number of
+ * small files and times SPIFFS_stat() of existing and missing names.  The
+ * flash reads issued per lookup are counted as well, as on the device these
+ * rather than the host CPU time dominate.  Build it with and without
+ * SPIFFS_NAME_CACHE ("make bench") to compare.
+ *
+ * Usage: spiffs_bench [-s fs_size] [-n lookups] [count ...]
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "spiffs.h"
+#include "spiffs_nucleus.h"
+
+#define LOG_PAGE_SIZE   256
+#define LOG_BLOCK_SIZE  0x2000
+#define ERASE_SIZE      0x1000
+
+static spiffs fs;
+static uint8_t *flash;
+static uint32_t flash_size = 3 * 1024 * 1024;
+
+static u8_t spiffs_work_buf[LOG_PAGE_SIZE*2];
+static u8_t spiffs_fds[sizeof(spiffs_fd) * 4];
+static u8_t myspiffs_cache[20 + (LOG_PAGE_SIZE+20)*4];
+
+static unsigned long rd_calls, rd_bytes;
+
+static s32_t flash_read (u32_t addr, u32_t size, u8_t *dst) {
+  rd_calls++;
+  rd_bytes += size;
+  memcpy (dst, flash + addr, size);
+  return SPIFFS_OK;
+}
+
+static s32_t flash_write (u32_t addr, u32_t size, u8_t *src) {
+  memcpy (flash + addr, src, size);
+  return SPIFFS_OK;
+}
+
+static s32_t flash_erase (u32_t addr, u32_t size) {
+  memset (flash + addr, 0xff, size);
+  return SPIFFS_OK;
+}
+
+static double now_us (void) {
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void fs_create (void) {
+  spiffs_config cfg;
+
+  memset (flash, 0xff, flash_size);
+  memset (&cfg, 0, sizeof(cfg));
+  cfg.phys_size = flash_size;
+  cfg.phys_addr = 0;
+  cfg.phys_erase_block = ERASE_SIZE;
+  cfg.log_block_size = LOG_BLOCK_SIZE;
+  cfg.log_page_size = LOG_PAGE_SIZE;
+  cfg.hal_read_f = flash_read;
+  cfg.hal_write_f = flash_write;
+  cfg.hal_erase_f = flash_erase;
+
+  SPIFFS_mount (&fs, &cfg, spiffs_work_buf, spiffs_fds, sizeof(spiffs_fds),
+                myspiffs_cache, sizeof(myspiffs_cache), 0);
+  SPIFFS_unmount (&fs);
+  if (SPIFFS_format (&fs) != 0 ||
+      SPIFFS_mount (&fs, &cfg, spiffs_work_buf, spiffs_fds, sizeof(spiffs_fds),
+                    myspiffs_cache, sizeof(myspiffs_cache), 0) != 0) {
+    fprintf (stderr, "cannot create file system\n");
+    exit (1);
+  }
+}
+
+static void file_name (char *buf, int i) {
+  sprintf (buf, "dir%d/file-%04d.txt", i % 8, i);
+}
+
+static void bench (int count, int lookups) {
+  char name[SPIFFS_OBJ_NAME_LEN];
+  spiffs_stat s;
+  double t_hit, t_miss;
+  unsigned long rd_hit, rd_miss;
+  int i;
+
+  fs_create ();
+  for (i = 0; i < count; i++) {
+    file_name (name, i);
+    spiffs_file fh = SPIFFS_open (&fs, name, SPIFFS_CREAT | SPIFFS_RDWR, 0);
+    if (fh < 0 || SPIFFS_write (&fs, fh, name, strlen (name)) < 0) {
+      fprintf (stderr, "cannot create %s: %d\n", name, SPIFFS_errno (&fs));
+      exit (1);
+    }
+    SPIFFS_close (&fs, fh);
+  }
+
+  srand (count);
+  rd_calls = rd_bytes = 0;
+  t_hit = now_us ();
+  for (i = 0; i < lookups; i++) {
+    file_name (name, rand () % count);
+    if (SPIFFS_stat (&fs, name, &s) != SPIFFS_OK) {
+      fprintf (stderr, "lookup of %s failed\n", name);
+      exit (1);
+    }
+  }
+  t_hit = (now_us () - t_hit) / lookups;
+  rd_hit = rd_calls;
+
+  rd_calls = 0;
+  t_miss = now_us ();
+  for (i = 0; i < lookups; i++) {
+    file_name (name, count + i);
+    if (SPIFFS_stat (&fs, name, &s) != SPIFFS_ERR_NOT_FOUND) {
+      fprintf (stderr, "lookup of %s did not fail\n", name);
+      exit (1);
+    }
+  }
+  t_miss = (now_us () - t_miss) / lookups;
+  rd_miss = rd_calls;
+
+  printf ("%6d %12.2f %10.1f %12.2f %10.1f\n", count,
+          t_hit, (double)rd_hit / lookups, t_miss, (double)rd_miss / lookups);
+  SPIFFS_unmount (&fs);
+}
+
+int main (int argc, char *argv[]) {
+  static const int def_counts[] = { 10, 50, 100, 200, 400, 800 };
+  int lookups = 2000, opt, i;
+
+  while ((opt = getopt (argc, argv, "s:n:")) != -1) {
+    switch (opt) {
+      case 's': flash_size = strtoul (optarg, 0, 0); break;
+      case 'n': lookups = atoi (optarg); break;
+      default:
+        fprintf (stderr, "Usage: %s [-s fs_size] [-n lookups] [count ...]\n", argv[0]);
+        return 1;
+    }
+  }
+  if (!(flash = malloc (flash_size))) {
+    return 1;
+  }
+
+  printf ("SPIFFS_NAME_CACHE %d, fs size %u, %d lookups per count\n",
+          SPIFFS_NAME_CACHE, flash_size, lookups);
+  printf ("%6s %12s %10s %12s %10s\n", "files", "found us", "reads", "missing us", "reads");
+  if (optind < argc) {
+    for (i = optind; i < argc; i++) {
+      bench (atoi (argv[i]), lookups);
+    }
+  } else {
+    for (i = 0; i < (int)(sizeof(def_counts)/sizeof(def_counts[0])); i++) {
+      bench (def_counts[i], lookups);
+    }
+  }
+  free (flash);
+  return 0;
+}